@@ -0,0 +1,162 @@
+/* config workload benchmark
+ *
+ * loads a Cube style configuration (config.cube by default) into a state
+ * along with stubs of the commands an engine would provide, then runs the
+ * hud_frame alias once per frame like a game would, opening one of the
+ * menus every so often; reports the time taken to load the configuration
+ * and the cost of a frame
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+using bench_clock = std::chrono::steady_clock;
+
+static double ms_since(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>{
+        bench_clock::now() - start
+    }.count();
+}
+
+static std::unique_ptr<char[]> read_file(char const *fname, std::size_t &len) {
+    FILE *f = std::fopen(fname, "rb");
+    if (!f) {
+        return nullptr;
+    }
+    std::fseek(f, 0, SEEK_END);
+    len = std::size_t(std::ftell(f));
+    std::fseek(f, 0, SEEK_SET);
+    auto buf = std::make_unique<char[]>(len + 1);
+    if (std::fread(buf.get(), 1, len, f) != len) {
+        std::fclose(f);
+        return nullptr;
+    }
+    std::fclose(f);
+    buf[len] = '\0';
+    return buf;
+}
+
+/* what an engine would do with the arguments is of no interest here, but
+ * they are consumed so that producing them cannot be skipped
+ */
+static std::size_t sink = 0;
+
+static void engine_commands(cs::state &gcs, std::vector<cs::bcode_ref> &menus) {
+    auto consume = [](auto &css, auto args, auto &) {
+        for (auto &v: args) {
+            sink += v.get_string(css).size();
+        }
+    };
+    for (auto *name: {
+        "bind", "editbind", "editaction", "hudtext", "say", "guitext"
+    }) {
+        gcs.new_command(name, "...", consume);
+    }
+    gcs.new_command("guibutton", "...", consume);
+    gcs.new_command("guibar", "", [](auto &, auto, auto &) {
+        ++sink;
+    });
+    gcs.new_command("guilist", "b", [](auto &css, auto args, auto &) {
+        args[0].get_code().call(css);
+    });
+    gcs.new_command("newgui", "sb", [&menus](
+        auto &css, auto args, auto &
+    ) {
+        sink += args[0].get_string(css).size();
+        menus.push_back(args[1].get_code());
+    });
+    gcs.new_command("showgui", "s", consume);
+    gcs.new_command("cleargui", "", [](auto &, auto, auto &) {
+        ++sink;
+    });
+}
+
+static void print_usage(char const *progname) {
+    std::fprintf(
+        stderr, "usage: %s [-n frames] [config]\n"
+        "  -n frames  number of frames to run (default 10000)\n",
+        progname
+    );
+}
+
+int main(int argc, char **argv) {
+    long frames = 10000;
+    char const *path = "config.cube";
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "-n") && ((i + 1) < argc)) {
+            frames = std::strtol(argv[++i], nullptr, 10);
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (frames < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::size_t len;
+    auto src = read_file(path, len);
+    if (!src) {
+        std::fprintf(stderr, "cannot read file: %s\n", path);
+        return 1;
+    }
+
+    cs::state gcs;
+    cs::std_init_all(gcs);
+    /* the menus hold code, so they must go away before the state */
+    std::vector<cs::bcode_ref> menus;
+    engine_commands(gcs, menus);
+
+    std::vector<double> times;
+    times.reserve(std::size_t(frames));
+    try {
+        auto start = bench_clock::now();
+        gcs.compile(std::string_view{src.get(), len}, path).call(gcs);
+        auto load = ms_since(start);
+        auto fid = gcs.get_ident("hud_frame");
+        if (!fid || (fid->get().type() != cs::ident_type::ALIAS)) {
+            std::fprintf(stderr, "%s does not define hud_frame\n", path);
+            return 1;
+        }
+        auto &frame = static_cast<cs::alias &>(fid->get());
+        for (long i = 0; i < frames; ++i) {
+            start = bench_clock::now();
+            frame.call(cs::span_type<cs::any_value>{}, gcs);
+            if (!menus.empty() && !(i % 60)) {
+                /* somebody opened a menu */
+                menus[std::size_t(i / 60) % menus.size()].call(gcs);
+            }
+            times.push_back(ms_since(start));
+        }
+        std::sort(times.begin(), times.end());
+        double total = 0;
+        for (auto t: times) {
+            total += t;
+        }
+        auto pct = [&times](double p) {
+            return times[std::size_t(double(times.size() - 1) * p)];
+        };
+        std::printf("load:   %.3f ms\n", load);
+        std::printf(
+            "frames: %ld, mean %.4f ms, median %.4f ms, p99 %.4f ms, "
+            "max %.4f ms\n", frames, total / double(frames), pct(0.5),
+            pct(0.99), times.back()
+        );
+    } catch (cs::error const &e) {
+        std::string_view msg = e.what();
+        std::fprintf(stderr, "error: %.*s\n", int(msg.size()), msg.data());
+        return 1;
+    }
+    return (sink != 0) ? 0 : 1;
+}
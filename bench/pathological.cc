@@ -0,0 +1,232 @@
+/* latency benchmark over adversarial inputs
+ *
+ * every input is generated at a base size and at twice that size, and the
+ * compile time, execution time and peak memory of a fresh state are taken
+ * for each; the ratio between the two sizes shows how the cost grows, so
+ * anything close to 4 or above points to quadratic behaviour
+ *
+ * each case has a limit on both ratios; going over it fails the run, unless
+ * the growth is already known, in which case it is only reported
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+struct mem_counter {
+    std::size_t cur = 0;
+    std::size_t peak = 0;
+};
+
+static void *counting_alloc(
+    void *data, void *p, std::size_t os, std::size_t ns
+) {
+    auto *mc = static_cast<mem_counter *>(data);
+    mc->cur = mc->cur - os + ns;
+    if (mc->cur > mc->peak) {
+        mc->peak = mc->cur;
+    }
+    if (!ns) {
+        std::free(p);
+        return nullptr;
+    }
+    return std::realloc(p, ns);
+}
+
+/* deeply nested blocks, both as a string and as code; compiling the nested
+ * code is known to be quadratic in the depth (about x4 per doubling)
+ */
+static void gen_nested(std::string &s, std::size_t n) {
+    s += "x = ";
+    s.append(n, '[');
+    s += "result 1";
+    s.append(n, ']');
+    s += "; ";
+    for (std::size_t i = 0; i < n; ++i) {
+        s += "do [";
+    }
+    s += "result 1";
+    s.append(n, ']');
+}
+
+/* a single line with very many statements */
+static void gen_long_line(std::string &s, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        s += "x = (+ " + std::to_string(i) + " 1); ";
+    }
+}
+
+/* a huge list with heavy quoting and nesting, then walked */
+static void gen_list(std::string &s, std::size_t n) {
+    s += "l = [";
+    for (std::size_t i = 0; i < n; ++i) {
+        s += "\"it^\"em^t" + std::to_string(i) + "\" [sub ";
+        s += std::to_string(i) + " [deep]] ";
+    }
+    s += "]; n = (listlen $l); c = 0; looplist v $l [c = (+ $c 1)]; ";
+    s += "x = (at $l (div $n 2)); y = (listfind v $l [=s $v deep])";
+}
+
+/* macro substitution through as many levels as there are blocks */
+static void gen_macro(std::string &s, std::size_t n) {
+    s += "a = 1; r = ";
+    s.append(n, '[');
+    s.append(n, '@');
+    s += "a";
+    s.append(n, ']');
+}
+
+/* alias recursion close to the call depth limit */
+static void gen_recursion(std::string &s, std::size_t n) {
+    s += "rec = [if (> $arg1 0) [rec (- $arg1 1)] [result 0]]; rec ";
+    s += std::to_string(n);
+}
+
+/* very many unique ident names, assigned and then looked up */
+static void gen_idents(std::string &s, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        s += "id_" + std::to_string(i) + " = " + std::to_string(i) + "\n";
+    }
+    for (std::size_t i = 0; i < n; i += 2) {
+        s += "x = $id_" + std::to_string(i) + "\n";
+    }
+}
+
+/* linear cases should double; leave room for noise, but not for n^2 */
+static constexpr double linear_limit = 3.2;
+
+struct bench_case {
+    char const *name;
+    void (*gen)(std::string &, std::size_t);
+    std::size_t size;
+    double max_compile;
+    double max_exec;
+    /* the growth is known and only reported when over the limit */
+    bool known = false;
+};
+
+static bench_case const cases[] = {
+    {"nested_blocks", gen_nested,    2000, linear_limit, linear_limit, true},
+    {"long_line",     gen_long_line, 20000, linear_limit, linear_limit},
+    {"quoted_list",   gen_list,      20000, linear_limit, linear_limit},
+    {"macro_levels",  gen_macro,     2000, linear_limit, linear_limit},
+    {"deep_recursion", gen_recursion, 1000, linear_limit, linear_limit},
+    {"unique_idents", gen_idents,    20000, linear_limit, linear_limit},
+};
+
+/* timings shorter than this are too noisy to check the growth of */
+static constexpr double min_checked_ms = 5;
+
+struct bench_result {
+    double compile_ms = 0;
+    double exec_ms = 0;
+    std::size_t peak = 0;
+    bool failed = false;
+};
+
+using bench_clock = std::chrono::steady_clock;
+
+static double ms_since(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>{
+        bench_clock::now() - start
+    }.count();
+}
+
+static bench_result run_case(bench_case const &c, std::size_t n) {
+    std::string src;
+    c.gen(src, n);
+    mem_counter mc;
+    bench_result res;
+    {
+        cs::state gcs{counting_alloc, &mc};
+        cs::std_init_all(gcs);
+        /* recursion takes two VM frames per level (alias and block) */
+        gcs.max_call_depth(2 * n + 64);
+        auto base = mc.cur;
+        mc.peak = base;
+        try {
+            auto start = bench_clock::now();
+            auto code = gcs.compile(src);
+            res.compile_ms = ms_since(start);
+            start = bench_clock::now();
+            code.call(gcs);
+            res.exec_ms = ms_since(start);
+        } catch (cs::error const &e) {
+            auto msg = e.what();
+            std::fprintf(
+                stderr, "%s: %.*s\n", c.name, int(msg.size()), msg.data()
+            );
+            res.failed = true;
+        }
+        res.peak = mc.peak - base;
+    }
+    return res;
+}
+
+static double ratio(double a, double b) {
+    return (a > 0) ? (b / a) : 0;
+}
+
+/* whether the growth from a to b goes over the limit */
+static bool over_limit(double a, double b, double limit) {
+    return (b >= min_checked_ms) && (ratio(a, b) > limit);
+}
+
+int main(int argc, char **argv) {
+    /* optionally scale all the inputs, e.g. for a quick run */
+    double scale = 1;
+    if (argc > 1) {
+        scale = std::strtod(argv[1], nullptr);
+        if (scale <= 0) {
+            std::fprintf(stderr, "usage: %s [scale]\n", argv[0]);
+            return 1;
+        }
+    }
+    std::printf(
+        "%-16s %8s %10s %10s %10s %7s %7s\n",
+        "case", "size", "compile", "exec", "peak", "x2 cmp", "x2 exec"
+    );
+    bool failed = false;
+    bool slow = false;
+    for (auto &c: cases) {
+        auto n = std::size_t(double(c.size) * scale);
+        if (!n) {
+            n = 1;
+        }
+        auto r1 = run_case(c, n);
+        auto r2 = run_case(c, n * 2);
+        failed = failed || r1.failed || r2.failed;
+        for (auto *r: {&r1, &r2}) {
+            std::printf(
+                "%-16s %8zu %8.3fms %8.3fms %9zuk",
+                c.name, (r == &r1) ? n : n * 2,
+                r->compile_ms, r->exec_ms, r->peak / 1024
+            );
+            if (r == &r2) {
+                std::printf(
+                    " %7.2f %7.2f", ratio(r1.compile_ms, r2.compile_ms),
+                    ratio(r1.exec_ms, r2.exec_ms)
+                );
+                bool over = over_limit(
+                    r1.compile_ms, r2.compile_ms, c.max_compile
+                ) || over_limit(r1.exec_ms, r2.exec_ms, c.max_exec);
+                if (over && c.known) {
+                    std::printf(" (known)");
+                } else if (over) {
+                    std::printf(" SLOW");
+                    slow = true;
+                }
+            }
+            std::printf("\n");
+        }
+    }
+    if (slow) {
+        std::fprintf(stderr, "some inputs grow faster than their limit\n");
+    }
+    return (failed || slow) ? 1 : 0;
+}
@@ -107,6 +107,8 @@ public:
             p_func = as_base(&p_stor);
             f.p_func->move_to(p_func);
         } else {
+            /* the allocator is needed to free it later */
+            std::memcpy(&p_stor, &f.p_stor, sizeof(p_stor));
             p_func = f.p_func;
             f.p_func = nullptr;
         }
@@ -147,6 +149,8 @@ public:
             p_func = as_base(&p_stor);
             f.p_func->move_to(p_func);
         } else {
+            /* the allocator is needed to free it later */
+            std::memcpy(&p_stor, &f.p_stor, sizeof(p_stor));
             p_func = f.p_func;
             f.p_func = nullptr;
         }
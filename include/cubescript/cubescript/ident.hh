@@ -12,6 +12,7 @@
 #ifndef LIBCUBESCRIPT_CUBESCRIPT_IDENT_HH
 #define LIBCUBESCRIPT_CUBESCRIPT_IDENT_HH
 
+#include <cstdint>
 #include <string_view>
 
 #include "value.hh"
@@ -237,6 +238,20 @@ struct LIBCUBESCRIPT_EXPORT alias: ident {
      */
     any_value call(span_type<any_value> args, state &cs);
 
+    /** @brief Compile the alias for the given thread.
+     *
+     * Aliases are normally compiled the first time they are called. This
+     * generates the code for the current value ahead of time instead, so
+     * that the first call does not pay for it. Assigning a new value will
+     * discard the code again.
+     *
+     * @return `true` if the alias has code now, `false` if it has no value
+     * @throw cubescript::error on compilation failure
+     *
+     * @see state::precompile_aliases()
+     */
+    bool compile(state &cs);
+
 protected:
     alias() = default;
 };
@@ -268,6 +283,23 @@ protected:
     command() = default;
 };
 
+/** @brief Usage counters of an ident.
+ *
+ * These are collected while usage tracking is enabled on the state, see
+ * state::track_usage(). Calls count invocations of aliases and commands,
+ * lookups count reads of aliases and variables, and assignments count
+ * writes to aliases and variables.
+ *
+ * The time of a call includes everything called from it, so with recursion
+ * the same time is counted at every level.
+ */
+struct ident_usage {
+    std::size_t calls = 0;   /**< @brief Number of calls. */
+    std::size_t lookups = 0; /**< @brief Number of lookups. */
+    std::size_t assigns = 0; /**< @brief Number of assignments. */
+    std::uint64_t call_ns = 0; /**< @brief Time spent in calls. */
+};
+
 /** @brief A safe alias handler for commands
  *
  * In general, when dealing with aliases in commands, you do not want to
@@ -12,6 +12,7 @@
 #define LIBCUBESCRIPT_CUBESCRIPT_STATE_HH
 
 #include <cstddef>
+#include <cstdint>
 #include <utility>
 #include <optional>
 #include <functional>
@@ -62,6 +63,24 @@ using alloc_func = void *(*)(void *, void *, size_t, size_t);
  */
 using hook_func = internal::callable<void, state &>;
 
+/** @brief Debug hook events
+ *
+ * Every thread can have one debug hook per event, see state::debug_hook().
+ */
+enum class hook_event {
+    CALL = 0, /**< @brief An alias or a command is about to be called. */
+    RETURN,   /**< @brief An alias or a command has returned normally. */
+    COUNT     /**< @brief A number of VM instructions have been run. */
+};
+
+/** @brief A debug hook function
+ *
+ * It receives the thread and the alias or command being called or returned
+ * from. Count hooks receive the innermost alias being run, if any, and
+ * `nullptr` otherwise.
+ */
+using debug_hook_func = internal::callable<void, state &, ident *>;
+
 /** @brief A command function
  *
  * This is how every command looks. It returns nothing and takes the thread
@@ -71,6 +90,65 @@ using command_func = internal::callable<
     void, state &, span_type<any_value>, any_value &
 >;
 
+/** @brief A list source function
+ *
+ * This produces the items of a list source (see state::new_source()). It
+ * takes the thread reference, the position of the consumer and a reference
+ * to store the item in. The position starts at zero and its meaning is up
+ * to the function, which advances it past the item it stores. Once there
+ * are no more items, it returns `false`.
+ */
+using source_func = internal::callable<
+    bool, state &, std::size_t &, any_value &
+>;
+
+/** @brief A snapshot of runtime statistics
+ *
+ * This is what state::stats() returns. The counters are shared by all
+ * threads of a state and count from its creation. Peaks are the highest
+ * values seen by any thread upon entering the VM.
+ */
+struct state_stats {
+    std::size_t vars = 0;        /**< @brief Number of variables. */
+    std::size_t commands = 0;    /**< @brief Number of commands. */
+    std::size_t aliases = 0;     /**< @brief Number of aliases. */
+    std::size_t specials = 0;    /**< @brief Number of special idents. */
+    std::size_t strings = 0;     /**< @brief Number of live strings. */
+    std::size_t pooled = 0;      /**< @brief Live strings in the pool. */
+    std::size_t string_bytes = 0; /**< @brief Memory used by strings. */
+    /** @brief Number of live bytecode blocks (not counting shared code). */
+    std::size_t code_blocks = 0;
+    std::size_t code_bytes = 0;  /**< @brief Memory used by the blocks. */
+    std::size_t peak_depth = 0;  /**< @brief Peak call depth. */
+    std::size_t peak_vmstack = 0; /**< @brief Peak size of the VM stack. */
+    /** @brief Peak size of the alias stack (pushed aliases and args). */
+    std::size_t peak_idstack = 0;
+    std::size_t compiles = 0;    /**< @brief Number of compilations. */
+    /** @brief Time spent in state::compile() and state::compile_shared(). */
+    std::uint64_t compile_ns = 0;
+    std::size_t errors = 0;      /**< @brief Number of errors raised. */
+    /** @brief Strings found in the pool when interning. */
+    std::size_t intern_hits = 0;
+    /** @brief Strings added to the pool when interning. */
+    std::size_t intern_misses = 0;
+    /** @brief Alias calls which had compiled code at hand. */
+    std::size_t code_hits = 0;
+    /** @brief Alias calls which had to compile first. */
+    std::size_t code_misses = 0;
+    /** @brief Alias assignments of the same body, keeping the code. */
+    std::size_t code_kept = 0;
+    /** @brief Blocks and compiles that reused identical code. */
+    std::size_t code_dedups = 0;
+    /** @brief Shared code runs which found their ident table cached. */
+    std::size_t shared_hits = 0;
+    /** @brief Shared code runs which had to resolve their idents. */
+    std::size_t shared_misses = 0;
+    /** @brief Regular expressions found compiled in the cache. */
+    std::size_t regex_hits = 0;
+    /** @brief Regular expressions which had to be compiled. */
+    std::size_t regex_misses = 0;
+};
+
 /** @brief The Cubescript thread
  *
  * Represents a Cubescript thread, either the main thread or a side thread
@@ -139,6 +217,7 @@ struct LIBCUBESCRIPT_EXPORT state {
      * The call hook is called every time the VM is entered. You can use
      * this for debugging and other tracking, or say, as a means of
      * interrupting execution from the side in an interactive interpreter.
+     * For calls, returns and instruction counts, see debug_hook().
      */
     template<typename F>
     hook_func call_hook(F &&f) {
@@ -153,6 +232,43 @@ struct LIBCUBESCRIPT_EXPORT state {
     /** @brief Get a reference to the call hook */
     hook_func &call_hook();
 
+    /** @brief Attach a debug hook for an event to the thread
+     *
+     * Setting a hook enables its event and setting `nullptr` disables it;
+     * the VM only tests the event mask while an event is disabled, so hooks
+     * cost nothing when not used. Hooks are not run for the code they run
+     * themselves. A hook may throw, e.g. to stop a runaway script, and may
+     * replace or remove itself.
+     *
+     * @return the previous hook
+     */
+    template<typename F>
+    debug_hook_func debug_hook(hook_event ev, F &&f) {
+        return debug_hook(
+            ev, debug_hook_func{std::forward<F>(f), callable_alloc, this}
+        );
+    }
+
+    /** @brief Get a reference to the debug hook for an event */
+    debug_hook_func const &debug_hook(hook_event ev) const;
+
+    /** @brief Get the events with a debug hook attached
+     *
+     * The mask has the bit `1 << int(ev)` set for every such event.
+     */
+    unsigned int hook_mask() const;
+
+    /** @brief Get the number of instructions between count hooks. */
+    std::size_t hook_count() const;
+
+    /** @brief Set the number of instructions between count hooks
+     *
+     * This also restarts the count. The default is 1000, zero is taken as 1.
+     *
+     * @return the old value
+     */
+    std::size_t hook_count(std::size_t n);
+
     /** @brief Clear override state for the given ident
      *
      * If the ident is overridden, clear the flag. Global variables will have
@@ -397,6 +513,27 @@ struct LIBCUBESCRIPT_EXPORT state {
         );
     }
 
+    /** @brief Create a list source.
+     *
+     * The result is a value_type::SOURCE value, which list commands iterate
+     * by calling the given function instead of parsing a string. This lets
+     * you hand ranges, host containers and the like to scripts without
+     * building the whole list first. The function must be able to restart
+     * from position zero at any time, as every consumer walks the source
+     * on its own.
+     *
+     * The function is called whenever the list is needed in full as well,
+     * such as when it is converted to a string. It may be kept alive by
+     * aliases until the main thread is destroyed, so anything it refers to
+     * must live as long.
+     */
+    template<typename F>
+    any_value new_source(F &&f) {
+        return new_source(
+            source_func{std::forward<F>(f), shared_alloc, shared_data()}
+        );
+    }
+
     /** @brief Compile a string.
      *
      * This compiles the given string, optionally using `source` as a filename
@@ -409,6 +546,210 @@ struct LIBCUBESCRIPT_EXPORT state {
         std::string_view v, std::string_view source = std::string_view{}
     );
 
+    /** @brief Compile a string into shareable bytecode.
+     *
+     * This is like compile(), except the result does not refer to the
+     * idents of this state directly. The idents it uses are recorded by
+     * name and resolved separately in every main state the bytecode is
+     * executed in, the first time that happens. The reference count is
+     * atomic and the bytecode is never modified, so it may be executed by
+     * any number of main states, each on its own OS thread if desired.
+     *
+     * The bytecode is freed using the allocation function of this state,
+     * which (along with its data) must remain usable until then, but the
+     * state itself may be destroyed earlier.
+     *
+     * Executing it raises an error if an ident it uses is of a different
+     * kind in the executing state, for example a command with another
+     * argument list or a variable of another type. Aliases are created
+     * as needed.
+     *
+     * @return a bytecode reference
+     * @throw cubescript::error on compilation failure
+     */
+    bcode_ref compile_shared(
+        std::string_view v, std::string_view source = std::string_view{}
+    );
+
+    /** @brief Get the image of shared bytecode.
+     *
+     * Bytecode made by compile_shared() contains no pointers and does not
+     * refer to the idents of any particular state, so it can be stored
+     * and used by other processes running the same build of the library.
+     * The image consists of a small header followed by the bytecode and
+     * is meant to be used with load_code_image() or map_code_image(). The
+     * `cubescript-embed` tool makes images of scripts at build time and
+     * writes them into a header as arrays for load_code_image().
+     *
+     * If `buf` is not null and `bufsize` is large enough, the image is
+     * written into it.
+     *
+     * @return the size of the image in bytes
+     * @throw cubescript::error if the bytecode is not shared
+     */
+    std::size_t code_image(
+        bcode_ref const &code, void *buf, std::size_t bufsize
+    );
+
+    /** @brief Use a bytecode image in place.
+     *
+     * The image is checked and used directly, without making a copy. It is
+     * never written to, so it may live in read-only memory, but it must be
+     * aligned to 4 bytes and stay valid and unchanged until the main state
+     * is destroyed; references to the bytecode must not outlive it either.
+     *
+     * @return a bytecode reference
+     * @throw cubescript::error if the image is malformed or incompatible
+     */
+    bcode_ref load_code_image(void const *data, std::size_t size);
+
+    /** @brief Map a bytecode image file.
+     *
+     * This is like load_code_image(), but the image is read from a file.
+     * Where supported, the file is mapped read-only and shared, so every
+     * process using the same image shares the same physical memory for
+     * it, with only the ident tables being per process; otherwise it is
+     * read into memory. The file remains mapped until the main state is
+     * destroyed.
+     *
+     * @return a bytecode reference
+     * @throw cubescript::error if the file cannot be read or is not a
+     * valid image
+     */
+    bcode_ref map_code_image(std::string_view path);
+
+    /** @brief Post code for the thread to run later.
+     *
+     * Unlike everything else, this may be called from any OS thread, while
+     * the thread may be running scripts. It takes no locks; the source and
+     * the arguments are copied into a single allocation made with the
+     * allocation function of the state, which must therefore be safe to
+     * call from other OS threads (the default one is).
+     *
+     * The posted items are run by run_posted(), in the order they were
+     * posted, with the arguments bound to `arg1` and on like in an alias
+     * call. The source is only compiled then.
+     */
+    void post(
+        std::string_view code,
+        span_type<std::string_view const> args =
+            span_type<std::string_view const>{}
+    );
+
+    /** @brief Post bytecode for the thread to run later.
+     *
+     * This is like the other post(), but with compiled code, which must be
+     * shared (see compile_shared()), as no other code may be referenced
+     * from other OS threads.
+     *
+     * @return false if the code is not shared, which posts nothing
+     */
+    bool post(
+        bcode_ref const &code,
+        span_type<std::string_view const> args =
+            span_type<std::string_view const>{}
+    );
+
+    /** @brief Run the code posted to the thread.
+     *
+     * This runs everything posted so far as one batch and is meant to be
+     * called by the thread wherever running scripts is safe, e.g. once per
+     * frame. Items posted while it runs are left for the next call. If an
+     * item raises an error, it propagates and the items after it are kept
+     * for the next call as well. Results are discarded.
+     *
+     * @return the number of items run
+     */
+    std::size_t run_posted();
+
+    /** @brief Compile alias bodies ahead of time.
+     *
+     * This goes over the aliases visible to this thread and compiles those
+     * that have a value but no code yet, like alias::compile(). It is meant
+     * to be used after loading configuration, so that latency sensitive
+     * code does not have to compile aliases on first call.
+     *
+     * If `max` is not zero, at most `max` aliases are compiled and the next
+     * call resumes where this one stopped, which lets you spread the work
+     * over several frames. Aliases which fail to compile are skipped; their
+     * error is raised when they are called as usual.
+     *
+     * @return the number of aliases compiled
+     */
+    std::size_t precompile_aliases(std::size_t max = 0);
+
+    /** @brief Start recording the workload of this thread.
+     *
+     * While recording, what the host feeds into this thread is written
+     * into a log at `path`: the code it compiles and calls, the values it
+     * assigns, and the results of its commands. The vars, commands and
+     * aliases existing at the start are recorded too. The log can then be
+     * run with replay() to repeat the same work deterministically, e.g. to
+     * profile a real workload offline.
+     *
+     * Only calls made from outside of the language are recorded; code
+     * which is neither compiled by compile() nor shared is replayed as
+     * a no-op, and calls back into the language made by the host's own
+     * commands are represented by their effects. Any previous recording
+     * of this thread is stopped.
+     *
+     * @throw cubescript::error if the file cannot be created
+     */
+    void record(std::string_view path);
+
+    /** @brief Stop recording and close the log.
+     *
+     * This also happens when the thread is destroyed.
+     */
+    void stop_recording();
+
+    /** @brief Replay a recorded log.
+     *
+     * This is meant to be used with a fresh state that has the same parts
+     * of the standard library as the recorded one. The recorded vars and
+     * aliases are set up first, and the commands of the host are created
+     * as stubs, which reproduce what the original commands did by playing
+     * back their recorded results. Errors raised by replayed calls are
+     * ignored, like they were handled by the host when recording.
+     *
+     * @return the number of calls replayed
+     * @throw cubescript::error if the log cannot be read or the scripts
+     * do not match it
+     */
+    std::size_t replay(std::string_view path);
+
+    /** @brief Save an image of the state.
+     *
+     * This writes the idents of the state, as seen by this thread, into
+     * a file at `path`: the vars and aliases with their values and flags,
+     * the name and argument list of every command, and the body of every
+     * alias compiled as shared bytecode (see compile_shared()). Restoring
+     * the image with load_image() is much cheaper than running the scripts
+     * which set up the state, as nothing has to be parsed or compiled.
+     *
+     * Like bytecode images, state images only work with the same build of
+     * the library. List sources and vectors are saved as their strings.
+     *
+     * @throw cubescript::error if the file cannot be written
+     */
+    void save_image(std::string_view path);
+
+    /** @brief Restore an image of the state.
+     *
+     * The image made by save_image() is mapped (see map_code_image()) and
+     * its vars and aliases are created or assigned, with the compiled
+     * code of the aliases used in place. Commands are not a part of the
+     * image; the host must create its commands and the parts of the
+     * standard library it uses first, and they are matched to the image
+     * by name and argument list. Nothing is changed if one is missing or
+     * an ident is of another kind than in the image.
+     *
+     * @return the number of vars and aliases restored
+     * @throw cubescript::error if the file cannot be read, is not a valid
+     * image or does not match the state
+     */
+    std::size_t load_image(std::string_view path);
+
     /** @brief Get if the thread is in override mode
      *
      * If the thread is in override mode, any assigned alias or variable will
@@ -445,6 +786,97 @@ struct LIBCUBESCRIPT_EXPORT state {
     /** @brief Set the thread's persist mode */
     bool persist_mode(bool v);
 
+    /** @brief Get if compiled code is deduplicated */
+    bool dedup_code() const;
+
+    /** @brief Enable or disable deduplication of compiled code
+     *
+     * While enabled, a block that compiles to the same bytecode as an
+     * earlier block of the same code is replaced by a reference to it, and
+     * compiling anything that results in the same bytecode as code that is
+     * still alive gives another reference to that code rather than a copy.
+     * This makes compiling a little slower, in exchange for less memory
+     * used by configurations that repeat the same blocks in many places.
+     * The setting is shared by all threads of the state.
+     *
+     * @return the old value
+     */
+    bool dedup_code(bool v);
+
+    /** @brief Get if ident usage is being tracked */
+    bool track_usage() const;
+
+    /** @brief Enable or disable ident usage tracking
+     *
+     * While enabled, calls, lookups and assignments of every ident are
+     * counted, see cubescript::ident_usage. The counters are shared by all
+     * threads of the state and are kept when tracking is disabled, so that
+     * they can be exported with usage() later.
+     *
+     * @return the old value
+     */
+    bool track_usage(bool v);
+
+    /** @brief Get the ident usage counters
+     *
+     * The counters are indexed by ident index (see ident::index()). The
+     * span may be shorter than ident_count(), if idents were created while
+     * tracking was disabled; those have no usage recorded.
+     */
+    span_type<ident_usage const> usage() const;
+
+    /** @brief Reset all ident usage counters to zero */
+    void reset_usage();
+
+    /** @brief Get a snapshot of runtime statistics
+     *
+     * All of the numbers are maintained as things happen, so this only
+     * copies them and is cheap enough to be polled frequently.
+     */
+    state_stats stats() const;
+
+    /** @brief Write a report of what uses memory.
+     *
+     * This walks the string pool and the bytecode owned by aliases visible
+     * to this thread and writes a text report into a file at `path`. The
+     * report has totals and counts by size, the `top` largest and most
+     * referenced strings and the `top` largest aliases by code size. Code
+     * held by the host or otherwise not owned by an alias is summed up.
+     *
+     * Each line is a keyword followed by space separated fields, with
+     * strings quoted and escaped like in the language, so the report can
+     * be easily parsed and compared with an earlier one. The walk is not
+     * cheap, so this is meant for diagnostics rather than regular polling;
+     * see stats() for the latter.
+     *
+     * @throw cubescript::error if the file cannot be written
+     */
+    void heap_report(std::string_view path, std::size_t top = 10);
+
+    /** @brief Count the instructions of bytecode by opcode.
+     *
+     * This walks the given bytecode, including the blocks nested in it, and
+     * adds the number of instructions with each opcode to `counts`, which
+     * is indexed by opcode. Opcodes that do not fit in `counts` are only
+     * added to the total. The instruction set is internal to the library
+     * and may change between versions, so this is meant for inspection
+     * only; see opcode_name().
+     *
+     * @return the total number of instructions
+     */
+    std::size_t code_histogram(
+        bcode_ref const &code, span_type<std::size_t> counts
+    ) const;
+
+    /** @brief Get the number of opcodes of the VM. */
+    static std::size_t opcode_count();
+
+    /** @brief Get the name of an opcode.
+     *
+     * @return the name, or an empty view if out of range
+     */
+    static std::string_view opcode_name(std::size_t op);
+
     /** @brief Get the maximum call depth of the VM
      *
      * If zero, it is unlimited, otherwise it specifies how much the VM is
@@ -469,10 +901,14 @@ private:
 
     hook_func call_hook(hook_func func);
 
+    debug_hook_func debug_hook(hook_event ev, debug_hook_func func);
+
     command &new_command(
         std::string_view name, std::string_view args, command_func func
     );
 
+    any_value new_source(source_func func);
+
     static void *callable_alloc(
         void *data, void *p, std::size_t os, std::size_t ns
     ) {
@@ -481,6 +917,13 @@ private:
 
     void *alloc(void *ptr, size_t olds, size_t news);
 
+    /* for things that may outlive this thread, such as list sources */
+    static void *shared_alloc(
+        void *data, void *p, std::size_t os, std::size_t ns
+    );
+
+    void *shared_data();
+
     struct thread_state *p_tstate = nullptr;
 };
 
@@ -546,6 +989,26 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs);
  */
 LIBCUBESCRIPT_EXPORT void std_init_list(state &cs);
 
+/** @brief Initialize the I/O library
+ *
+ * The I/O library contains commands to iterate the lines (`looplines`,
+ * `filelines`) or the records delimited by a separator (`looprecords`,
+ * `filerecords`) of a file. Files are mapped into memory where possible,
+ * and only the records actually iterated become strings, so this is fit
+ * for processing files much larger than what you would read whole.
+ *
+ * As it gives scripts read access to any file the program can open, it is
+ * not a part of cubescript::std_init_all() and has to be initialized on
+ * its own.
+ *
+ * Calling this multiple times has no effect; commands will only be
+ * registered once.
+ *
+ * @see cubescript::std_init_list()
+ * @see cubescript::std_init_all()
+ */
+LIBCUBESCRIPT_EXPORT void std_init_io(state &cs);
+
 /** @brief Initialize all standard libraries
  *
  * This is like calling each of the individual standard library init
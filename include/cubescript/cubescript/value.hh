@@ -45,7 +45,9 @@ enum class loop_state {
  *
  * The API does not expose any specifics of the bytecode format either.
  * This is an implementation detail; bytecode is also not meant to be
- * serialized and stored on disk (it's not guaranteed to be portable).
+ * serialized and stored on disk (it's not guaranteed to be portable). The
+ * only exception is shared bytecode, whose images can be used by other
+ * processes running the same build, see state::code_image().
  */
 struct LIBCUBESCRIPT_EXPORT bcode_ref {
     /** @brief Initialize a null reference.
@@ -152,6 +154,12 @@ private:
  * a single reference to such string. By providing a reference counting
  * mechanism, it is possible to manage strings in a memory-safe manner.
  *
+ * The one exception are strings built in place by the standard library,
+ * e.g. with `s = (concat $s foo)`; while a string like that is referenced
+ * only once, it is modified instead of being copied, and it is not shared
+ * with others of the same contents. Comparing string references accounts
+ * for that.
+ *
  * There is also no such thing as a null reference in this case. If you
  * have a string reference, it always points to a valid string no matter
  * what.
@@ -279,7 +287,9 @@ enum class value_type {
     FLOAT,    /**< @brief Floating point value (cubescript::float_type). */
     STRING,   /**< @brief String value (cubescript::string_ref). */
     CODE,     /**< @brief Bytecode value (cubescript::bcode_ref). */
-    IDENT     /**< @brief Ident value (cubescript::ident). */
+    IDENT,    /**< @brief Ident value (cubescript::ident). */
+    SOURCE,   /**< @brief List source (see state::new_source()). */
+    VECTOR    /**< @brief Float vector (see any_value::set_vector()). */
 };
 
 /** @brief A tagged union representing a value.
@@ -296,6 +306,16 @@ enum class value_type {
  * When the value contains a string or bytecode, it holds a reference like
  * cubescript::string_ref or cubescript::bcode_ref would.
  *
+ * A value may also hold a list source, which produces the items of a list
+ * one by one instead of holding the list as a string. Sources are reference
+ * counted too and can be assigned to aliases; anything that needs them as
+ * a string gets the whole list built on demand.
+ *
+ * Small vectors of 2 to 4 floats, such as positions and colors, have a
+ * type of their own too. They are reference counted like sources, and
+ * look like the list of their components to the language; the string is
+ * only built when something asks for it.
+ *
  * Upon setting different types, the old type will get cleared, which may
  * include a reference count decrease.
  */
@@ -401,6 +421,16 @@ struct LIBCUBESCRIPT_EXPORT any_value {
      */
     void set_code(bcode_ref const &val);
 
+    /** @brief Set the value to a vector.
+     *
+     * The type becomes value_type::VECTOR, holding a copy of the given
+     * components. A vector has 2 to 4 components; components past the
+     * fourth are ignored, a single one makes a value_type::FLOAT and none
+     * make a value_type::NONE. Like with strings, the vector is allocated,
+     * which is why it is necessary to provide a state.
+     */
+    void set_vector(span_type<float_type const> val, state &cs);
+
     /** @brief Set the value to an indent.
      *
      * The type becomes value_type::IDENT. No reference counting is
@@ -415,10 +445,23 @@ struct LIBCUBESCRIPT_EXPORT any_value {
      * will occur. This will not affect the contained type, all conversions
      * are only intermediate.
      *
-     * If the type is not convertible, an empty string is used.
+     * A list source is converted into the list of all its items, quoting
+     * them where needed, and a vector into the list of its components. If
+     * the type is not convertible, an empty string is used.
      */
     string_ref get_string(state &cs) const;
 
+    /** @brief Produce an item of a list source.
+     *
+     * If the value is a value_type::SOURCE, the next item after `pos` is
+     * stored in `item` and `pos` is advanced. The position should start at
+     * zero; its meaning is otherwise up to the source, so every consumer
+     * keeps its own and the same source may be walked any number of times.
+     *
+     * @return `false` once there are no more items or if not a source
+     */
+    bool next_item(state &cs, std::size_t &pos, any_value &item) const;
+
     /** @brief Get the value as an integer.
      *
      * If the contained value is not an integer, an appropriate conversion
@@ -426,6 +469,8 @@ struct LIBCUBESCRIPT_EXPORT any_value {
      * are only intermediate.
      *
      * Floating point values are rounded down and converted to integers.
+     * Vectors convert their first component like their string would, i.e.
+     * it is truncated towards zero rather than rounded down.
      *
      * If the type is not convertible, 0 is returned.
      */
@@ -437,10 +482,22 @@ struct LIBCUBESCRIPT_EXPORT any_value {
      * will occur. This will not affect the contained type, all conversions
      * are only intermediate.
      *
+     * Vectors convert their first component, like their string would.
+     *
      * If the type is not convertible, 0 is returned.
      */
     float_type get_float() const;
 
+    /** @brief Get the components of a vector.
+     *
+     * If the value is a value_type::VECTOR, its components are stored in
+     * `comps`, which must have room for 4 of them. No conversion from other
+     * types is done.
+     *
+     * @return The number of components, or 0 if not a vector.
+     */
+    std::size_t get_vector(float_type *comps) const;
+
     /** @brief Get the value as a bytecode.
      *
      * If the contained value is not bytecode, null bytecode is returned.
@@ -469,7 +526,7 @@ struct LIBCUBESCRIPT_EXPORT any_value {
      * (strong conversion rules apply), it's treated like an integer. If it
      * is not, it's converted to a float (strong rules apply) and if it is
      * convertible, it's treated like a float. Any non-integer non-float
-     * string is considered `true`.
+     * string is considered `true`, and so is a list source or a vector.
      *
      * For any other type, `false` is returned.
      */
@@ -536,12 +593,16 @@ struct LIBCUBESCRIPT_EXPORT any_value {
     ident &force_ident(state &cs);
 
 private:
+    friend struct state;
+
     union {
         integer_type i;
         float_type f;
         char const *s;
         struct bcode *b;
         ident *v;
+        struct list_source *l;
+        struct float_vector *fv;
     } p_stor;
     value_type p_type;
 };
@@ -1,5 +1,14 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+
 #include "cs_bcode.hh"
 #include "cs_state.hh"
+#include "cs_thread.hh"
+#include "cs_error.hh"
+#include "cs_record.hh"
 #include "cs_vm.hh"
 
 namespace cubescript {
@@ -48,7 +57,11 @@ LIBCUBESCRIPT_EXPORT bcode_ref::operator bool() const {
 
 LIBCUBESCRIPT_EXPORT any_value bcode_ref::call(state &cs) const {
     any_value ret{};
-    vm_exec(cs, state_p{cs}.ts(), p_code->raw(), ret);
+    auto &ts = state_p{cs}.ts();
+    if (record_entry(ts)) {
+        record_call(ts, p_code);
+    }
+    vm_exec_code(cs, ts, p_code, ret);
     return ret;
 }
 
@@ -80,11 +93,19 @@ LIBCUBESCRIPT_EXPORT loop_state bcode_ref::call_loop(state &cs) const {
 /* private funcs */
 
 struct bcode_hdr {
-    internal_state *cs; /* needed to construct the allocator */
+    alloc_func af; /* the allocator the block came from */
+    void *ad;
+    internal_state *owner; /* accounts for the block, null for shared code */
     std::size_t asize; /* alloc size of the bytecode block */
+    std::uint32_t tab; /* ident table offset from bc, for shared code */
     bcode bc; /* BC_INST_START + refcount */
 };
 
+static_assert(
+    offsetof(bcode_hdr, bc) == (sizeof(bcode_hdr) - sizeof(std::uint32_t)),
+    "the bytecode must immediately follow the header"
+);
+
 /* returned address is the 'init' member of the header */
 std::uint32_t *bcode_alloc(internal_state *cs, std::size_t sz) {
     auto a = std_allocator<std::uint32_t>{cs};
@@ -92,39 +113,134 @@ std::uint32_t *bcode_alloc(internal_state *cs, std::size_t sz) {
     auto p = a.allocate(sz + hdrs - 1);
     bcode_hdr *hdr;
     std::memcpy(&hdr, &p, sizeof(hdr));
-    hdr->cs = cs;
+    /* shared code may outlive the state, so do not refer to it */
+    hdr->af = cs->allocf;
+    hdr->ad = cs->aptr;
     hdr->asize = sz + hdrs - 1;
+    hdr->tab = 0;
+    hdr->owner = cs;
+    ++cs->stats.code_blocks;
+    cs->stats.code_bytes += hdr->asize * sizeof(std::uint32_t);
     return p + hdrs - 1;
 }
 
+static void bcode_disown(internal_state *cs, std::uint32_t *bc) {
+    auto *rp = bc + 1 - (sizeof(bcode_hdr) / sizeof(std::uint32_t));
+    bcode_hdr *hdr;
+    std::memcpy(&hdr, &rp, sizeof(hdr));
+    --cs->stats.code_blocks;
+    cs->stats.code_bytes -= hdr->asize * sizeof(std::uint32_t);
+    hdr->owner = nullptr;
+}
+
+static void bcode_pool_remove(internal_state *cs, std::uint32_t *bc) {
+    std::size_t hdrs = sizeof(bcode_hdr) / sizeof(std::uint32_t);
+    auto *rp = bc + 1 - hdrs;
+    bcode_hdr *hdr;
+    std::memcpy(&hdr, &rp, sizeof(hdr));
+    auto it = cs->code_pool.find(
+        bcode_hash(bc + 1, hdr->asize - hdrs)
+    );
+    if ((it != cs->code_pool.end()) && (it->second == bc)) {
+        cs->code_pool.erase(it);
+    }
+}
+
 /* bc's address must be the 'init' member of the header */
 static inline void bcode_free(std::uint32_t *bc) {
     auto *rp = bc + 1 - (sizeof(bcode_hdr) / sizeof(std::uint32_t));
     bcode_hdr *hdr;
     std::memcpy(&hdr, &rp, sizeof(hdr));
-    std_allocator<std::uint32_t>{hdr->cs}.deallocate(rp, hdr->asize);
+    if (hdr->owner) {
+        --hdr->owner->stats.code_blocks;
+        hdr->owner->stats.code_bytes -= hdr->asize * sizeof(std::uint32_t);
+        if (!hdr->owner->code_pool.empty()) {
+            bcode_pool_remove(hdr->owner, bc);
+        }
+    }
+    hdr->af(hdr->ad, rp, hdr->asize * sizeof(std::uint32_t), 0);
+}
+
+std::size_t bcode_block_size(
+    internal_state *cs, std::uint32_t const *start
+) {
+    auto const *empty = &cs->empty[0].init.init;
+    if ((start >= empty) && (start < &cs->empty[VAL_ANY].init.init)) {
+        return 0;
+    }
+    if (bcode_flags(start) & BC_START_STATIC) {
+        return 0;
+    }
+    auto const *rp = start + 1 - (sizeof(bcode_hdr) / sizeof(std::uint32_t));
+    bcode_hdr const *hdr;
+    std::memcpy(&hdr, &rp, sizeof(hdr));
+    return hdr->asize * sizeof(std::uint32_t);
+}
+
+/* other threads may be modifying the refcount of shared code */
+static inline std::uint32_t bcode_load(std::uint32_t const *start) {
+    return std::atomic_ref<std::uint32_t>{
+        *const_cast<std::uint32_t *>(start)
+    }.load(std::memory_order_relaxed);
+}
+
+std::uint32_t bcode_flags(std::uint32_t const *start) {
+    return bcode_load(start) & BC_INST_RET_MASK;
 }
 
 static inline void bcode_incr(std::uint32_t *bc) {
+    auto fl = bcode_flags(bc);
+    if (fl & BC_START_STATIC) {
+        return;
+    }
+    if (fl & BC_START_SHARED) {
+        std::atomic_ref<std::uint32_t>{*bc}.fetch_add(
+            0x100, std::memory_order_relaxed
+        );
+        return;
+    }
     *bc += 0x100;
 }
 
 static inline void bcode_decr(std::uint32_t *bc) {
+    auto fl = bcode_flags(bc);
+    if (fl & BC_START_STATIC) {
+        return;
+    }
+    if (fl & BC_START_SHARED) {
+        auto v = std::atomic_ref<std::uint32_t>{*bc}.fetch_sub(
+            0x100, std::memory_order_acq_rel
+        ) - 0x100;
+        if (std::int32_t(v) < 0x100) {
+            bcode_free(bc);
+        }
+        return;
+    }
     *bc -= 0x100;
     if (std::int32_t(*bc) < 0x100) {
         bcode_free(bc);
     }
 }
 
+std::uint32_t *bcode_start(std::uint32_t *code) {
+    if ((bcode_load(code) & BC_INST_OP_MASK) == BC_INST_START) {
+        return code;
+    }
+    if ((bcode_load(&code[-1]) & BC_INST_OP_MASK) == BC_INST_OFFSET) {
+        return code - std::ptrdiff_t(code[-1] >> 8);
+    }
+    return &code[-1];
+}
+
 void bcode_addref(std::uint32_t *code) {
     if (!code) {
         return;
     }
-    if ((*code & BC_INST_OP_MASK) == BC_INST_START) {
+    if ((bcode_load(code) & BC_INST_OP_MASK) == BC_INST_START) {
         bcode_incr(code);
         return;
     }
-    switch (code[-1]&BC_INST_OP_MASK) {
+    switch (bcode_load(&code[-1]) & BC_INST_OP_MASK) {
         case BC_INST_START:
             bcode_incr(&code[-1]);
             break;
@@ -139,11 +255,11 @@ void bcode_unref(std::uint32_t *code) {
     if (!code) {
         return;
     }
-    if ((*code & BC_INST_OP_MASK) == BC_INST_START) {
+    if ((bcode_load(code) & BC_INST_OP_MASK) == BC_INST_START) {
         bcode_decr(code);
         return;
     }
-    switch (code[-1]&BC_INST_OP_MASK) {
+    switch (bcode_load(&code[-1]) & BC_INST_OP_MASK) {
         case BC_INST_START:
             bcode_decr(&code[-1]);
             break;
@@ -154,6 +270,448 @@ void bcode_unref(std::uint32_t *code) {
     }
 }
 
+/* deduplication */
+
+std::size_t bcode_hash(std::uint32_t const *code, std::size_t n) {
+    /* FNV-1a over the words */
+    std::size_t h = std::size_t(14695981039346656037ULL);
+    auto mix = [&h](std::uint32_t w) {
+        h = (h ^ w) * std::size_t(1099511628211ULL);
+    };
+    for (std::size_t i = 0; i < n;) {
+        auto op = code[i];
+        auto isz = std::min(bcode_insn_size(op), n - i);
+        if ((op & BC_INST_OP_MASK) == BC_INST_OFFSET) {
+            op = BC_INST_OFFSET;
+        }
+        mix(op);
+        for (std::size_t j = 1; j < isz; ++j) {
+            mix(code[i + j]);
+        }
+        i += isz;
+    }
+    return h;
+}
+
+bool bcode_same(
+    std::uint32_t const *a, std::uint32_t const *b, std::size_t n
+) {
+    for (std::size_t i = 0; i < n;) {
+        auto op = a[i];
+        auto isz = std::min(bcode_insn_size(op), n - i);
+        if ((op & BC_INST_OP_MASK) == BC_INST_OFFSET) {
+            if ((b[i] & BC_INST_OP_MASK) != BC_INST_OFFSET) {
+                return false;
+            }
+        } else if (std::memcmp(
+            &a[i], &b[i], isz * sizeof(std::uint32_t)
+        )) {
+            return false;
+        }
+        i += isz;
+    }
+    return true;
+}
+
+/* the pooled code is compared without its first word, which has the
+ * refcount in it
+ */
+
+bcode *bcode_pool_get(
+    internal_state *cs, std::uint32_t const *code, std::size_t sz
+) {
+    auto it = cs->code_pool.find(bcode_hash(code + 1, sz - 1));
+    if (it == cs->code_pool.end()) {
+        return nullptr;
+    }
+    auto *bc = it->second;
+    std::size_t hdrs = sizeof(bcode_hdr) / sizeof(std::uint32_t);
+    auto *rp = bc + 1 - hdrs;
+    bcode_hdr const *hdr;
+    std::memcpy(&hdr, &rp, sizeof(hdr));
+    if (
+        ((hdr->asize - hdrs + 1) != sz) || !bcode_same(bc + 1, code + 1, sz - 1)
+    ) {
+        return nullptr;
+    }
+    ++cs->stats.code_dedups;
+    bcode *ret;
+    bc += 1;
+    std::memcpy(&ret, &bc, sizeof(ret));
+    return ret;
+}
+
+void bcode_pool_add(internal_state *cs, std::uint32_t *bc, std::size_t sz) {
+    /* on a collision, the code already there stays */
+    cs->code_pool.try_emplace(bcode_hash(bc + 1, sz - 1), bc);
+}
+
+/* shared code
+ *
+ * the ident table consists of the number of entries, followed by the
+ * entries; each entry is a word containing the internal ident type and
+ * the value type of variables, followed by the name and for commands
+ * also the argument list, each as a length word and the padded chars
+ */
+
+static void shared_put_str(
+    valbuf<std::uint32_t> &tab, std::string_view str
+) {
+    tab.push_back(std::uint32_t(str.size()));
+    auto nw = str.size() / sizeof(std::uint32_t) + 1;
+    auto off = tab.size();
+    tab.resize(off + nw);
+    std::memset(&tab[off], 0, nw * sizeof(std::uint32_t));
+    std::memcpy(&tab[off], str.data(), str.size());
+}
+
+static std::string_view shared_get_str(std::uint32_t const *&tab) {
+    auto len = *tab++;
+    char const *str;
+    std::memcpy(&str, &tab, sizeof(str));
+    tab += len / sizeof(std::uint32_t) + 1;
+    return std::string_view{str, len};
+}
+
+bcode_ref bcode_make_shared(
+    thread_state &ts, std::uint32_t const *code, std::size_t sz
+) {
+    using slot_allocator = std_allocator<std::pair<int const, std::uint32_t>>;
+    std::unordered_map<
+        int, std::uint32_t, std::hash<int>, std::equal_to<int>,
+        slot_allocator
+    > slots{slot_allocator{ts.istate}};
+    valbuf<std::uint32_t> tab{ts.istate};
+    valbuf<std::uint32_t> ncode{ts.istate};
+    ncode.append(code, code + sz);
+    tab.push_back(0);
+    for (std::size_t i = 1; i < sz; i += bcode_insn_size(ncode[i])) {
+        auto op = ncode[i];
+        if (!bcode_has_ident(op)) {
+            continue;
+        }
+        auto [it, added] = slots.try_emplace(int(op >> 8), tab[0]);
+        if (added) {
+            auto *id = ts.istate->identmap[op >> 8];
+            auto &idi = ident_p{*id}.impl();
+            std::uint32_t vtp = 0;
+            if (idi.p_type == ID_VAR) {
+                vtp = std::uint32_t(
+                    static_cast<var_impl &>(idi).p_storage.type()
+                );
+            }
+            tab.push_back(std::uint32_t(idi.p_type) | (vtp << 8));
+            shared_put_str(tab, id->name());
+            if ((idi.p_type != ID_VAR) && (idi.p_type != ID_ALIAS)) {
+                shared_put_str(tab, static_cast<command *>(id)->args());
+            }
+            ++tab[0];
+        }
+        ncode[i] = (op & 0xFF) | (it->second << 8);
+    }
+    auto *cp = bcode_alloc(ts.istate, sz + tab.size());
+    std::memcpy(cp, ncode.data(), sz * sizeof(std::uint32_t));
+    std::memcpy(cp + sz, tab.data(), tab.size() * sizeof(std::uint32_t));
+    cp[0] |= BC_START_SHARED;
+    cp[-1] = std::uint32_t(sz);
+    /* may outlive the state, so it is not accounted for */
+    bcode_disown(ts.istate, cp);
+    bcode *b;
+    cp += 1;
+    std::memcpy(&b, &cp, sizeof(b));
+    return bcode_p::make_ref(b);
+}
+
+static ident *shared_resolve(
+    thread_state &ts, std::uint32_t const *&tab
+) {
+    auto &cs = *ts.pstate;
+    auto tp = int(*tab & 0xFF);
+    auto vtp = value_type(*tab >> 8);
+    ++tab;
+    auto name = shared_get_str(tab);
+    if (tp == ID_ALIAS) {
+        auto &id = ts.istate->new_ident(cs, name, IDENT_FLAG_UNKNOWN);
+        if (id.type() == ident_type::ALIAS) {
+            return &id;
+        }
+    } else {
+        auto args = std::string_view{};
+        if (tp != ID_VAR) {
+            args = shared_get_str(tab);
+        }
+        auto *id = ts.istate->get_ident(name);
+        if (!id) {
+            throw error_p::make(
+                cs, "shared code uses unknown ident '%s'", name.data()
+            );
+        }
+        auto &idi = ident_p{*id}.impl();
+        if (idi.p_type == tp) {
+            if (tp == ID_VAR) {
+                if (static_cast<var_impl &>(idi).p_storage.type() == vtp) {
+                    return id;
+                }
+            } else if (static_cast<command *>(id)->args() == args) {
+                return id;
+            }
+        }
+    }
+    throw error_p::make(
+        cs, "shared code uses incompatible ident '%s'", name.data()
+    );
+}
+
+ident **bcode_resolve_shared(thread_state &ts, std::uint32_t *start) {
+    auto &sc = ts.istate->shared_code;
+    auto it = sc.find(start);
+    if (it != sc.end()) {
+        ++ts.istate->stats.shared_hits;
+        return it->second.idents.data();
+    }
+    ++ts.istate->stats.shared_misses;
+    std::uint32_t const *tab = start + start[-1];
+    shared_idents::ident_vector idents{std_allocator<ident *>{ts.istate}};
+    std::size_t nids = *tab++;
+    idents.reserve(nids);
+    for (std::size_t i = 0; i < nids; ++i) {
+        idents.push_back(shared_resolve(ts, tab));
+    }
+    /* drop the entries only kept alive by us */
+    if (sc.size() >= ts.istate->shared_sweep) {
+        for (auto sit = sc.begin(); sit != sc.end();) {
+            auto v = bcode_load(sit->first);
+            if ((v & BC_START_STATIC) || ((v >> 8) > 1)) {
+                ++sit;
+            } else {
+                sit = sc.erase(sit);
+            }
+        }
+        ts.istate->shared_sweep = std::max(
+            std::size_t(16), sc.size() * 2
+        );
+    }
+    bcode *b;
+    start += 1;
+    std::memcpy(&b, &start, sizeof(b));
+    auto &ent = sc.try_emplace(
+        start - 1, bcode_p::make_ref(b), std::move(idents)
+    ).first->second;
+    return ent.idents.data();
+}
+
+/* images
+ *
+ * an image is a header of four words (magic, version along with the sizes
+ * of inline values, number of words following the header, and the offset
+ * of the ident table) followed by the shared code with BC_START_STATIC set
+ */
+
+static constexpr std::uint32_t BC_IMAGE_MAGIC = 0x43424353; /* CSBC */
+static constexpr std::uint32_t BC_IMAGE_VERSION = 1 | (
+    std::uint32_t(sizeof(integer_type)) << 8
+) | (std::uint32_t(sizeof(float_type)) << 16);
+static constexpr std::size_t BC_IMAGE_HDR = 4;
+
+std::size_t bcode_image(
+    thread_state &ts, std::uint32_t const *start, void *buf, std::size_t bsize
+) {
+    auto fl = bcode_flags(start);
+    if (!(fl & BC_START_SHARED)) {
+        throw error{*ts.pstate, "bytecode is not shared"};
+    }
+    std::size_t nw;
+    if (fl & BC_START_STATIC) {
+        /* an image already, the header precedes it */
+        nw = start[-2];
+    } else {
+        std::size_t hdrs = sizeof(bcode_hdr) / sizeof(std::uint32_t);
+        auto *rp = start + 1 - hdrs;
+        bcode_hdr const *hdr;
+        std::memcpy(&hdr, &rp, sizeof(hdr));
+        nw = hdr->asize - hdrs + 1;
+    }
+    auto isize = (nw + BC_IMAGE_HDR) * sizeof(std::uint32_t);
+    if (!buf || (bsize < isize)) {
+        return isize;
+    }
+    std::uint32_t hdr[BC_IMAGE_HDR] = {
+        BC_IMAGE_MAGIC, BC_IMAGE_VERSION, std::uint32_t(nw), start[-1]
+    };
+    auto *out = static_cast<unsigned char *>(buf);
+    std::memcpy(out, hdr, sizeof(hdr));
+    out += sizeof(hdr);
+    std::memcpy(out, start, nw * sizeof(std::uint32_t));
+    /* no refcount in the image */
+    std::uint32_t sv = fl | BC_START_STATIC;
+    std::memcpy(out, &sv, sizeof(sv));
+    return isize;
+}
+
+static bool bcode_check_image(
+    internal_state *cs, std::uint32_t const *start, std::size_t tab,
+    std::size_t nw
+) {
+    /* ident table */
+    std::size_t nids = start[tab];
+    std::size_t ti = tab + 1;
+    auto skip_str = [start, nw](std::size_t &i) {
+        if (i >= nw) {
+            return false;
+        }
+        i += start[i] / sizeof(std::uint32_t) + 2;
+        return (i <= nw);
+    };
+    for (std::size_t i = 0; i < nids; ++i) {
+        if (ti >= nw) {
+            return false;
+        }
+        auto tp = int(start[ti++] & 0xFF);
+        if (!skip_str(ti)) {
+            return false;
+        }
+        if ((tp != ID_VAR) && (tp != ID_ALIAS) && !skip_str(ti)) {
+            return false;
+        }
+    }
+    /* the code itself must be well formed; the blocks are remembered in
+     * the order they start, for the references to them
+     */
+    valbuf<std::size_t> blocks{cs};
+    for (std::size_t i = 1; i < tab;) {
+        auto op = start[i];
+        auto isz = bcode_insn_size(op);
+        if (
+            ((op & BC_INST_OP_MASK) > BC_INST_BLOCK_REF) ||
+            ((i + isz) > tab)
+        ) {
+            return false;
+        }
+        if ((op & BC_INST_OP_MASK) == BC_INST_UNSHARE) {
+            /* the VM peeks at the command call */
+            auto nop = start[i + 1] & BC_INST_OP_MASK;
+            if ((nop != BC_INST_COM) && (nop != BC_INST_COM_V)) {
+                return false;
+            }
+        }
+        if (bcode_has_ident(op) && ((op >> 8) >= nids)) {
+            return false;
+        }
+        switch (op & BC_INST_OP_MASK) {
+            case BC_INST_START:
+                return false;
+            case BC_INST_OFFSET:
+                if ((op >> 8) != (i + 1)) {
+                    return false;
+                }
+                break;
+            case BC_INST_BLOCK:
+                blocks.push_back(i + 2);
+                [[fallthrough]];
+            case BC_INST_JUMP:
+            case BC_INST_JUMP_B:
+            case BC_INST_JUMP_RESULT:
+                if ((i + 1 + (op >> 8)) >= tab) {
+                    return false;
+                }
+                break;
+            case BC_INST_BLOCK_REF:
+                if (!std::binary_search(
+                    blocks.data(), blocks.data() + blocks.size(),
+                    i - std::min(i, std::size_t(op >> 8))
+                )) {
+                    return false;
+                }
+                break;
+            default:
+                break;
+        }
+        i += isz;
+    }
+    return ((start[tab - 1] & BC_INST_OP_MASK) == BC_INST_EXIT);
+}
+
+bcode_ref bcode_load_image(
+    thread_state &ts, void const *data, std::size_t size
+) {
+    auto &cs = *ts.pstate;
+    if (
+        (reinterpret_cast<std::uintptr_t>(data) % alignof(std::uint32_t)) ||
+        (size < ((BC_IMAGE_HDR + 3) * sizeof(std::uint32_t)))
+    ) {
+        throw error{cs, "invalid bytecode image"};
+    }
+    auto *words = static_cast<std::uint32_t const *>(data);
+    if (words[0] != BC_IMAGE_MAGIC) {
+        throw error{cs, "invalid bytecode image"};
+    }
+    if (words[1] != BC_IMAGE_VERSION) {
+        throw error{cs, "incompatible bytecode image"};
+    }
+    std::size_t nw = words[2], tab = words[3];
+    auto *start = words + BC_IMAGE_HDR;
+    if (
+        (nw > (size / sizeof(std::uint32_t) - BC_IMAGE_HDR)) ||
+        (tab < 2) || (tab >= nw) ||
+        (start[0] != (BC_INST_START | BC_START_SHARED | BC_START_STATIC)) ||
+        !bcode_check_image(ts.istate, start, tab, nw)
+    ) {
+        throw error{cs, "invalid bytecode image"};
+    }
+    bcode *b;
+    start += 1;
+    std::memcpy(&b, &start, sizeof(b));
+    return bcode_p::make_ref(b);
+}
+
+/* inspection */
+
+static char const *opnames[] = {
+    "start", "offset", "null", "true", "false", "not", "pop", "enter",
+    "enter_result", "exit", "result", "result_arg", "force", "dup", "val",
+    "val_int", "local", "do", "do_args", "jump", "jump_b", "jump_result",
+    "break", "block", "empty", "compile", "cond", "ident", "ident_u",
+    "lookup", "lookup_u", "conc", "conc_w", "var", "alias", "alias_u",
+    "call", "call_u", "com", "com_v", "unshare", "lookup_buf", "block_ref"
+};
+
+static_assert(
+    (sizeof(opnames) / sizeof(opnames[0])) == (BC_INST_BLOCK_REF + 1),
+    "opcode names do not match the instruction set"
+);
+
+std::size_t bcode_histogram(
+    std::uint32_t const *code, std::size_t *counts, std::size_t ncounts
+) {
+    /* nested blocks begin with BC_INST_OFFSET and end with BC_INST_EXIT */
+    std::size_t total = 0, depth = 0;
+    for (;;) {
+        auto op = *code;
+        auto opc = std::size_t(op & BC_INST_OP_MASK);
+        if (opc < ncounts) {
+            ++counts[opc];
+        }
+        ++total;
+        if (opc == BC_INST_OFFSET) {
+            ++depth;
+        } else if (opc == BC_INST_EXIT) {
+            if (!depth) {
+                break;
+            }
+            --depth;
+        }
+        code += bcode_insn_size(op);
+    }
+    return total;
+}
+
+std::string_view bcode_opcode_name(std::size_t op) {
+    if (op >= (sizeof(opnames) / sizeof(opnames[0]))) {
+        return std::string_view{};
+    }
+    return opnames[op];
+}
+
 /* empty fallbacks */
 
 static std::uint32_t emptyrets[VAL_ANY] = {
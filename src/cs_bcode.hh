@@ -9,6 +9,7 @@
 namespace cubescript {
 
 struct internal_state;
+struct thread_state;
 
 struct bcode {
     std::uint32_t init;
@@ -167,6 +168,25 @@ enum {
      * instruction, arguments are popped off the stack and passed as is
      */
     BC_INST_COM_V,
+    /* the command call that follows (COM or COM_V) gets the value of alias
+     * with index D as its first argument, and its result is assigned back
+     * to that alias; if the command can reuse the storage of its first
+     * argument, let the alias release its reference to it once the command
+     * takes it over (see thread_state::take_unshared), so that the command
+     * may find it uniquely owned while the alias is kept until then
+     */
+    BC_INST_UNSHARE,
+    /* like BC_INST_LOOKUP, as the first argument of a command call preceded
+     * by BC_INST_UNSHARE of the same alias; a string outside the pool is
+     * pushed without being interned, as the alias either lets go of it or
+     * it is interned there
+     */
+    BC_INST_LOOKUP_BUF,
+    /* push the bytecode starting D words before this instruction on the
+     * stack; it is an earlier block of the same code identical to the one
+     * this replaces, see gen_state::dedup_blocks()
+     */
+    BC_INST_BLOCK_REF,
 
     /* opcode mask */
     BC_INST_OP_MASK = 0x3F,
@@ -183,14 +203,115 @@ enum {
 
     /* BC_INST_JUMP_B, BC_INST_JUMP_RESULT */
     BC_INST_FLAG_TRUE = 1 << BC_INST_RET,
-    BC_INST_FLAG_FALSE = 0 << BC_INST_RET
+    BC_INST_FLAG_FALSE = 0 << BC_INST_RET,
+
+    /* BC_INST_START: shared code; the refcount is atomic and the data of
+     * ident instructions indexes the ident table following the code, whose
+     * offset from BC_INST_START is stored in the word right before it
+     */
+    BC_START_SHARED = 1 << BC_INST_RET,
+    /* BC_INST_START: shared code living in memory not owned by us (e.g. a
+     * mapped image); it is never written to, so it is not refcounted
+     */
+    BC_START_STATIC = 2 << BC_INST_RET
 };
 
+/* the number of words taken by the instruction, including itself */
+inline std::size_t bcode_insn_size(std::uint32_t op) {
+    switch (op & BC_INST_OP_MASK) {
+        case BC_INST_VAL:
+            switch (op & BC_INST_RET_MASK) {
+                case BC_RET_STRING:
+                    return (op >> 8) / sizeof(std::uint32_t) + 2;
+                case BC_RET_INT:
+                    return bc_store_size<integer_type> + 1;
+                case BC_RET_FLOAT:
+                    return bc_store_size<float_type> + 1;
+                default:
+                    break;
+            }
+            break;
+        case BC_INST_CALL:
+        case BC_INST_COM_V:
+            return 2;
+        default:
+            break;
+    }
+    return 1;
+}
+
+/* whether the instruction refers to an ident by index */
+inline bool bcode_has_ident(std::uint32_t op) {
+    switch (op & BC_INST_OP_MASK) {
+        case BC_INST_IDENT:
+        case BC_INST_LOOKUP:
+        case BC_INST_VAR:
+        case BC_INST_ALIAS:
+        case BC_INST_CALL:
+        case BC_INST_COM:
+        case BC_INST_COM_V:
+        case BC_INST_UNSHARE:
+        case BC_INST_LOOKUP_BUF:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
 std::uint32_t *bcode_alloc(internal_state *cs, std::size_t sz);
 
 void bcode_addref(std::uint32_t *code);
 void bcode_unref(std::uint32_t *code);
 
+/* find the BC_INST_START of the block code points into */
+std::uint32_t *bcode_start(std::uint32_t *code);
+/* get the BC_INST_START flags */
+std::uint32_t bcode_flags(std::uint32_t const *start);
+/* the memory held by the block, or zero if it is not allocated on its own
+ * (empty blocks and images)
+ */
+std::size_t bcode_block_size(internal_state *cs, std::uint32_t const *start);
+
+/* turn generated code (starting with BC_INST_START) into shared code */
+bcode_ref bcode_make_shared(
+    thread_state &ts, std::uint32_t const *code, std::size_t sz
+);
+/* the idents used by shared code, resolved for the given state */
+ident **bcode_resolve_shared(thread_state &ts, std::uint32_t *start);
+
+/* write the image of shared code into buf if large enough, return size */
+std::size_t bcode_image(
+    thread_state &ts, std::uint32_t const *start, void *buf, std::size_t bsize
+);
+/* validate an image and make a reference to the static code inside */
+bcode_ref bcode_load_image(
+    thread_state &ts, void const *data, std::size_t size
+);
+
+/* hash and compare n words of code, instruction by instruction; the data
+ * of BC_INST_OFFSET depends on where the code is, so it is left out
+ */
+std::size_t bcode_hash(std::uint32_t const *code, std::size_t n);
+bool bcode_same(
+    std::uint32_t const *a, std::uint32_t const *b, std::size_t n
+);
+
+/* the pool of compiled code of a state, for when it deduplicates code;
+ * get finds code identical to the given generated code (starting with
+ * BC_INST_START), add puts allocated code in the pool
+ */
+bcode *bcode_pool_get(
+    internal_state *cs, std::uint32_t const *code, std::size_t sz
+);
+void bcode_pool_add(internal_state *cs, std::uint32_t *bc, std::size_t sz);
+
+/* count the instructions of code and the blocks within by opcode */
+std::size_t bcode_histogram(
+    std::uint32_t const *code, std::size_t *counts, std::size_t ncounts
+);
+std::string_view bcode_opcode_name(std::size_t op);
+
 struct empty_block {
     bcode init;
     std::uint32_t code;
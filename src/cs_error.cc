@@ -86,12 +86,14 @@ LIBCUBESCRIPT_EXPORT error::error(state &cs, std::string_view msg):
     p_errbeg = sp;
     p_errend = buf + msg.size();
     save_stack(cs, p_sbeg, p_send);
+    ++state_p{cs}.ts().istate->stats.errors;
 }
 
 LIBCUBESCRIPT_EXPORT error::error(
     state &cs, char const *errbeg, char const *errend
 ): p_errbeg{errbeg}, p_errend{errend}, p_state{&cs} {
     save_stack(cs, p_sbeg, p_send);
+    ++state_p{cs}.ts().istate->stats.errors;
 }
 
 std::string_view error::what() const {
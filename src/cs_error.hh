@@ -18,10 +18,12 @@ struct error_p {
             int written = std::snprintf(buf, sz, msg.data(), args...);
             if (written <= 0) {
                 throw error{cs, "malformed format string"};
-            } else if (std::size_t(written) <= sz) {
+            } else if (std::size_t(written) < sz) {
+                /* the message ends where the formatting did */
+                sz = std::size_t(written);
                 break;
             }
-            sz = std::size_t(written);
+            sz = std::size_t(written) + 1;
         }
         return error{cs, sp, buf + sz};
     }
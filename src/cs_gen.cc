@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <unordered_map>
 
 #include "cs_gen.hh"
 
@@ -25,14 +27,132 @@ std::uint32_t gen_state::peek(std::size_t idx) const {
 }
 
 bcode_ref gen_state::steal_ref() {
+    bool dedup = ts.istate->dedup_code;
+    if (dedup) {
+        dedup_blocks();
+        if (auto *b = bcode_pool_get(ts.istate, code.data(), code.size())) {
+            return bcode_p::make_ref(b);
+        }
+    }
     auto *cp = bcode_alloc(ts.istate, code.size());
     std::memcpy(cp, code.data(), code.size() * sizeof(std::uint32_t));
+    if (dedup) {
+        bcode_pool_add(ts.istate, cp, code.size());
+    }
     bcode *b;
     cp += 1;
     std::memcpy(&b, &cp, sizeof(b));
     return bcode_p::make_ref(b);
 }
 
+bcode_ref gen_state::steal_shared_ref() {
+    if (ts.istate->dedup_code) {
+        dedup_blocks();
+    }
+    return bcode_make_shared(ts, code.data(), code.size());
+}
+
+/* this runs once the code is complete, as the compiler turns some blocks
+ * into inline code (e.g. those of if) by looking at what it generated;
+ * removing the duplicates moves the code following them, so the offsets
+ * and lengths in the code are adjusted
+ */
+void gen_state::dedup_blocks() {
+    struct dup_block {
+        std::size_t pos; /* of the BC_INST_BLOCK */
+        std::size_t len; /* the words removed after it */
+        std::size_t target; /* where the identical block's code begins */
+        std::size_t removed; /* words removed by the duplicates up to here */
+    };
+    using block_allocator = std_allocator<
+        std::pair<std::size_t const, std::size_t>
+    >;
+    std::unordered_map<
+        std::size_t, std::size_t, std::hash<std::size_t>,
+        std::equal_to<std::size_t>, block_allocator
+    > blocks{block_allocator{ts.istate}};
+    valbuf<dup_block> dups{ts.istate};
+    std::size_t removed = 0;
+    for (std::size_t i = 1; i < code.size();) {
+        auto op = code[i];
+        if ((op & BC_INST_OP_MASK) != BC_INST_BLOCK) {
+            i += bcode_insn_size(op);
+            continue;
+        }
+        std::size_t len = op >> 8;
+        auto [it, added] = blocks.try_emplace(
+            bcode_hash(&code[i + 1], len), i
+        );
+        auto opos = it->second;
+        if (
+            added || (code[opos] != op) ||
+            !bcode_same(&code[opos + 1], &code[i + 1], len)
+        ) {
+            /* a new block, or another one with the same hash; look inside */
+            ++i;
+            continue;
+        }
+        removed += len;
+        dups.push_back(dup_block{i, len, opos + 2, removed});
+        i += len + 1;
+    }
+    if (dups.empty()) {
+        return;
+    }
+    ts.istate->stats.code_dedups += dups.size();
+    /* where code at pos ends up, pos not being within a removed block */
+    auto new_pos = [&dups](std::size_t pos) {
+        auto *it = std::lower_bound(
+            dups.data(), dups.data() + dups.size(), pos,
+            [](dup_block const &d, std::size_t p) {
+                return d.pos < p;
+            }
+        );
+        if (it == dups.data()) {
+            return pos;
+        }
+        return pos - it[-1].removed;
+    };
+    auto rel = [&new_pos](std::size_t pos, std::size_t target) {
+        return std::uint32_t(new_pos(target) - new_pos(pos) - 1) << 8;
+    };
+    std::size_t o = 1;
+    std::size_t di = 0;
+    for (std::size_t i = 1; i < code.size();) {
+        auto op = code[i];
+        if ((di < dups.size()) && (dups[di].pos == i)) {
+            auto &d = dups[di++];
+            code[o++] = BC_INST_BLOCK_REF | (
+                std::uint32_t(new_pos(i) - new_pos(d.target)) << 8
+            );
+            i += d.len + 1;
+            continue;
+        }
+        auto isz = bcode_insn_size(op);
+        auto opc = op & BC_INST_OP_MASK;
+        switch (opc) {
+            case BC_INST_OFFSET:
+                op = opc | (std::uint32_t(o + 1) << 8);
+                break;
+            case BC_INST_BLOCK:
+            case BC_INST_JUMP:
+            case BC_INST_JUMP_B:
+            case BC_INST_JUMP_RESULT:
+                op = (op & 0xFF) | rel(i, i + 1 + (op >> 8));
+                break;
+            default:
+                break;
+        }
+        code[o] = op;
+        for (std::size_t j = 1; j < isz; ++j) {
+            code[o + j] = code[i + j];
+        }
+        o += isz;
+        i += isz;
+    }
+    code.resize(o);
+}
+
 void gen_state::gen_pop() {
     code.push_back(BC_INST_POP);
 }
@@ -60,7 +180,7 @@ void gen_state::gen_not(int ltype) {
 bool gen_state::gen_if(std::size_t tpos, std::size_t fpos, int ltype) {
     auto inst1 = code[tpos];
     auto op1 = inst1 & ~BC_INST_RET_MASK;
-    auto tlen = std::uint32_t(fpos - tpos - 1);
+    auto tlen = std::uint32_t((fpos ? fpos : count()) - tpos - 1);
     if (!fpos) {
         if (is_block(tpos, fpos)) {
             code[tpos] = (tlen << 8) | BC_INST_JUMP_B | BC_INST_FLAG_FALSE;
@@ -350,7 +470,62 @@ void gen_state::gen_lookup_ident(int ltype) {
     code.push_back(BC_INST_LOOKUP_U | ret_code(ltype));
 }
 
+/* whether the code at pos is a lookup of the alias that nothing consumes
+ * before the instruction at end, i.e. the whole first argument of a call
+ */
+bool gen_state::is_lookup_arg(
+    ident &id, std::size_t pos, std::size_t end
+) const {
+    if (
+        (pos >= end) || static_cast<alias &>(id).is_arg() ||
+        ((code[pos] & BC_INST_OP_MASK) != BC_INST_LOOKUP) ||
+        ((code[pos] >> 8) != std::uint32_t(id.index()))
+    ) {
+        return false;
+    }
+    if (++pos == end) {
+        return true;
+    }
+    switch (code[pos] & BC_INST_OP_MASK) {
+        case BC_INST_VAL:
+        case BC_INST_VAL_INT:
+        case BC_INST_LOOKUP:
+        case BC_INST_VAR:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
 void gen_state::gen_assign_alias(ident &id) {
+    /* a command call whose result is assigned right away, like in
+     * a = (concat $a b); let it build the result in the alias's string
+     */
+    auto sz = code.size();
+    if (
+        (last_com < sz) &&
+        ((code[sz - 1] & BC_INST_OP_MASK) == BC_INST_RESULT_ARG) &&
+        ((last_com + bcode_insn_size(code[last_com]) + 1) == sz)
+    ) {
+        auto op = code[last_com] & BC_INST_OP_MASK;
+        if ((op == BC_INST_COM) || (op == BC_INST_COM_V)) {
+            auto &cmd = *ts.istate->identmap[code[last_com] >> 8];
+            if (ident_p{cmd}.impl().p_flags & IDENT_FLAG_INPLACE) {
+                code.insert(last_com, BC_INST_UNSHARE | (id.index() << 8));
+                if (is_lookup_arg(id, last_com_args, last_com)) {
+                    /* the alias itself is the first argument; it must not
+                     * be interned on the way, or the string is hashed every
+                     * time it is appended to
+                     */
+                    code[last_com_args] = BC_INST_LOOKUP_BUF | (
+                        code[last_com_args] & ~std::uint32_t(BC_INST_OP_MASK)
+                    );
+                }
+            }
+        }
+    }
+    last_com = std::size_t(-1);
     code.push_back(BC_INST_ALIAS | (id.index() << 8));
 }
 
@@ -386,8 +561,10 @@ void gen_state::gen_concat(std::size_t concs, bool space, int ltype) {
 }
 
 void gen_state::gen_command_call(
-    ident &id, int comt, int ltype, std::uint32_t nargs
+    ident &id, int comt, int ltype, std::uint32_t nargs, std::size_t argpos
 ) {
+    last_com = code.size();
+    last_com_args = argpos;
     code.push_back(comt | ret_code(ltype) | (id.index() << 8));
     if (comt != BC_INST_COM) {
         code.push_back(nargs);
@@ -438,6 +615,7 @@ void gen_state::gen_main(std::string_view v, std::string_view src) {
         throw;
     }
     ts.source = psrc;
+    ++ts.istate->stats.compiles;
 }
 
 void gen_state::gen_main_null() {
@@ -25,6 +25,10 @@ struct gen_state {
     std::uint32_t peek(std::size_t idx) const;
 
     bcode_ref steal_ref();
+    bcode_ref steal_shared_ref();
+
+    /* replace blocks identical to an earlier one by references to it */
+    void dedup_blocks();
 
     void gen_pop();
     void gen_dup(int ltype = 0);
@@ -73,8 +77,10 @@ struct gen_state {
 
     void gen_concat(std::size_t concs, bool space, int ltype = 0);
 
+    /* argpos is where the code of the arguments starts, if known */
     void gen_command_call(
-        ident &id, int comt, int ltype = 0, std::uint32_t nargs = 0
+        ident &id, int comt, int ltype = 0, std::uint32_t nargs = 0,
+        std::size_t argpos = std::size_t(-1)
     );
     void gen_alias_call(ident &id, std::uint32_t nargs = 0);
     void gen_call(std::uint32_t nargs = 0);
@@ -101,7 +107,12 @@ struct gen_state {
     );
 
 private:
+    bool is_lookup_arg(ident &id, std::size_t pos, std::size_t end) const;
+
     valbuf<std::uint32_t> code;
+    /* position of the last command call and of its arguments */
+    std::size_t last_com = std::size_t(-1);
+    std::size_t last_com_args = std::size_t(-1);
 };
 
 } /* namespace cubescript */
@@ -0,0 +1,251 @@
+#include <cstdio>
+#include <algorithm>
+#include <cubescript/cubescript.hh>
+
+#include "cs_bcode.hh"
+#include "cs_state.hh"
+#include "cs_strman.hh"
+#include "cs_thread.hh"
+#include "cs_error.hh"
+
+namespace cubescript {
+
+/* heap report
+ *
+ * a line based text format meant to be diffed and parsed by scripts; every
+ * line is a keyword followed by space separated fields, strings are quoted
+ * and escaped like in the language, sizes are in bytes:
+ *
+ * heap VERSION
+ * strings COUNT BYTES POOLED POOLED_BYTES
+ * string_bucket MIN COUNT BYTES     (sizes from MIN up to twice that)
+ * string_size BYTES REFS "PREFIX"   (largest pooled strings)
+ * string_refs REFS BYTES "PREFIX"   (most referenced pooled strings)
+ * code COUNT BYTES
+ * code_bucket MIN COUNT BYTES
+ * code_alias BYTES NAME             (largest code owned by aliases)
+ * code_shared BYTES REFS            (shared code with a cached ident table)
+ * code_other COUNT BYTES            (code held elsewhere, e.g. by the host)
+ */
+
+static constexpr int HEAP_REPORT_VERSION = 1;
+static constexpr std::size_t HEAP_PREFIX = 32;
+
+struct heap_str {
+    std::string_view str;
+    std::size_t refs;
+    std::size_t size;
+};
+
+struct heap_code {
+    std::uint32_t const *start;
+    std::size_t size;
+    ident const *owner;
+};
+
+struct heap_buckets {
+    std::size_t count[64] = {};
+    std::size_t bytes[64] = {};
+
+    void add(std::size_t sz) {
+        std::size_t b = 0;
+        while ((std::size_t(2) << b) <= sz) {
+            ++b;
+        }
+        ++count[b];
+        bytes[b] += sz;
+    }
+
+    void write(std::FILE *f, char const *kw) const {
+        for (std::size_t i = 0; i < 64; ++i) {
+            if (count[i]) {
+                std::fprintf(
+                    f, "%s %zu %zu %zu\n", kw, std::size_t(1) << i,
+                    count[i], bytes[i]
+                );
+            }
+        }
+    }
+};
+
+static void heap_put_str(std::FILE *f, std::string_view str) {
+    struct file_writer {
+        std::FILE *f;
+        file_writer &operator*() { return *this; }
+        file_writer &operator++(int) { return *this; }
+        file_writer &operator=(char c) {
+            std::fputc(c, f);
+            return *this;
+        }
+    };
+    escape_string(file_writer{f}, str.substr(0, HEAP_PREFIX));
+}
+
+/* largest first, ties broken by contents so that reports diff well */
+static bool heap_by_size(heap_str const &a, heap_str const &b) {
+    if (a.size != b.size) {
+        return a.size > b.size;
+    }
+    return a.str < b.str;
+}
+
+static bool heap_by_refs(heap_str const &a, heap_str const &b) {
+    if (a.refs != b.refs) {
+        return a.refs > b.refs;
+    }
+    return a.str < b.str;
+}
+
+static void report_strings(thread_state &ts, std::FILE *f, std::size_t top) {
+    auto &st = ts.istate->stats;
+    valbuf<heap_str> strs{ts.istate};
+    heap_buckets buckets;
+    std::size_t pbytes = 0;
+    for (auto &p: ts.istate->strman->counts) {
+        auto *ptr = p.first.data();
+        auto sz = str_managed_size(ptr);
+        strs.emplace_back(heap_str{p.first, str_managed_refs(ptr), sz});
+        buckets.add(sz);
+        pbytes += sz;
+    }
+    std::fprintf(
+        f, "strings %zu %zu %zu %zu\n", st.strings, st.string_bytes,
+        strs.size(), pbytes
+    );
+    buckets.write(f, "string_bucket");
+    if (strs.empty()) {
+        return;
+    }
+    auto *beg = strs.data();
+    auto *end = beg + strs.size();
+    auto n = std::min(top, strs.size());
+    std::partial_sort(beg, beg + n, end, heap_by_size);
+    for (std::size_t i = 0; i < n; ++i) {
+        std::fprintf(f, "string_size %zu %zu ", beg[i].size, beg[i].refs);
+        heap_put_str(f, beg[i].str);
+        std::fputc('\n', f);
+    }
+    std::partial_sort(beg, beg + n, end, heap_by_refs);
+    for (std::size_t i = 0; i < n; ++i) {
+        std::fprintf(f, "string_refs %zu %zu ", beg[i].refs, beg[i].size);
+        heap_put_str(f, beg[i].str);
+        std::fputc('\n', f);
+    }
+}
+
+static void heap_code_add(
+    thread_state &ts, valbuf<heap_code> &codes,
+    bcode_ref const &code, ident const *owner
+) {
+    auto *bc = bcode_p{code}.get();
+    if (!bc) {
+        return;
+    }
+    auto *start = bcode_start(bc->raw());
+    auto sz = bcode_block_size(ts.istate, start);
+    if (sz) {
+        codes.emplace_back(heap_code{start, sz, owner});
+    }
+}
+
+static void report_code(thread_state &ts, std::FILE *f, std::size_t top) {
+    auto &st = ts.istate->stats;
+    valbuf<heap_code> codes{ts.istate};
+    /* code owned by aliases, as seen by this thread */
+    for (auto *id: ts.istate->identmap) {
+        if (id->type() != ident_type::ALIAS) {
+            continue;
+        }
+        auto *a = static_cast<alias_impl *>(id);
+        ident_stack *node = &a->p_initial;
+        auto it = ts.astacks.find(a->index());
+        if (it != ts.astacks.end()) {
+            node = it->second.node;
+        }
+        for (; node; node = node->next) {
+            heap_code_add(ts, codes, node->code, id);
+        }
+    }
+    /* a block may be referenced more than once */
+    std::sort(codes.data(), codes.data() + codes.size(), [](
+        heap_code const &a, heap_code const &b
+    ) {
+        return a.start < b.start;
+    });
+    std::size_t nuniq = 0, abytes = 0;
+    heap_buckets buckets;
+    for (std::size_t i = 0; i < codes.size(); ++i) {
+        if (nuniq && (codes[nuniq - 1].start == codes[i].start)) {
+            continue;
+        }
+        codes[nuniq++] = codes[i];
+        buckets.add(codes[i].size);
+        abytes += codes[i].size;
+    }
+    codes.resize(nuniq);
+    std::fprintf(f, "code %zu %zu\n", st.code_blocks, st.code_bytes);
+    buckets.write(f, "code_bucket");
+    auto n = std::min(top, nuniq);
+    if (n) {
+        std::partial_sort(
+            codes.data(), codes.data() + n, codes.data() + nuniq, [](
+                heap_code const &a, heap_code const &b
+            ) {
+                if (a.size != b.size) {
+                    return a.size > b.size;
+                }
+                return a.owner->name() < b.owner->name();
+            }
+        );
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        std::fprintf(f, "code_alias %zu ", codes[i].size);
+        heap_put_str(f, codes[i].owner->name());
+        std::fputc('\n', f);
+    }
+    for (auto &p: ts.istate->shared_code) {
+        auto sz = bcode_block_size(ts.istate, p.first);
+        if (sz) {
+            std::fprintf(
+                f, "code_shared %zu %zu\n", sz, std::size_t(p.first[0] >> 8)
+            );
+        }
+    }
+    std::fprintf(
+        f, "code_other %zu %zu\n",
+        (st.code_blocks > nuniq) ? (st.code_blocks - nuniq) : 0,
+        (st.code_bytes > abytes) ? (st.code_bytes - abytes) : 0
+    );
+}
+
+static void write_report(
+    thread_state &ts, std::string_view path, std::size_t top
+) {
+    charbuf fname{ts};
+    fname.append(path);
+    fname.push_back('\0');
+    auto *f = std::fopen(fname.data(), "wb");
+    if (!f) {
+        throw error_p::make(
+            *ts.pstate, "could not write file \"%.*s\"",
+            int(path.size()), path.data()
+        );
+    }
+    std::fprintf(f, "heap %d\n", HEAP_REPORT_VERSION);
+    try {
+        report_strings(ts, f, top);
+        report_code(ts, f, top);
+    } catch (...) {
+        std::fclose(f);
+        throw;
+    }
+    std::fclose(f);
+}
+
+LIBCUBESCRIPT_EXPORT void state::heap_report(
+    std::string_view path, std::size_t top
+) {
+    write_report(*p_tstate, path, top);
+}
+
+} /* namespace cubescript */
@@ -1,6 +1,9 @@
 #include "cs_ident.hh"
 
 #include "cs_bcode.hh"
+#include "cs_gen.hh"
+#include "cs_record.hh"
+#include "cs_strman.hh"
 #include "cs_thread.hh"
 #include "cs_vm.hh"
 #include "cs_error.hh"
@@ -103,14 +106,42 @@ command *var_impl::get_setter(thread_state &ts) const {
 void command_impl::call(
     thread_state &ts, span_type<any_value> args, any_value &ret
 ) const {
+    auto *self = const_cast<command_impl *>(this);
+    /* only this command may take the string of the alias, not ones called
+     * by a hook or by the command itself
+     */
+    auto *unshare = std::exchange(ts.unshare, nullptr);
+    if (ts.hooked(hook_event::CALL)) {
+        ts.run_hook(hook_event::CALL, self);
+    }
     auto idstsz = ts.idstack.size();
+    usage_timer ut{ts.istate, this};
+    bool rec = ts.rec && record_command_begin(ts, *this);
     try {
+        ts.unshare = unshare;
         p_cb_cftv(*ts.pstate, args, ret);
     } catch (...) {
+        ts.unshare = nullptr;
         ts.idstack.resize(idstsz);
+        if (rec) {
+            record_command_error(ts);
+        }
         throw;
     }
+    if (unshare && !ts.unshare) {
+        /* the string was taken, so give the alias the result until it is
+         * assigned; it is lent, as it is not shared for long
+         */
+        str_lend(*ts.pstate, ts.get_astack(unshare).node->val_s, ret);
+    }
+    ts.unshare = nullptr;
     ts.idstack.resize(idstsz);
+    if (rec) {
+        record_command_end(ts, ret);
+    }
+    if (ts.hooked(hook_event::RETURN)) {
+        ts.run_hook(hook_event::RETURN, self);
+    }
 }
 
 bool ident_is_used_arg(ident const *id, thread_state &ts) {
@@ -129,9 +160,43 @@ void alias_stack::pop() {
     node = node->next;
 }
 
+/* whether the new value of an alias compiles to what its code came from;
+ * the old value is still held, so a matching pointer cannot be a new string
+ * that reused freed memory
+ */
+static bool same_body(
+    thread_state &ts, any_value const &ov, any_value const &nv
+) {
+    if (ov.type() != nv.type()) {
+        return false;
+    }
+    switch (ov.type()) {
+        case value_type::STRING:
+            return ov.get_string(*ts.pstate) == nv.get_string(*ts.pstate);
+        case value_type::CODE:
+            return (
+                bcode_p{ov.get_code()}.get() == bcode_p{nv.get_code()}.get()
+            );
+        default:
+            break;
+    }
+    return false;
+}
+
+void alias_stack::reset_code(thread_state &ts, any_value const &v) {
+    if (!node->code) {
+        return;
+    }
+    if (same_body(ts, node->val_s, v)) {
+        ++ts.istate->stats.code_kept;
+        return;
+    }
+    node->code = bcode_ref{};
+}
+
 void alias_stack::set_arg(alias *a, thread_state &ts, any_value &v) {
     if (ident_is_used_arg(a, ts)) {
-        node->code = bcode_ref{};
+        reset_code(ts, v);
     } else {
         push(ts.idstack.emplace_back());
         ts.callstack.back().usedargs[a->index()] = true;
@@ -140,15 +205,28 @@ void alias_stack::set_arg(alias *a, thread_state &ts, any_value &v) {
 }
 
 void alias_stack::set_alias(alias *a, thread_state &ts, any_value &v) {
+    reset_code(ts, v);
     node->val_s = std::move(v);
-    node->code = bcode_ref{};
     flags = ts.ident_flags;
+    note_usage(ts.istate, a, &ident_usage::assigns);
     auto *imp = static_cast<alias_impl *>(a);
     if (node == &imp->p_initial) {
         imp->p_flags = flags;
+        if (record_host(ts)) {
+            record_set(ts, *a, node->val_s);
+        }
     }
 }
 
+void alias_stack::compile(thread_state &ts) {
+    if (node->code) {
+        return;
+    }
+    gen_state gs{ts};
+    gs.gen_main(node->val_s.get_string(*ts.pstate));
+    node->code = gs.steal_ref();
+}
+
 /* public interface */
 
 LIBCUBESCRIPT_EXPORT ident::~ident() {}
@@ -314,6 +392,11 @@ LIBCUBESCRIPT_EXPORT void builtin_var::set_raw_value(
             break;
     }
     static_cast<var_impl *>(p_impl)->p_storage = std::move(val);
+    auto &ts = state_p{cs}.ts();
+    note_usage(ts.istate, this, &ident_usage::assigns);
+    if (record_host(ts)) {
+        record_set(ts, *this, static_cast<var_impl *>(p_impl)->p_storage);
+    }
 }
 
 LIBCUBESCRIPT_EXPORT void builtin_var::set_value(
@@ -348,6 +431,19 @@ LIBCUBESCRIPT_EXPORT void alias::set_value(state &cs, any_value v) {
     }
 }
 
+LIBCUBESCRIPT_EXPORT bool alias::compile(state &cs) {
+    auto &ts = state_p{cs}.ts();
+    if (is_arg() && !ident_is_used_arg(this, ts)) {
+        return false;
+    }
+    auto &ast = ts.get_astack(this);
+    if (ast.node->val_s.type() == value_type::NONE) {
+        return false;
+    }
+    ast.compile(ts);
+    return true;
+}
+
 LIBCUBESCRIPT_EXPORT bool alias::is_arg() const {
     return (static_cast<alias_impl const *>(this)->p_flags & IDENT_FLAG_ARG);
 }
@@ -362,7 +458,10 @@ LIBCUBESCRIPT_EXPORT any_value alias::call(
     auto nargs = args.size();
     auto &ast = ts.get_astack(this);
     if (ast.node->val_s.type() != value_type::NONE) {
-        return exec_alias(cs, ts, this, &args[0], nargs, ast);
+        if (record_entry(ts)) {
+            record_alias_call(ts, *this, args);
+        }
+        return exec_alias(cs, ts, this, args.data(), nargs, ast);
     }
     return any_value{};
 }
@@ -400,7 +499,7 @@ LIBCUBESCRIPT_EXPORT any_value command::call(
         }
         targs.resize(osz);
     } else {
-        exec_command(ts, &cimpl, this, &args[0], ret, nargs, false);
+        exec_command(ts, &cimpl, this, args.data(), ret, nargs, false);
     }
     return ret;
 }
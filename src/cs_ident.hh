@@ -22,7 +22,11 @@ enum {
     IDENT_FLAG_READONLY   = 1 << 2,
     IDENT_FLAG_OVERRIDE   = 1 << 3,
     IDENT_FLAG_OVERRIDDEN = 1 << 4,
-    IDENT_FLAG_PERSIST    = 1 << 5
+    IDENT_FLAG_PERSIST    = 1 << 5,
+    /* commands: may reuse the string of the first argument if unique */
+    IDENT_FLAG_INPLACE    = 1 << 6,
+    /* commands: part of the library rather than the host */
+    IDENT_FLAG_STD        = 1 << 7
 };
 
 struct ident_stack {
@@ -39,8 +43,14 @@ struct alias_stack {
     void push(ident_stack &st);
     void pop();
 
+    /* drop the code of the current node unless v has the same body */
+    void reset_code(thread_state &ts, any_value const &v);
+
     void set_arg(alias *a, thread_state &ts, any_value &v);
     void set_alias(alias *a, thread_state &ts, any_value &v);
+
+    /* generate the code for the current node if not already present */
+    void compile(thread_state &ts);
 };
 
 struct ident_impl {
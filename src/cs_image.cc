@@ -0,0 +1,432 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cubescript/cubescript.hh>
+
+#include "cs_image.hh"
+#include "cs_bcode.hh"
+#include "cs_error.hh"
+#include "cs_gen.hh"
+#include "cs_ident.hh"
+#include "cs_map.hh"
+#include "cs_state.hh"
+
+namespace cubescript {
+
+/* "CSSI" */
+static constexpr std::uint32_t IMG_MAGIC = 0x49535343;
+static constexpr std::uint32_t IMG_VERSION = 1
+    | (sizeof(integer_type) << 8) | (sizeof(float_type) << 16);
+static constexpr std::size_t IMG_HDR = 3;
+
+struct image_writer {
+    image_writer(thread_state &t, std::FILE *fp):
+        ts{t}, f{fp}, code{t.istate}
+    {}
+
+    void put(void const *p, std::size_t n) {
+        static constexpr char pad[4] = {};
+        if (n) {
+            std::fwrite(p, 1, n, f);
+            std::fwrite(pad, 1, (4 - (n & 3)) & 3, f);
+        }
+    }
+
+    void put_u32(std::uint32_t v) {
+        put(&v, sizeof(v));
+    }
+
+    void put_str(std::string_view s) {
+        put_u32(std::uint32_t(s.size()));
+        put(s.data(), s.size());
+    }
+
+    void put_entry(int tag, value_type vt, int flags, std::string_view name) {
+        put_u32(std::uint32_t(tag | (int(vt) << 8) | (flags << 16)));
+        put_str(name);
+    }
+
+    /* sources and vectors are stored as their string */
+    void put_value(any_value const &v) {
+        switch (v.type()) {
+            case value_type::INTEGER: {
+                auto i = v.get_integer();
+                put_u32(sizeof(i));
+                put(&i, sizeof(i));
+                break;
+            }
+            case value_type::FLOAT: {
+                auto fv = v.get_float();
+                put_u32(sizeof(fv));
+                put(&fv, sizeof(fv));
+                break;
+            }
+            default:
+                put_str(v.get_string(*ts.pstate));
+                break;
+        }
+    }
+
+    static value_type stored_type(any_value const &v) {
+        switch (v.type()) {
+            case value_type::INTEGER:
+            case value_type::FLOAT:
+                return v.type();
+            default:
+                return value_type::STRING;
+        }
+    }
+
+    /* the body compiled the same way as an alias, but shared; a body that
+     * does not compile gets no code and raises its error when called
+     */
+    void put_code(any_value const &v) {
+        bcode_ref ref;
+        try {
+            gen_state gs{ts};
+            gs.gen_main(v.get_string(*ts.pstate));
+            ref = gs.steal_shared_ref();
+        } catch (error const &) {
+            put_u32(0);
+            return;
+        }
+        auto *start = bcode_start(bcode_p{ref}.get()->raw());
+        auto sz = bcode_image(ts, start, nullptr, 0);
+        code.resize(sz / sizeof(std::uint32_t));
+        bcode_image(ts, start, code.data(), sz);
+        put_u32(std::uint32_t(sz));
+        put(code.data(), sz);
+    }
+
+    bool write(ident &id) {
+        switch (id.type()) {
+            case ident_type::COMMAND:
+                put_entry(IMG_COMMAND, value_type::NONE, 0, id.name());
+                put_str(static_cast<command &>(id).args());
+                return true;
+            case ident_type::VAR: {
+                auto &v = static_cast<builtin_var &>(id);
+                auto val = v.value(*ts.pstate);
+                put_entry(
+                    IMG_VAR, stored_type(val),
+                    (int(v.variable_type()) << 1) | int(v.is_read_only()),
+                    id.name()
+                );
+                put_value(val);
+                return true;
+            }
+            case ident_type::ALIAS: {
+                auto &a = static_cast<alias_impl &>(id);
+                if (a.is_arg()) {
+                    return false;
+                }
+                /* what this thread sees, like precompile_aliases */
+                ident_stack *node = &a.p_initial;
+                int flags = a.p_flags;
+                auto it = ts.astacks.find(a.index());
+                if (it != ts.astacks.end()) {
+                    node = it->second.node;
+                    flags = it->second.flags;
+                }
+                auto &val = node->val_s;
+                if (
+                    (flags & IDENT_FLAG_UNKNOWN) ||
+                    (val.type() == value_type::NONE)
+                ) {
+                    return false;
+                }
+                put_entry(
+                    IMG_ALIAS, stored_type(val), flags & IDENT_FLAG_PERSIST,
+                    id.name()
+                );
+                put_value(val);
+                put_code(val);
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    thread_state &ts;
+    std::FILE *f;
+    valbuf<std::uint32_t> code;
+};
+
+void image_save(thread_state &ts, std::string_view path) {
+    charbuf fname{ts};
+    fname.append(path);
+    fname.push_back('\0');
+    auto *f = std::fopen(fname.data(), "wb");
+    if (!f) {
+        throw error_p::make(
+            *ts.pstate, "could not write file \"%.*s\"",
+            int(path.size()), path.data()
+        );
+    }
+    image_writer w{ts, f};
+    /* the entry count is filled in at the end */
+    std::uint32_t hdr[IMG_HDR] = {IMG_MAGIC, IMG_VERSION, 0};
+    w.put(hdr, sizeof(hdr));
+    try {
+        for (auto *id: ts.istate->identmap) {
+            hdr[2] += w.write(*id);
+        }
+    } catch (...) {
+        std::fclose(f);
+        std::remove(fname.data());
+        throw;
+    }
+    bool ok = !std::fseek(f, 0, SEEK_SET);
+    ok = ok && (std::fwrite(hdr, sizeof(hdr), 1, f) == 1);
+    ok = !std::ferror(f) && ok;
+    ok = !std::fclose(f) && ok;
+    if (!ok) {
+        std::remove(fname.data());
+        throw error_p::make(
+            *ts.pstate, "could not write file \"%.*s\"",
+            int(path.size()), path.data()
+        );
+    }
+}
+
+struct image_reader {
+    image_reader(thread_state &t, file_map const &m):
+        ts{t}, data{static_cast<char const *>(m.data)}, size{m.size}
+    {}
+
+    [[noreturn]] void fail() {
+        throw error{*ts.pstate, "malformed state image"};
+    }
+
+    char const *get(std::size_t n) {
+        auto padded = (n + 3) & ~std::size_t(3);
+        if ((padded < n) || ((size - pos) < padded)) {
+            fail();
+        }
+        auto *ret = &data[pos];
+        pos += padded;
+        return ret;
+    }
+
+    std::uint32_t get_u32() {
+        std::uint32_t v;
+        std::memcpy(&v, get(sizeof(v)), sizeof(v));
+        return v;
+    }
+
+    std::string_view get_str() {
+        auto len = get_u32();
+        return std::string_view{get(len), len};
+    }
+
+    void get_value(value_type vt, any_value &v) {
+        auto s = get_str();
+        switch (vt) {
+            case value_type::INTEGER: {
+                integer_type i;
+                if (s.size() != sizeof(i)) {
+                    fail();
+                }
+                std::memcpy(&i, s.data(), sizeof(i));
+                v.set_integer(i);
+                break;
+            }
+            case value_type::FLOAT: {
+                float_type f;
+                if (s.size() != sizeof(f)) {
+                    fail();
+                }
+                std::memcpy(&f, s.data(), sizeof(f));
+                v.set_float(f);
+                break;
+            }
+            case value_type::STRING:
+                v.set_string(s, *ts.pstate);
+                break;
+            default:
+                fail();
+        }
+    }
+
+    /* everything the image needs must be in place before changing any of
+     * the state, so the commands and the kinds of idents are checked first
+     */
+    void check_entry(
+        int tag, value_type vt, std::string_view name, any_value &val
+    ) {
+        auto &cs = *ts.pstate;
+        auto id = cs.get_ident(name);
+        switch (tag) {
+            case IMG_COMMAND: {
+                auto args = get_str();
+                if (
+                    !id || (id->get().type() != ident_type::COMMAND) ||
+                    (static_cast<command &>(id->get()).args() != args)
+                ) {
+                    throw error_p::make(
+                        cs, "state image needs command '%.*s' (%.*s)",
+                        int(name.size()), name.data(),
+                        int(args.size()), args.data()
+                    );
+                }
+                return;
+            }
+            case IMG_VAR:
+                get_value(vt, val);
+                if (id && (
+                    (id->get().type() != ident_type::VAR) ||
+                    (static_cast<builtin_var &>(id->get()).value(cs).type()
+                        != vt)
+                )) {
+                    throw error_p::make(
+                        cs, "state image has a different var '%.*s'",
+                        int(name.size()), name.data()
+                    );
+                }
+                return;
+            case IMG_ALIAS: {
+                get_value(vt, val);
+                auto csz = get_u32();
+                auto *img = get(csz);
+                if (id && (id->get().type() != ident_type::ALIAS)) {
+                    throw error_p::make(
+                        cs, "cannot redefine builtin %.*s with an alias",
+                        int(name.size()), name.data()
+                    );
+                }
+                /* the code is used in place and refers to nothing else, so
+                 * checking it here leaves nothing that can fail later
+                 */
+                if (csz) {
+                    try {
+                        bcode_load_image(ts, img, csz);
+                    } catch (error const &) {
+                        fail();
+                    }
+                }
+                return;
+            }
+            default:
+                fail();
+        }
+    }
+
+    void load_var(std::string_view name, int flags, any_value &val) {
+        auto &cs = *ts.pstate;
+        if (auto id = cs.get_ident(name); id) {
+            static_cast<builtin_var &>(id->get()).set_raw_value(
+                cs, std::move(val)
+            );
+            return;
+        }
+        bool ro = (flags & 1);
+        auto vtp = var_type(flags >> 1);
+        switch (val.type()) {
+            case value_type::INTEGER:
+                cs.new_var(name, val.get_integer(), ro, vtp);
+                break;
+            case value_type::FLOAT:
+                cs.new_var(name, val.get_float(), ro, vtp);
+                break;
+            default:
+                cs.new_var(name, val.get_string(cs), ro, vtp);
+                break;
+        }
+    }
+
+    void load_alias(std::string_view name, int flags, any_value &val) {
+        auto &cs = *ts.pstate;
+        auto csz = get_u32();
+        auto *img = get(csz);
+        auto oflags = ts.ident_flags;
+        ts.ident_flags = (oflags & ~IDENT_FLAG_PERSIST) | flags;
+        try {
+            cs.assign_value(name, std::move(val));
+        } catch (...) {
+            ts.ident_flags = oflags;
+            throw;
+        }
+        ts.ident_flags = oflags;
+        if (!csz) {
+            return;
+        }
+        auto &a = static_cast<alias &>(cs.get_ident(name)->get());
+        ts.get_astack(&a).node->code = bcode_load_image(ts, img, csz);
+    }
+
+    std::size_t run() {
+        if (
+            (get_u32() != IMG_MAGIC) || (get_u32() != IMG_VERSION)
+        ) {
+            throw error{*ts.pstate, "incompatible state image"};
+        }
+        auto nents = get_u32();
+        auto start = pos;
+        any_value val;
+        for (std::uint32_t i = 0; i < nents; ++i) {
+            auto hdr = get_u32();
+            check_entry(
+                int(hdr & 0xFF), value_type((hdr >> 8) & 0xFF), get_str(), val
+            );
+        }
+        pos = start;
+        applying = true;
+        std::size_t ret = 0;
+        for (std::uint32_t i = 0; i < nents; ++i) {
+            auto hdr = get_u32();
+            auto vt = value_type((hdr >> 8) & 0xFF);
+            int flags = int(hdr >> 16);
+            auto name = get_str();
+            switch (hdr & 0xFF) {
+                case IMG_COMMAND:
+                    get_str();
+                    continue;
+                case IMG_VAR:
+                    get_value(vt, val);
+                    load_var(name, flags, val);
+                    break;
+                default:
+                    get_value(vt, val);
+                    load_alias(name, flags, val);
+                    break;
+            }
+            ++ret;
+        }
+        return ret;
+    }
+
+    thread_state &ts;
+    char const *data;
+    std::size_t size;
+    std::size_t pos = 0;
+    bool applying = false;
+};
+
+std::size_t image_load(thread_state &ts, std::string_view path) {
+    file_map m;
+    if (!file_map_open(ts.istate, path, m)) {
+        throw error_p::make(
+            *ts.pstate, "could not read file \"%.*s\"",
+            int(path.size()), path.data()
+        );
+    }
+    image_reader rd{ts, m};
+    std::size_t ret;
+    try {
+        ret = rd.run();
+    } catch (...) {
+        /* code may be in use already if it failed while restoring */
+        if (rd.applying) {
+            ts.istate->maps.push_back(m);
+        } else {
+            file_map_close(ts.istate, m);
+        }
+        throw;
+    }
+    /* the code of the aliases is used in place */
+    ts.istate->maps.push_back(m);
+    return ret;
+}
+
+} /* namespace cubescript */
@@ -0,0 +1,37 @@
+#ifndef LIBCUBESCRIPT_IMAGE_HH
+#define LIBCUBESCRIPT_IMAGE_HH
+
+#include <cubescript/cubescript.hh>
+
+#include <cstddef>
+#include <string_view>
+
+#include "cs_thread.hh"
+
+namespace cubescript {
+
+/* state images
+ *
+ * an image holds the idents of a state as seen by a thread: the commands
+ * by name and argument list, the vars and aliases with their values and
+ * flags, and for every alias its body compiled as shared code; the code
+ * is stored as a bytecode image, which is used in place from the mapped
+ * file when restoring, so nothing has to be parsed or compiled again
+ *
+ * the image starts with a header like a replay log does, followed by
+ * entries; everything is in 32-bit words, strings are stored as a length
+ * in bytes followed by the contents padded to a whole word, and values as
+ * such strings holding the raw integer, float or string
+ */
+enum {
+    IMG_COMMAND = 1, /* name, argument list */
+    IMG_VAR,         /* name, value; var type and read-only flag */
+    IMG_ALIAS        /* name, value, code image size, code image */
+};
+
+void image_save(thread_state &ts, std::string_view path);
+std::size_t image_load(thread_state &ts, std::string_view path);
+
+} /* namespace cubescript */
+
+#endif
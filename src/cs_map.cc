@@ -0,0 +1,102 @@
+#if defined(__unix__) || defined(__APPLE__)
+#  define CS_MAP_MMAP 1
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+
+#include "cs_map.hh"
+#include "cs_std.hh"
+
+namespace cubescript {
+
+#ifdef CS_MAP_MMAP
+static bool file_map_mmap(char const *path, file_map &ret) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    ret.size = std::size_t(st.st_size);
+    if (!ret.size) {
+        /* cannot map empty files */
+        close(fd);
+        ret.data = nullptr;
+        ret.mapped = false;
+        return true;
+    }
+    void *p = mmap(nullptr, ret.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    ret.data = p;
+    ret.mapped = true;
+    return true;
+}
+#endif
+
+bool file_map_open(internal_state *cs, std::string_view path, file_map &ret) {
+    charbuf fname{cs};
+    fname.append(path);
+    fname.push_back('\0');
+#ifdef CS_MAP_MMAP
+    if (file_map_mmap(fname.data(), ret)) {
+        return true;
+    }
+#endif
+    auto *f = std::fopen(fname.data(), "rb");
+    if (!f) {
+        return false;
+    }
+    charbuf buf{cs};
+    char rbuf[4096];
+    for (;;) {
+        auto n = std::fread(rbuf, 1, sizeof(rbuf), f);
+        if (!n) {
+            break;
+        }
+        buf.append(rbuf, rbuf + n);
+    }
+    bool err = std::ferror(f);
+    std::fclose(f);
+    if (err) {
+        return false;
+    }
+    ret.size = buf.size();
+    ret.mapped = false;
+    ret.data = nullptr;
+    if (ret.size) {
+        auto *p = std_allocator<char>{cs}.allocate(ret.size);
+        std::memcpy(p, buf.data(), ret.size);
+        ret.data = p;
+    }
+    return true;
+}
+
+void file_map_close(internal_state *cs, file_map &m) {
+    if (!m.data) {
+        return;
+    }
+#ifdef CS_MAP_MMAP
+    if (m.mapped) {
+        munmap(const_cast<void *>(m.data), m.size);
+        m.data = nullptr;
+        return;
+    }
+#endif
+    std_allocator<char>{cs}.deallocate(
+        static_cast<char *>(const_cast<void *>(m.data)), m.size
+    );
+    m.data = nullptr;
+}
+
+} /* namespace cubescript */
@@ -0,0 +1,28 @@
+#ifndef LIBCUBESCRIPT_MAP_HH
+#define LIBCUBESCRIPT_MAP_HH
+
+#include <cubescript/cubescript.hh>
+
+#include <cstddef>
+#include <string_view>
+
+namespace cubescript {
+
+struct internal_state;
+
+struct file_map {
+    void const *data = nullptr;
+    std::size_t size = 0;
+    /* whether the data is mapped, otherwise it was read into memory */
+    bool mapped = false;
+};
+
+/* map a file read-only, shared between processes where supported, or
+ * read it into memory otherwise; returns false if it cannot be opened
+ */
+bool file_map_open(internal_state *cs, std::string_view path, file_map &ret);
+void file_map_close(internal_state *cs, file_map &m);
+
+} /* namespace cubescript */
+
+#endif
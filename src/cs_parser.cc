@@ -1,5 +1,6 @@
 #include <cubescript/cubescript.hh>
 
+#include <algorithm>
 #include <cmath>
 #include <cctype>
 #include <limits>
@@ -925,6 +926,7 @@ bool parser_state::parse_call_command(
     command_impl *id, ident &self, int rettype
 ) {
     std::uint32_t comtype = BC_INST_COM, numargs = 0, fakeargs = 0;
+    auto argpos = gs.count();
     auto fmt = id->args();
     bool more = true, rep = false;
     for (auto it = fmt.begin(); it != fmt.end(); ++it) {
@@ -993,7 +995,7 @@ bool parser_state::parse_call_command(
                 break;
         }
     }
-    gs.gen_command_call(*id, comtype, rettype, numargs);
+    gs.gen_command_call(*id, comtype, rettype, numargs, argpos);
     return more;
 }
 
@@ -1414,6 +1416,56 @@ void parser_state::parse_block(int ltype, int term) {
     }
 }
 
+static bool list_needs_quote(std::string_view item) {
+    if (item.empty()) {
+        return true;
+    }
+    for (auto c: item) {
+        switch (c) {
+            case ' ': case '\t': case '\r': case '\n':
+            case '"': case '(': case ')': case '[': case ']': case ';':
+            case '/':
+                return true;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+void list_quote_item(charbuf &buf, std::string_view item) {
+    if (list_needs_quote(item)) {
+        escape_string(std::back_inserter(buf), item);
+    } else {
+        buf.append(item);
+    }
+}
+
+char *list_quote_item(char *out, std::string_view item) {
+    if (list_needs_quote(item)) {
+        return escape_string(out, item);
+    }
+    return std::copy(item.begin(), item.end(), out);
+}
+
+std::size_t list_quote_size(std::string_view item) {
+    if (!list_needs_quote(item)) {
+        return item.size();
+    }
+    /* the quotes and whatever escape_string escapes */
+    std::size_t n = item.size() + 2;
+    for (auto c: item) {
+        switch (c) {
+            case '\n': case '\t': case '\f': case '"': case '^':
+                ++n;
+                break;
+            default:
+                break;
+        }
+    }
+    return n;
+}
+
 /* list parser public implementation */
 
 LIBCUBESCRIPT_EXPORT bool list_parser::parse() {
@@ -20,6 +20,13 @@ float_type parse_float(std::string_view input, std::string_view *end = nullptr);
 
 bool is_valid_name(std::string_view input);
 
+/* append an item to a list, quoting it if needed to read back the same */
+void list_quote_item(charbuf &buf, std::string_view item);
+char *list_quote_item(char *out, std::string_view item);
+
+/* the number of characters list_quote_item writes for an item */
+std::size_t list_quote_size(std::string_view item);
+
 struct parser_state {
     thread_state &ts;
     gen_state &gs;
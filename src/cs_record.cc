@@ -0,0 +1,608 @@
+#include <cstdio>
+#include <cstring>
+#include <cubescript/cubescript.hh>
+
+#include "cs_record.hh"
+#include "cs_bcode.hh"
+#include "cs_error.hh"
+#include "cs_map.hh"
+#include "cs_state.hh"
+#include "cs_thread.hh"
+
+namespace cubescript {
+
+/* "CSRL" */
+static constexpr std::uint32_t REC_MAGIC = 0x4C525343;
+static constexpr std::uint32_t REC_VERSION = 1
+    | (sizeof(integer_type) << 8) | (sizeof(float_type) << 16);
+
+struct recorder {
+    using code_allocator = std_allocator<
+        std::pair<bcode *const, std::uint32_t>
+    >;
+
+    recorder(thread_state &t, std::FILE *fp):
+        ts{t}, f{fp}, codes{code_allocator{t.istate}},
+        refs{t.istate}, vars{t.istate}, vals{t.istate}
+    {}
+
+    void put(void const *p, std::size_t n) {
+        if (n) {
+            std::fwrite(p, 1, n, f);
+        }
+    }
+
+    void put_u8(unsigned char v) {
+        put(&v, 1);
+    }
+
+    void put_u32(std::uint32_t v) {
+        put(&v, sizeof(v));
+    }
+
+    void put_str(std::string_view s) {
+        put_u32(std::uint32_t(s.size()));
+        put(s.data(), s.size());
+    }
+
+    void put_value(any_value const &v) {
+        switch (v.type()) {
+            case value_type::INTEGER: {
+                auto i = v.get_integer();
+                put_u8(int(value_type::INTEGER));
+                put(&i, sizeof(i));
+                break;
+            }
+            case value_type::FLOAT: {
+                auto fv = v.get_float();
+                put_u8(int(value_type::FLOAT));
+                put(&fv, sizeof(fv));
+                break;
+            }
+            case value_type::STRING:
+            case value_type::SOURCE:
+            case value_type::VECTOR:
+                /* sources and vectors replay as their string */
+                put_u8(int(value_type::STRING));
+                put_str(v.get_string(*ts.pstate));
+                break;
+            case value_type::IDENT:
+                put_u8(int(value_type::IDENT));
+                put_str(v.get_ident(*ts.pstate).name());
+                break;
+            default:
+                /* code cannot be recorded */
+                put_u8(int(value_type::NONE));
+                break;
+        }
+    }
+
+    /* declare the idents made since the last event, then start one */
+    void begin(int tag) {
+        auto &ids = ts.istate->identmap;
+        for (; decl_pos < ids.size(); ++decl_pos) {
+            declare(*ids[decl_pos]);
+        }
+        put_u8(tag);
+    }
+
+    void declare(ident &id) {
+        switch (id.type()) {
+            case ident_type::VAR: {
+                auto &v = static_cast<builtin_var &>(id);
+                auto val = v.value(*ts.pstate);
+                put_u8(REC_VAR);
+                put_str(id.name());
+                put_u8(v.is_read_only());
+                put_u8(int(v.variable_type()));
+                put_value(val);
+                vars.push_back(&v);
+                vals.push_back(std::move(val));
+                break;
+            }
+            case ident_type::COMMAND:
+                if (ident_p{id}.impl().p_flags & IDENT_FLAG_STD) {
+                    break;
+                }
+                put_u8(REC_COMMAND);
+                put_str(id.name());
+                put_str(static_cast<command &>(id).args());
+                break;
+            case ident_type::ALIAS: {
+                /* aliases made later get their values from the events */
+                if (!snapshot) {
+                    break;
+                }
+                auto &imp = static_cast<alias_impl &>(id);
+                auto &val = imp.p_initial.val_s;
+                if (imp.is_arg() || (val.type() == value_type::NONE)) {
+                    break;
+                }
+                put_u8(REC_SET);
+                put_str(id.name());
+                put_value(val);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    /* vars bound to host memory may change without us knowing */
+    void sync_vars() {
+        for (std::size_t i = 0; i < vars.size(); ++i) {
+            auto &v = *vars[i];
+            if (!static_cast<var_impl &>(v).ptr) {
+                continue;
+            }
+            auto val = v.value(*ts.pstate);
+            if (same_value(val, vals[i])) {
+                continue;
+            }
+            begin(REC_SET);
+            put_str(v.name());
+            put_value(val);
+            vals[i] = std::move(val);
+        }
+    }
+
+    bool same_value(any_value const &a, any_value const &b) {
+        if (a.type() != b.type()) {
+            return false;
+        }
+        switch (a.type()) {
+            case value_type::INTEGER:
+                return a.get_integer() == b.get_integer();
+            case value_type::FLOAT:
+                return a.get_float() == b.get_float();
+            case value_type::STRING:
+            case value_type::SOURCE:
+            case value_type::VECTOR:
+                return a.get_string(*ts.pstate) == b.get_string(*ts.pstate);
+            default:
+                break;
+        }
+        return true;
+    }
+
+    std::uint32_t add_code(bcode_ref const &code) {
+        auto id = std::uint32_t(refs.size() + 1);
+        codes.emplace(bcode_p{code}.get(), id);
+        refs.push_back(code);
+        return id;
+    }
+
+    thread_state &ts;
+    std::FILE *f;
+    std::size_t decl_pos = 0;
+    bool snapshot = false;
+    std::unordered_map<
+        bcode *, std::uint32_t, std::hash<bcode *>,
+        std::equal_to<bcode *>, code_allocator
+    > codes;
+    /* keeps the recorded code alive, so the pointers stay unique */
+    valbuf<bcode_ref> refs;
+    /* declared vars and their last recorded values */
+    valbuf<builtin_var *> vars;
+    valbuf<any_value> vals;
+};
+
+void record_start(thread_state &ts, std::string_view path) {
+    record_stop(ts);
+    charbuf fname{ts};
+    fname.append(path);
+    fname.push_back('\0');
+    auto *f = std::fopen(fname.data(), "wb");
+    if (!f) {
+        throw error_p::make(
+            *ts.pstate, "could not write file \"%.*s\"",
+            int(path.size()), path.data()
+        );
+    }
+    auto *rec = ts.istate->create<recorder>(ts, f);
+    rec->put_u32(REC_MAGIC);
+    rec->put_u32(REC_VERSION);
+    /* what exists at this point is the starting state of the replay */
+    rec->snapshot = true;
+    auto &ids = ts.istate->identmap;
+    for (; rec->decl_pos < ids.size(); ++rec->decl_pos) {
+        rec->declare(*ids[rec->decl_pos]);
+    }
+    rec->snapshot = false;
+    ts.rec = rec;
+}
+
+void record_stop(thread_state &ts) {
+    if (!ts.rec) {
+        return;
+    }
+    std::fclose(ts.rec->f);
+    ts.istate->destroy(ts.rec);
+    ts.rec = nullptr;
+}
+
+void record_code(
+    thread_state &ts, bcode_ref const &code,
+    std::string_view src, std::string_view name
+) {
+    auto &rec = *ts.rec;
+    auto id = rec.add_code(code);
+    rec.begin(REC_CODE);
+    rec.put_u32(id);
+    rec.put_str(name);
+    rec.put_str(src);
+}
+
+void record_call(thread_state &ts, bcode *code) {
+    auto &rec = *ts.rec;
+    std::uint32_t id = 0;
+    auto it = rec.codes.find(code);
+    if (it != rec.codes.end()) {
+        id = it->second;
+    } else {
+        /* shared code does not need a source, store its image */
+        auto *start = bcode_start(code->raw());
+        if (
+            (bcode_flags(start) & (BC_START_SHARED | BC_START_STATIC)) &&
+            (code->raw() == (start + 1))
+        ) {
+            auto sz = bcode_image(ts, start, nullptr, 0);
+            valbuf<unsigned char> img{ts.istate};
+            img.resize(sz);
+            bcode_image(ts, start, img.data(), sz);
+            id = rec.add_code(bcode_p::make_ref(code));
+            rec.begin(REC_IMAGE);
+            rec.put_u32(id);
+            rec.put_u32(std::uint32_t(sz));
+            rec.put(img.data(), sz);
+        }
+    }
+    rec.sync_vars();
+    rec.begin(REC_CALL);
+    rec.put_u32(id);
+}
+
+void record_alias_call(
+    thread_state &ts, alias const &a, span_type<any_value> args
+) {
+    auto &rec = *ts.rec;
+    rec.sync_vars();
+    rec.begin(REC_CALL_ALIAS);
+    rec.put_str(a.name());
+    rec.put_u32(std::uint32_t(args.size()));
+    for (auto &v: args) {
+        rec.put_value(v);
+    }
+}
+
+void record_set(thread_state &ts, ident const &id, any_value const &v) {
+    auto &rec = *ts.rec;
+    rec.begin(REC_SET);
+    rec.put_str(id.name());
+    rec.put_value(v);
+}
+
+bool record_command_begin(thread_state &ts, command_impl const &cmd) {
+    if (ts.rec_host || (cmd.p_flags & IDENT_FLAG_STD)) {
+        return false;
+    }
+    ++ts.rec_host;
+    return true;
+}
+
+void record_command_end(thread_state &ts, any_value const &ret) {
+    auto &rec = *ts.rec;
+    --ts.rec_host;
+    rec.sync_vars();
+    rec.begin(REC_RESULT);
+    rec.put_value(ret);
+}
+
+void record_command_error(thread_state &ts) {
+    auto &rec = *ts.rec;
+    --ts.rec_host;
+    rec.begin(REC_ERROR);
+    try {
+        throw;
+    } catch (error const &e) {
+        rec.put_str(e.what());
+    } catch (...) {
+        rec.put_str("");
+    }
+}
+
+/* replay */
+
+struct replayer {
+    replayer(thread_state &t, file_map const &m):
+        ts{t}, data{static_cast<char const *>(m.data)},
+        size{m.size}, codes{t.istate}, args{t.istate}
+    {}
+
+    [[noreturn]] void fail() {
+        throw error{*ts.pstate, "malformed replay log"};
+    }
+
+    void get(void *p, std::size_t n) {
+        if ((size - pos) < n) {
+            fail();
+        }
+        std::memcpy(p, &data[pos], n);
+        pos += n;
+    }
+
+    unsigned char get_u8() {
+        unsigned char v;
+        get(&v, 1);
+        return v;
+    }
+
+    std::uint32_t get_u32() {
+        std::uint32_t v;
+        get(&v, sizeof(v));
+        return v;
+    }
+
+    std::string_view get_str() {
+        auto len = get_u32();
+        if ((size - pos) < len) {
+            fail();
+        }
+        std::string_view ret{&data[pos], len};
+        pos += len;
+        return ret;
+    }
+
+    void get_value(any_value &v) {
+        auto &cs = *ts.pstate;
+        switch (value_type(get_u8())) {
+            case value_type::NONE:
+                v.set_none();
+                break;
+            case value_type::INTEGER: {
+                integer_type i;
+                get(&i, sizeof(i));
+                v.set_integer(i);
+                break;
+            }
+            case value_type::FLOAT: {
+                float_type f;
+                get(&f, sizeof(f));
+                v.set_float(f);
+                break;
+            }
+            case value_type::STRING:
+                v.set_string(get_str(), cs);
+                break;
+            case value_type::IDENT:
+                v.set_ident(cs.new_ident(get_str()));
+                break;
+            default:
+                fail();
+        }
+    }
+
+    bcode_ref *get_code() {
+        auto id = get_u32();
+        if (!id) {
+            return nullptr;
+        }
+        if (id > codes.size()) {
+            codes.resize(id);
+        }
+        return &codes[id - 1];
+    }
+
+    void do_var() {
+        auto &cs = *ts.pstate;
+        auto name = get_str();
+        bool ro = get_u8();
+        auto vtp = var_type(get_u8());
+        any_value val;
+        get_value(val);
+        auto id = cs.get_ident(name);
+        if (id) {
+            if (id->get().type() == ident_type::VAR) {
+                static_cast<builtin_var &>(id->get()).set_raw_value(
+                    cs, std::move(val)
+                );
+            }
+            return;
+        }
+        switch (val.type()) {
+            case value_type::INTEGER:
+                cs.new_var(name, val.get_integer(), ro, vtp);
+                break;
+            case value_type::FLOAT:
+                cs.new_var(name, val.get_float(), ro, vtp);
+                break;
+            default:
+                cs.new_var(name, val.get_string(cs), ro, vtp);
+                break;
+        }
+    }
+
+    void do_set() {
+        auto &cs = *ts.pstate;
+        auto name = get_str();
+        any_value val;
+        get_value(val);
+        auto id = cs.get_ident(name);
+        if (id && (id->get().type() == ident_type::VAR)) {
+            /* var hooks are host commands, their effects are in the log */
+            static_cast<builtin_var &>(id->get()).set_raw_value(
+                cs, std::move(val)
+            );
+        } else {
+            cs.assign_value(name, std::move(val));
+        }
+    }
+
+    void do_image() {
+        auto *code = get_code();
+        auto sz = get_u32();
+        if (!code || ((size - pos) < sz)) {
+            fail();
+        }
+        /* images are used in place, keep a copy for the state's lifetime */
+        file_map m;
+        auto *buf = std_allocator<char>{ts.istate}.allocate(sz);
+        std::memcpy(buf, &data[pos], sz);
+        pos += sz;
+        m.data = buf;
+        m.size = sz;
+        ts.istate->maps.push_back(m);
+        *code = ts.pstate->load_code_image(buf, sz);
+    }
+
+    void do_alias_call() {
+        auto &cs = *ts.pstate;
+        auto name = get_str();
+        auto nargs = get_u32();
+        args.resize(nargs);
+        for (std::size_t i = 0; i < nargs; ++i) {
+            get_value(args[i]);
+        }
+        auto id = cs.get_ident(name);
+        if (!id || (id->get().type() != ident_type::ALIAS)) {
+            return;
+        }
+        ++ncalls;
+        try {
+            id->get().call(span_type<any_value>{args.data(), nargs}, cs);
+        } catch (error const &) {
+            /* errors happen the same way as when recording */
+        }
+    }
+
+    /* process one event; top is false when in a command stub */
+    int step(any_value &ret, bool top) {
+        auto &cs = *ts.pstate;
+        auto tag = get_u8();
+        switch (tag) {
+            case REC_VAR:
+                do_var();
+                break;
+            case REC_COMMAND: {
+                auto name = get_str();
+                auto cargs = get_str();
+                if (!cs.get_ident(name)) {
+                    cs.new_command(name, cargs, [](
+                        auto &ccs, auto, auto &res
+                    ) {
+                        replay_command(ccs, res);
+                    });
+                }
+                break;
+            }
+            case REC_SET:
+                do_set();
+                break;
+            case REC_CODE: {
+                auto *code = get_code();
+                auto name = get_str();
+                auto src = get_str();
+                if (!code) {
+                    fail();
+                }
+                *code = cs.compile(src, name);
+                break;
+            }
+            case REC_IMAGE:
+                do_image();
+                break;
+            case REC_CALL: {
+                if (!top) {
+                    throw error{cs, "replay diverged from the log"};
+                }
+                auto *code = get_code();
+                if (!code || !*code) {
+                    break;
+                }
+                ++ncalls;
+                try {
+                    code->call(cs);
+                } catch (error const &) {
+                    /* errors happen the same way as when recording */
+                }
+                break;
+            }
+            case REC_CALL_ALIAS:
+                if (!top) {
+                    throw error{cs, "replay diverged from the log"};
+                }
+                do_alias_call();
+                break;
+            case REC_RESULT:
+                get_value(ret);
+                break;
+            case REC_ERROR:
+                ret.set_string(get_str(), cs);
+                break;
+            default:
+                fail();
+        }
+        return tag;
+    }
+
+    thread_state &ts;
+    char const *data;
+    std::size_t size;
+    std::size_t pos = 0;
+    std::size_t ncalls = 0;
+    valbuf<bcode_ref> codes;
+    valbuf<any_value> args;
+};
+
+std::size_t replay_run(thread_state &ts, std::string_view path) {
+    auto &cs = *ts.pstate;
+    file_map m;
+    if (!file_map_open(ts.istate, path, m)) {
+        throw error_p::make(
+            cs, "could not read file \"%.*s\"", int(path.size()), path.data()
+        );
+    }
+    auto *prev = ts.rep;
+    try {
+        replayer rep{ts, m};
+        if ((rep.get_u32() != REC_MAGIC) || (rep.get_u32() != REC_VERSION)) {
+            throw error{cs, "incompatible replay log"};
+        }
+        ts.rep = &rep;
+        while (rep.pos < rep.size) {
+            /* results of commands the host called by itself are skipped */
+            any_value ret;
+            rep.step(ret, true);
+        }
+        ts.rep = prev;
+        file_map_close(ts.istate, m);
+        return rep.ncalls;
+    } catch (...) {
+        ts.rep = prev;
+        file_map_close(ts.istate, m);
+        throw;
+    }
+}
+
+void replay_command(state &cs, any_value &ret) {
+    auto &ts = state_p{cs}.ts();
+    if (!ts.rep) {
+        throw error{cs, "replay is not running"};
+    }
+    auto &rep = *ts.rep;
+    for (;;) {
+        if (rep.pos >= rep.size) {
+            throw error{cs, "replay diverged from the log"};
+        }
+        switch (rep.step(ret, false)) {
+            case REC_RESULT:
+                return;
+            case REC_ERROR:
+                throw error{cs, ret.get_string(cs)};
+            default:
+                break;
+        }
+    }
+}
+
+} /* namespace cubescript */
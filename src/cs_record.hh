@@ -0,0 +1,80 @@
+#ifndef LIBCUBESCRIPT_RECORD_HH
+#define LIBCUBESCRIPT_RECORD_HH
+
+#include <cubescript/cubescript.hh>
+
+#include <cstddef>
+#include <string_view>
+
+#include "cs_bcode.hh"
+#include "cs_thread.hh"
+
+namespace cubescript {
+
+struct command_impl;
+
+/* workload recording
+ *
+ * only what comes from the host is recorded: code it compiles, its calls
+ * into the language, values it writes and the results of its commands
+ * (the ones that are not a part of the library); everything the scripts
+ * do on their own is reproduced by running them again, with the commands
+ * of the host replaced by stubs which play back their recorded effects
+ *
+ * the log starts with a header like a bytecode image does, followed by
+ * events; each event is a tag byte followed by its data; strings are
+ * stored as a 32-bit length followed by the contents, values as a type
+ * byte followed by the contents
+ */
+enum {
+    REC_VAR = 1,    /* var declaration: name, type, flags, value */
+    REC_COMMAND,    /* command declaration: name, argument list */
+    REC_SET,        /* host assignment: name, value */
+    REC_CODE,       /* compiled code: id, source name, source text */
+    REC_IMAGE,      /* shared code: id, image */
+    REC_CALL,       /* code call: id, or zero if the code is not known */
+    REC_CALL_ALIAS, /* alias call: name, argument count, arguments */
+    REC_RESULT,     /* a host command returned: value */
+    REC_ERROR       /* a host command raised an error: message */
+};
+
+struct recorder;
+struct replayer;
+
+void record_start(thread_state &ts, std::string_view path);
+void record_stop(thread_state &ts);
+
+/* whether the running code is the host, rather than a script */
+inline bool record_host(thread_state const &ts) {
+    return ts.rec && (!ts.call_depth || ts.rec_host);
+}
+
+/* whether the host is calling into the language at the top level */
+inline bool record_entry(thread_state const &ts) {
+    return ts.rec && !ts.call_depth && !ts.rec_host;
+}
+
+void record_code(
+    thread_state &ts, bcode_ref const &code,
+    std::string_view src, std::string_view name
+);
+void record_call(thread_state &ts, bcode *code);
+void record_alias_call(
+    thread_state &ts, alias const &a, span_type<any_value> args
+);
+void record_set(thread_state &ts, ident const &id, any_value const &v);
+
+/* returns true if the command belongs to the host and is recorded */
+bool record_command_begin(thread_state &ts, command_impl const &cmd);
+void record_command_end(thread_state &ts, any_value const &ret);
+/* call from a catch block; records the error being handled */
+void record_command_error(thread_state &ts);
+
+/* play back a log in the given thread, return the number of calls */
+std::size_t replay_run(thread_state &ts, std::string_view path);
+/* the body of the stubs standing in for the commands of the host */
+void replay_command(state &cs, any_value &ret);
+
+} /* namespace cubescript */
+
+#endif
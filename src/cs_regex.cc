@@ -0,0 +1,795 @@
+#include <cubescript/cubescript.hh>
+
+#include <algorithm>
+#include <cstring>
+
+#include "cs_regex.hh"
+#include "cs_state.hh"
+#include "cs_strman.hh"
+#include "cs_thread.hh"
+#include "cs_error.hh"
+
+namespace cubescript {
+
+enum {
+    RX_CHAR = 0, RX_ANY, RX_CLASS, RX_BOL, RX_EOL, RX_WORDB, RX_NWORDB,
+    RX_SPLIT, RX_JMP, RX_SAVE, RX_MATCH
+};
+
+static constexpr std::uint32_t RX_NO_SLOT = ~std::uint32_t(0);
+
+/* limits keeping both the compiler and the program in check */
+static constexpr std::size_t RX_MAX_PROG = 1 << 16;
+static constexpr int RX_MAX_REPEAT = 1000;
+static constexpr std::uint32_t RX_MAX_HEIGHT = 512;
+/* every live thread carries the captures of all groups along */
+static constexpr std::uint32_t RX_MAX_GROUPS = 100;
+
+static bool rx_is_word(unsigned char c) {
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (
+        (c >= '0') && (c <= '9')
+    ) || (c == '_');
+}
+
+static bool rx_is_space(unsigned char c) {
+    switch (c) {
+        case ' ': case '\t': case '\n': case '\r': case '\f': case '\v':
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+static void rx_class_set(regex_class &cl, unsigned char c) {
+    cl.bits[c >> 5] |= (1u << (c & 31));
+}
+
+/* add one of the \d, \w, \s classes or their negations */
+static bool rx_class_builtin(regex_class &cl, char e) {
+    bool neg = false;
+    bool (*f)(unsigned char) = nullptr;
+    switch (e) {
+        case 'D': neg = true; [[fallthrough]];
+        case 'd':
+            f = [](unsigned char c) { return (c >= '0') && (c <= '9'); };
+            break;
+        case 'W': neg = true; [[fallthrough]];
+        case 'w':
+            f = rx_is_word;
+            break;
+        case 'S': neg = true; [[fallthrough]];
+        case 's':
+            f = rx_is_space;
+            break;
+        default:
+            return false;
+    }
+    for (unsigned int c = 0; c < 256; ++c) {
+        if (f(static_cast<unsigned char>(c)) != neg) {
+            rx_class_set(cl, static_cast<unsigned char>(c));
+        }
+    }
+    return true;
+}
+
+static int rx_hex(char c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* syntax tree */
+
+enum {
+    RXN_CHAR = 0, RXN_ANY, RXN_CLASS, RXN_BOL, RXN_EOL, RXN_WORDB,
+    RXN_NWORDB, RXN_EMPTY, RXN_CAT, RXN_ALT, RXN_GROUP, RXN_REPEAT
+};
+
+static constexpr std::uint32_t RXN_NONE = ~std::uint32_t(0);
+
+struct regex_node {
+    int type;
+    std::uint32_t val = 0;
+    /* children are linked through their siblings */
+    std::uint32_t child = RXN_NONE;
+    std::uint32_t next = RXN_NONE;
+    /* the longest path to a leaf, as generation recurses that deep */
+    std::uint32_t height = 1;
+    int min = 0, max = 0;
+    bool greedy = true;
+};
+
+struct regex_parser {
+    regex_parser(internal_state *is, regex &r, std::string_view p):
+        istate{is}, re{r}, nodes{is}, pat{p}
+    {}
+
+    internal_state *istate;
+    regex &re;
+    valbuf<regex_node> nodes;
+    std::string_view pat;
+    std::size_t pos = 0;
+    std::size_t depth = 0;
+    std::uint32_t ngroups = 1;
+    char const *err = nullptr;
+
+    bool eof() const {
+        return pos >= pat.size();
+    }
+
+    char peek() const {
+        return eof() ? '\0' : pat[pos];
+    }
+
+    std::uint32_t node(int type, std::uint32_t val = 0) {
+        auto &n = nodes.emplace_back();
+        n.type = type;
+        n.val = val;
+        return std::uint32_t(nodes.size() - 1);
+    }
+
+    void add_child(std::uint32_t par, std::uint32_t &last, std::uint32_t ch) {
+        if (err) {
+            return;
+        }
+        if (last == RXN_NONE) {
+            nodes[par].child = ch;
+        } else {
+            nodes[last].next = ch;
+        }
+        last = ch;
+        auto h = nodes[ch].height + 1;
+        if (h > RX_MAX_HEIGHT) {
+            fail("pattern nested too deeply");
+        } else if (h > nodes[par].height) {
+            nodes[par].height = h;
+        }
+    }
+
+    bool fail(char const *msg) {
+        if (!err) {
+            err = msg;
+        }
+        return false;
+    }
+
+    std::uint32_t parse_alt() {
+        /* every level adds to the height, so this is bounded too */
+        if (++depth > RX_MAX_HEIGHT) {
+            fail("pattern nested too deeply");
+            return RXN_NONE;
+        }
+        auto first = parse_cat();
+        if (err || (peek() != '|')) {
+            --depth;
+            return first;
+        }
+        auto alt = node(RXN_ALT);
+        auto last = RXN_NONE;
+        add_child(alt, last, first);
+        while (!err && (peek() == '|')) {
+            ++pos;
+            add_child(alt, last, parse_cat());
+        }
+        --depth;
+        return alt;
+    }
+
+    std::uint32_t parse_cat() {
+        auto cat = node(RXN_CAT);
+        auto last = RXN_NONE;
+        std::size_t n = 0;
+        while (!err && !eof() && (peek() != '|') && (peek() != ')')) {
+            add_child(cat, last, parse_repeat());
+            ++n;
+        }
+        if (!n) {
+            nodes[cat].type = RXN_EMPTY;
+        } else if (n == 1) {
+            return nodes[cat].child;
+        }
+        return cat;
+    }
+
+    bool parse_count(int &v) {
+        if ((peek() < '0') || (peek() > '9')) {
+            return false;
+        }
+        v = 0;
+        while ((peek() >= '0') && (peek() <= '9')) {
+            v = v * 10 + (pat[pos++] - '0');
+            if (v > RX_MAX_REPEAT) {
+                return fail("repetition count too large");
+            }
+        }
+        return true;
+    }
+
+    std::uint32_t parse_repeat() {
+        auto atom = parse_atom();
+        while (!err && !eof()) {
+            int min, max;
+            switch (peek()) {
+                case '*': min = 0; max = -1; ++pos; break;
+                case '+': min = 1; max = -1; ++pos; break;
+                case '?': min = 0; max = 1; ++pos; break;
+                case '{':
+                    ++pos;
+                    if (!parse_count(min)) {
+                        fail("invalid repetition");
+                        return atom;
+                    }
+                    max = min;
+                    if (peek() == ',') {
+                        ++pos;
+                        max = -1;
+                        if ((peek() != '}') && !parse_count(max)) {
+                            fail("invalid repetition");
+                            return atom;
+                        }
+                    }
+                    if (peek() != '}') {
+                        fail("invalid repetition");
+                        return atom;
+                    }
+                    ++pos;
+                    if ((max >= 0) && (max < min)) {
+                        fail("invalid repetition range");
+                        return atom;
+                    }
+                    break;
+                default:
+                    return atom;
+            }
+            auto rep = node(RXN_REPEAT);
+            auto last = RXN_NONE;
+            add_child(rep, last, atom);
+            nodes[rep].min = min;
+            nodes[rep].max = max;
+            if (peek() == '?') {
+                ++pos;
+                nodes[rep].greedy = false;
+            }
+            atom = rep;
+        }
+        return atom;
+    }
+
+    std::uint32_t parse_atom() {
+        char c = pat[pos++];
+        switch (c) {
+            case '(': {
+                std::uint32_t grp = 0;
+                if ((peek() == '?') && ((pos + 1) < pat.size()) && (
+                    pat[pos + 1] == ':'
+                )) {
+                    pos += 2;
+                } else if (ngroups > RX_MAX_GROUPS) {
+                    fail("too many groups");
+                    return node(RXN_EMPTY);
+                } else {
+                    grp = ngroups++;
+                }
+                auto sub = parse_alt();
+                if (err) {
+                    return sub;
+                }
+                if (peek() != ')') {
+                    fail("missing )");
+                    return sub;
+                }
+                ++pos;
+                if (!grp) {
+                    return sub;
+                }
+                auto n = node(RXN_GROUP, grp);
+                auto last = RXN_NONE;
+                add_child(n, last, sub);
+                return n;
+            }
+            case '[':
+                return parse_class();
+            case '.':
+                return node(RXN_ANY);
+            case '^':
+                return node(RXN_BOL);
+            case '$':
+                return node(RXN_EOL);
+            case '*':
+            case '+':
+            case '?':
+            case '{':
+                fail("nothing to repeat");
+                return RXN_NONE;
+            case '\\':
+                return parse_escape();
+            default:
+                break;
+        }
+        return node(RXN_CHAR, static_cast<unsigned char>(c));
+    }
+
+    /* a single character escape, shared with classes */
+    bool escape_char(char e, unsigned char &ret) {
+        switch (e) {
+            case 'n': ret = '\n'; return true;
+            case 't': ret = '\t'; return true;
+            case 'r': ret = '\r'; return true;
+            case 'f': ret = '\f'; return true;
+            case 'v': ret = '\v'; return true;
+            case '0': ret = '\0'; return true;
+            case 'x': {
+                int hi = ((pos + 1) < pat.size()) ? rx_hex(pat[pos]) : -1;
+                int lo = (hi >= 0) ? rx_hex(pat[pos + 1]) : -1;
+                if (lo < 0) {
+                    return fail("invalid hex escape");
+                }
+                pos += 2;
+                ret = static_cast<unsigned char>((hi << 4) | lo);
+                return true;
+            }
+            default:
+                break;
+        }
+        if (
+            ((e >= 'a') && (e <= 'z')) || ((e >= 'A') && (e <= 'Z')) ||
+            ((e >= '0') && (e <= '9'))
+        ) {
+            /* reserved for future use */
+            return fail("unknown escape");
+        }
+        ret = static_cast<unsigned char>(e);
+        return true;
+    }
+
+    std::uint32_t parse_escape() {
+        if (eof()) {
+            fail("trailing backslash");
+            return RXN_NONE;
+        }
+        char e = pat[pos++];
+        switch (e) {
+            case 'b':
+                return node(RXN_WORDB);
+            case 'B':
+                return node(RXN_NWORDB);
+            default:
+                break;
+        }
+        regex_class cl{};
+        if (rx_class_builtin(cl, e)) {
+            re.p_classes.push_back(cl);
+            return node(RXN_CLASS, std::uint32_t(re.p_classes.size() - 1));
+        }
+        unsigned char c;
+        if (!escape_char(e, c)) {
+            return RXN_NONE;
+        }
+        return node(RXN_CHAR, c);
+    }
+
+    std::uint32_t parse_class() {
+        regex_class cl{};
+        bool neg = false;
+        if (peek() == '^') {
+            neg = true;
+            ++pos;
+        }
+        bool first = true;
+        for (;;) {
+            if (eof()) {
+                fail("missing ]");
+                return RXN_NONE;
+            }
+            char c = pat[pos++];
+            if ((c == ']') && !first) {
+                break;
+            }
+            first = false;
+            unsigned char lo = static_cast<unsigned char>(c);
+            if (c == '\\') {
+                if (eof()) {
+                    fail("missing ]");
+                    return RXN_NONE;
+                }
+                char e = pat[pos++];
+                if (rx_class_builtin(cl, e)) {
+                    continue;
+                }
+                if ((e == 'b') || (e == 'B')) {
+                    fail("unknown escape");
+                    return RXN_NONE;
+                }
+                if (!escape_char(e, lo)) {
+                    return RXN_NONE;
+                }
+            }
+            unsigned char hi = lo;
+            if (
+                (peek() == '-') && ((pos + 1) < pat.size()) &&
+                (pat[pos + 1] != ']')
+            ) {
+                ++pos;
+                char h = pat[pos++];
+                hi = static_cast<unsigned char>(h);
+                if ((h == '\\') && (eof() || !escape_char(pat[pos++], hi))) {
+                    fail("invalid class range");
+                    return RXN_NONE;
+                }
+                if (hi < lo) {
+                    fail("invalid class range");
+                    return RXN_NONE;
+                }
+            }
+            for (unsigned int i = lo; i <= hi; ++i) {
+                rx_class_set(cl, static_cast<unsigned char>(i));
+            }
+        }
+        if (neg) {
+            for (auto &b: cl.bits) {
+                b = ~b;
+            }
+        }
+        re.p_classes.push_back(cl);
+        return node(RXN_CLASS, std::uint32_t(re.p_classes.size() - 1));
+    }
+
+    /* code generation */
+
+    std::uint32_t emit(
+        std::uint32_t op, std::uint32_t x = 0, std::uint32_t y = 0
+    ) {
+        if (re.p_prog.size() >= RX_MAX_PROG) {
+            fail("pattern too large");
+        }
+        re.p_prog.push_back(regex_insn{op, x, y});
+        return std::uint32_t(re.p_prog.size() - 1);
+    }
+
+    std::uint32_t here() const {
+        return std::uint32_t(re.p_prog.size());
+    }
+
+    /* a split preferring the next instruction when greedy */
+    void patch_split(std::uint32_t at, std::uint32_t out, bool greedy) {
+        auto &in = re.p_prog[at];
+        if (greedy) {
+            in.x = at + 1;
+            in.y = out;
+        } else {
+            in.x = out;
+            in.y = at + 1;
+        }
+    }
+
+    void gen(std::uint32_t ni) {
+        if (err) {
+            return;
+        }
+        auto &n = nodes[ni];
+        switch (n.type) {
+            case RXN_CHAR: emit(RX_CHAR, n.val); break;
+            case RXN_ANY: emit(RX_ANY); break;
+            case RXN_CLASS: emit(RX_CLASS, n.val); break;
+            case RXN_BOL: emit(RX_BOL); break;
+            case RXN_EOL: emit(RX_EOL); break;
+            case RXN_WORDB: emit(RX_WORDB); break;
+            case RXN_NWORDB: emit(RX_NWORDB); break;
+            case RXN_EMPTY: break;
+            case RXN_CAT:
+                for (auto c = n.child; c != RXN_NONE; c = nodes[c].next) {
+                    gen(c);
+                }
+                break;
+            case RXN_ALT: {
+                /* every alternative but the last jumps past the rest */
+                valbuf<std::uint32_t> jumps{istate};
+                for (auto c = n.child; c != RXN_NONE; c = nodes[c].next) {
+                    if (nodes[c].next == RXN_NONE) {
+                        gen(c);
+                        break;
+                    }
+                    auto split = emit(RX_SPLIT);
+                    gen(c);
+                    jumps.push_back(emit(RX_JMP));
+                    if (err) {
+                        return;
+                    }
+                    patch_split(split, here(), true);
+                }
+                for (std::size_t i = 0; i < jumps.size(); ++i) {
+                    re.p_prog[jumps[i]].x = here();
+                }
+                break;
+            }
+            case RXN_GROUP:
+                emit(RX_SAVE, n.val * 2);
+                gen(n.child);
+                emit(RX_SAVE, n.val * 2 + 1);
+                break;
+            case RXN_REPEAT:
+                gen_repeat(n);
+                break;
+        }
+    }
+
+    void gen_repeat(regex_node const &n) {
+        for (int i = 0; i < n.min; ++i) {
+            gen(n.child);
+        }
+        if (n.max < 0) {
+            auto split = emit(RX_SPLIT);
+            gen(n.child);
+            emit(RX_JMP, split);
+            if (!err) {
+                patch_split(split, here(), n.greedy);
+            }
+            return;
+        }
+        /* the optional ones nest, so each one skips all that follow */
+        valbuf<std::uint32_t> splits{istate};
+        for (int i = n.min; i < n.max; ++i) {
+            splits.push_back(emit(RX_SPLIT));
+            gen(n.child);
+            if (err) {
+                return;
+            }
+        }
+        for (std::size_t i = 0; i < splits.size(); ++i) {
+            patch_split(splits[i], here(), n.greedy);
+        }
+    }
+};
+
+regex::regex(internal_state *is):
+    p_istate{is}, p_prog{is}, p_classes{is}, p_lists{tlist{is}, tlist{is}},
+    p_stack{is}, p_work{is}
+{}
+
+std::string_view regex::compile(std::string_view pat) {
+    regex_parser ps{p_istate, *this, pat};
+    auto root = ps.parse_alt();
+    if (!ps.err && !ps.eof()) {
+        /* parse_cat only stops early at an unmatched paren */
+        ps.fail("unmatched )");
+    }
+    if (!ps.err) {
+        ps.emit(RX_SAVE, 0);
+        ps.gen(root);
+        ps.emit(RX_SAVE, 1);
+        ps.emit(RX_MATCH);
+    }
+    if (ps.err) {
+        return ps.err;
+    }
+    p_nslots = std::size_t(ps.ngroups) * 2;
+    auto nprog = p_prog.size();
+    for (auto &l: p_lists) {
+        l.dense.resize(nprog);
+        l.sparse.resize(nprog);
+        l.rows.resize(nprog);
+    }
+    p_stack.reserve(nprog * 2);
+    p_work.resize(p_nslots);
+    return std::string_view{};
+}
+
+void regex::add_thread(
+    tlist &l, std::uint32_t pc0, std::string_view str, std::size_t pos
+) {
+    auto *wcaps = p_work.data();
+    p_stack.clear();
+    p_stack.push_back(tentry{pc0, RX_NO_SLOT, 0});
+    while (!p_stack.empty()) {
+        auto e = p_stack.back();
+        p_stack.pop_back();
+        if (e.slot != RX_NO_SLOT) {
+            wcaps[e.slot] = e.val;
+            continue;
+        }
+        for (auto pc = e.pc;;) {
+            auto idx = l.sparse[pc];
+            if ((idx < l.n) && (l.dense[idx] == pc)) {
+                break;
+            }
+            idx = std::uint32_t(l.n++);
+            l.sparse[pc] = idx;
+            l.dense[idx] = pc;
+            auto &in = p_prog[pc];
+            bool next = true;
+            switch (in.op) {
+                case RX_JMP:
+                    pc = in.x;
+                    continue;
+                case RX_SPLIT:
+                    p_stack.push_back(tentry{in.y, RX_NO_SLOT, 0});
+                    pc = in.x;
+                    continue;
+                case RX_SAVE:
+                    p_stack.push_back(tentry{0, in.x, wcaps[in.x]});
+                    wcaps[in.x] = std::ptrdiff_t(pos);
+                    ++pc;
+                    continue;
+                case RX_BOL:
+                    next = (pos == 0);
+                    break;
+                case RX_EOL:
+                    next = (pos == str.size());
+                    break;
+                case RX_WORDB:
+                case RX_NWORDB: {
+                    bool a = (pos > 0) && rx_is_word(
+                        static_cast<unsigned char>(str[pos - 1])
+                    );
+                    bool b = (pos < str.size()) && rx_is_word(
+                        static_cast<unsigned char>(str[pos])
+                    );
+                    next = ((a != b) == (in.op == RX_WORDB));
+                    break;
+                }
+                default: {
+                    /* consumes input or matches, so it waits for a step */
+                    auto row = l.nrows++;
+                    if (l.caps.size() < (l.nrows * p_nslots)) {
+                        l.caps.resize(l.nrows * p_nslots);
+                    }
+                    l.rows[idx] = std::uint32_t(row);
+                    std::memcpy(
+                        &l.caps[row * p_nslots], wcaps,
+                        p_nslots * sizeof(std::ptrdiff_t)
+                    );
+                    next = false;
+                    break;
+                }
+            }
+            if (!next) {
+                break;
+            }
+            ++pc;
+        }
+    }
+}
+
+bool regex::match(
+    std::string_view str, std::size_t start, bool full, std::ptrdiff_t *caps
+) {
+    auto *cl = &p_lists[0], *nl = &p_lists[1];
+    cl->clear();
+    nl->clear();
+    bool matched = false;
+    for (std::size_t pos = start;; ++pos) {
+        if (!matched && (!full || (pos == start))) {
+            /* a new attempt starting here, after all the earlier ones */
+            std::fill(p_work.buf.begin(), p_work.buf.end(), -1);
+            add_thread(*cl, 0, str, pos);
+        }
+        if (!cl->n) {
+            break;
+        }
+        int c = (pos < str.size()) ? static_cast<unsigned char>(str[pos]) : -1;
+        for (std::size_t i = 0; i < cl->n; ++i) {
+            auto pc = cl->dense[i];
+            auto &in = p_prog[pc];
+            bool step;
+            switch (in.op) {
+                case RX_MATCH:
+                    if (full && (pos != str.size())) {
+                        continue;
+                    }
+                    std::memcpy(
+                        caps, &cl->caps[cl->rows[i] * p_nslots],
+                        p_nslots * sizeof(std::ptrdiff_t)
+                    );
+                    matched = true;
+                    /* the threads after this one are of lower priority */
+                    goto next_pos;
+                case RX_CHAR:
+                    step = (c == int(in.x));
+                    break;
+                case RX_ANY:
+                    step = (c >= 0) && (c != '\n');
+                    break;
+                case RX_CLASS:
+                    step = (c >= 0) && p_classes[in.x].has(
+                        static_cast<unsigned char>(c)
+                    );
+                    break;
+                default:
+                    step = false;
+                    break;
+            }
+            if (step) {
+                std::memcpy(
+                    p_work.data(), &cl->caps[cl->rows[i] * p_nslots],
+                    p_nslots * sizeof(std::ptrdiff_t)
+                );
+                add_thread(*nl, pc + 1, str, pos + 1);
+            }
+        }
+next_pos:
+        std::swap(cl, nl);
+        nl->clear();
+        if (pos >= str.size()) {
+            break;
+        }
+    }
+    return matched;
+}
+
+/* the cache of compiled patterns */
+
+static constexpr std::size_t RX_CACHE_SIZE = 16;
+
+struct regex_cache {
+    struct entry {
+        any_value pat{};
+        char const *key = nullptr;
+        regex *re = nullptr;
+        std::size_t used = 0;
+    };
+
+    entry ents[RX_CACHE_SIZE];
+    std::size_t clock = 0;
+};
+
+regex &regex_get(state &cs, any_value &pat) {
+    str_intern(cs, pat);
+    auto key = pat.force_string(cs).data();
+    auto *is = state_p{cs}.ts().istate;
+    if (!is->recache) {
+        is->recache = is->create<regex_cache>();
+    }
+    auto &rc = *is->recache;
+    ++rc.clock;
+    auto *victim = &rc.ents[0];
+    for (auto &e: rc.ents) {
+        if (e.re && (e.key == key)) {
+            e.used = rc.clock;
+            ++is->stats.regex_hits;
+            return *e.re;
+        }
+        if (e.used < victim->used) {
+            victim = &e;
+        }
+    }
+    ++is->stats.regex_misses;
+    auto *re = is->create<regex>(is);
+    auto err = re->compile(pat.get_string(cs));
+    if (!err.empty()) {
+        is->destroy(re);
+        throw error_p::make(
+            cs, "invalid regular expression: %s", err.data()
+        );
+    }
+    if (victim->re) {
+        is->destroy(victim->re);
+    }
+    victim->pat = pat;
+    victim->key = key;
+    victim->re = re;
+    victim->used = rc.clock;
+    return *re;
+}
+
+void regex_cache_free(internal_state *is) {
+    if (!is->recache) {
+        return;
+    }
+    for (auto &e: is->recache->ents) {
+        if (e.re) {
+            is->destroy(e.re);
+        }
+    }
+    is->destroy(is->recache);
+    is->recache = nullptr;
+}
+
+} /* namespace cubescript */
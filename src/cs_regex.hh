@@ -0,0 +1,105 @@
+#ifndef LIBCUBESCRIPT_REGEX_HH
+#define LIBCUBESCRIPT_REGEX_HH
+
+#include <cubescript/cubescript.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "cs_std.hh"
+
+namespace cubescript {
+
+struct regex_insn {
+    std::uint32_t op;
+    std::uint32_t x, y;
+};
+
+struct regex_class {
+    std::uint32_t bits[8];
+
+    bool has(unsigned char c) const {
+        return bits[c >> 5] & (1u << (c & 31));
+    }
+};
+
+/* a compiled regular expression; all threads of its program advance over
+ * the input in lockstep, so matching takes time linear in the input for
+ * any pattern, and the leftmost match is found with the captures a
+ * backtracking engine would give
+ */
+struct regex {
+    regex(internal_state *is);
+
+    /* an error message on failure, empty on success */
+    std::string_view compile(std::string_view pat);
+
+    /* capture slots, the start and end of every group and the whole match */
+    std::size_t slots() const {
+        return p_nslots;
+    }
+
+    /* find the first match at or after start, or only one spanning the
+     * entire input if full is set; unset captures are -1
+     */
+    bool match(
+        std::string_view str, std::size_t start, bool full,
+        std::ptrdiff_t *caps
+    );
+
+private:
+    /* the threads at each instruction; only those waiting for the next
+     * character or a match get a row of captures, so the captures take
+     * memory for the live threads rather than the whole program
+     */
+    struct tlist {
+        tlist(internal_state *is):
+            dense{is}, sparse{is}, rows{is}, caps{is}
+        {}
+
+        void clear() {
+            n = nrows = 0;
+        }
+
+        valbuf<std::uint32_t> dense;
+        valbuf<std::uint32_t> sparse;
+        valbuf<std::uint32_t> rows;
+        valbuf<std::ptrdiff_t> caps;
+        std::size_t n = 0;
+        std::size_t nrows = 0;
+    };
+
+    struct tentry {
+        std::uint32_t pc;
+        std::uint32_t slot;
+        std::ptrdiff_t val;
+    };
+
+    friend struct regex_parser;
+
+    void add_thread(
+        tlist &l, std::uint32_t pc, std::string_view str, std::size_t pos
+    );
+
+    internal_state *p_istate;
+    valbuf<regex_insn> p_prog;
+    valbuf<regex_class> p_classes;
+    std::size_t p_nslots = 2;
+    /* matching scratch */
+    tlist p_lists[2];
+    valbuf<tentry> p_stack;
+    valbuf<std::ptrdiff_t> p_work;
+};
+
+/* get the compiled form of a pattern from the cache of the state, compiling
+ * it on a miss; the pattern is interned, so the cache can be keyed by the
+ * string pointer
+ */
+regex &regex_get(state &cs, any_value &pat);
+
+void regex_cache_free(internal_state *is);
+
+} /* namespace cubescript */
+
+#endif
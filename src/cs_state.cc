@@ -1,6 +1,10 @@
 #include <memory>
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cmath>
+#include <cstring>
+#include <new>
 
 #include "cs_bcode.hh"
 #include "cs_state.hh"
@@ -8,6 +12,9 @@
 #include "cs_strman.hh"
 #include "cs_vm.hh"
 #include "cs_parser.hh"
+#include "cs_record.hh"
+#include "cs_image.hh"
+#include "cs_regex.hh"
 #include "cs_error.hh"
 
 namespace cubescript {
@@ -17,13 +24,23 @@ internal_state::internal_state(alloc_func af, void *data):
     idents{allocator_type{this}},
     identmap{allocator_type{this}},
     strman{create<string_pool>(this)},
-    empty{bcode_init_empty(this)}
+    empty{bcode_init_empty(this)},
+    shared_code{shared_allocator{this}},
+    code_pool{pool_allocator{this}},
+    maps{std_allocator<file_map>{this}},
+    usage{std_allocator<ident_usage>{this}}
 {}
 
 internal_state::~internal_state() {
+    regex_cache_free(this);
+    shared_code.clear();
     for (auto &p: idents) {
         destroy(&ident_p{*p.second}.impl());
     }
+    /* after the idents, as their values may hold code used in place */
+    for (auto &m: maps) {
+        file_map_close(this, m);
+    }
     bcode_free_empty(this, empty);
     destroy(strman);
 }
@@ -52,6 +69,15 @@ ident *internal_state::add_ident(ident *id, ident_impl *impl) {
     idents[id->name()] = id;
     impl->p_index = int(identmap.size());
     identmap.push_back(id);
+    switch (id->type()) {
+        case ident_type::VAR: ++stats.vars; break;
+        case ident_type::COMMAND: ++stats.commands; break;
+        case ident_type::ALIAS: ++stats.aliases; break;
+        default: ++stats.specials; break;
+    }
+    if (track_usage) {
+        usage.emplace_back();
+    }
     return identmap.back();
 }
 
@@ -256,9 +282,19 @@ state::state(alloc_func func, void *data) {
         }
     });
     static_cast<command_impl *>(p)->p_type = ID_CONTINUE;
+
+    /* everything so far is builtin */
+    for (auto *id: statep->identmap) {
+        if (id->type() != ident_type::ALIAS) {
+            ident_p{*id}.impl().p_flags |= IDENT_FLAG_STD;
+        }
+    }
 }
 
 LIBCUBESCRIPT_EXPORT state::~state() {
+    if (p_tstate) {
+        record_stop(*p_tstate);
+    }
     if (!p_tstate || !p_tstate->owner) {
         return;
     }
@@ -310,6 +346,32 @@ LIBCUBESCRIPT_EXPORT hook_func &state::call_hook() {
     return p_tstate->get_hook();
 }
 
+LIBCUBESCRIPT_EXPORT debug_hook_func state::debug_hook(
+    hook_event ev, debug_hook_func func
+) {
+    return p_tstate->set_debug_hook(ev, std::move(func));
+}
+
+LIBCUBESCRIPT_EXPORT debug_hook_func const &state::debug_hook(
+    hook_event ev
+) const {
+    return p_tstate->debug_hooks[std::size_t(ev)];
+}
+
+LIBCUBESCRIPT_EXPORT unsigned int state::hook_mask() const {
+    return p_tstate->hook_mask;
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::hook_count() const {
+    return p_tstate->hook_count;
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::hook_count(std::size_t n) {
+    auto old = p_tstate->hook_count;
+    p_tstate->hook_count = p_tstate->hook_left = std::max(n, std::size_t(1));
+    return old;
+}
+
 LIBCUBESCRIPT_EXPORT void *state::alloc(void *ptr, size_t os, size_t ns) {
     return p_tstate->istate->alloc(ptr, os, ns);
 }
@@ -510,6 +572,9 @@ LIBCUBESCRIPT_EXPORT void state::assign_value(
             p_tstate->ident_flags
         );
         p_tstate->istate->add_ident(a, a);
+        if (record_host(*p_tstate)) {
+            record_set(*p_tstate, *a, a->p_initial.val_s);
+        }
     }
 }
 
@@ -533,9 +598,11 @@ LIBCUBESCRIPT_EXPORT any_value state::lookup_value(std::string_view name) {
                 if (a->is_arg() && !ident_is_used_arg(id, *p_tstate)) {
                     return any_value{};
                 }
+                note_usage(p_tstate->istate, id, &ident_usage::lookups);
                 return ast->node->val_s.get_plain();
             }
             case ident_type::VAR:
+                note_usage(p_tstate->istate, id, &ident_usage::lookups);
                 return static_cast<builtin_var *>(id)->value(*this);
             case ident_type::COMMAND: {
                 any_value val{};
@@ -593,6 +660,26 @@ LIBCUBESCRIPT_EXPORT void state::touch_value(std::string_view name) {
     var_changed(*this, *p_tstate, v, vv);
 }
 
+LIBCUBESCRIPT_EXPORT void state::record(std::string_view path) {
+    record_start(*p_tstate, path);
+}
+
+LIBCUBESCRIPT_EXPORT void state::stop_recording() {
+    record_stop(*p_tstate);
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::replay(std::string_view path) {
+    return replay_run(*p_tstate, path);
+}
+
+LIBCUBESCRIPT_EXPORT void state::save_image(std::string_view path) {
+    image_save(*p_tstate, path);
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::load_image(std::string_view path) {
+    return image_load(*p_tstate, path);
+}
+
 static char const *allowed_builtins[] = {
     "//ivar", "//fvar", "//svar", "//var_changed",
     "//ivar_builtin", "//fvar_builtin", "//svar_builtin",
@@ -703,12 +790,115 @@ do_add:
     return *cmd;
 }
 
+/* only compiles requested by the host are timed, so that the clock is not
+ * read for every alias body or block compiled while running
+ */
+static void gen_main_timed(
+    gen_state &gs, std::string_view v, std::string_view source
+) {
+    auto start = std::chrono::steady_clock::now();
+    gs.gen_main(v, source);
+    gs.ts.istate->stats.compile_ns += std::uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count()
+    );
+}
+
 LIBCUBESCRIPT_EXPORT bcode_ref state::compile(
     std::string_view v, std::string_view source
 ) {
     gen_state gs{*p_tstate};
-    gs.gen_main(v, source);
-    return gs.steal_ref();
+    gen_main_timed(gs, v, source);
+    auto ret = gs.steal_ref();
+    if (record_host(*p_tstate)) {
+        record_code(*p_tstate, ret, v, source);
+    }
+    return ret;
+}
+
+LIBCUBESCRIPT_EXPORT bcode_ref state::compile_shared(
+    std::string_view v, std::string_view source
+) {
+    gen_state gs{*p_tstate};
+    gen_main_timed(gs, v, source);
+    return gs.steal_shared_ref();
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::code_image(
+    bcode_ref const &code, void *buf, std::size_t bufsize
+) {
+    if (!code) {
+        throw error{*this, "bytecode is not shared"};
+    }
+    auto *start = bcode_start(bcode_p{code}.get()->raw());
+    return bcode_image(*p_tstate, start, buf, bufsize);
+}
+
+LIBCUBESCRIPT_EXPORT bcode_ref state::load_code_image(
+    void const *data, std::size_t size
+) {
+    return bcode_load_image(*p_tstate, data, size);
+}
+
+LIBCUBESCRIPT_EXPORT bcode_ref state::map_code_image(std::string_view path) {
+    auto &maps = p_tstate->istate->maps;
+    file_map m;
+    if (!file_map_open(p_tstate->istate, path, m)) {
+        throw error_p::make(
+            *this, "could not read file \"%.*s\"",
+            int(path.size()), path.data()
+        );
+    }
+    try {
+        auto ret = bcode_load_image(*p_tstate, m.data, m.size);
+        maps.push_back(m);
+        return ret;
+    } catch (...) {
+        file_map_close(p_tstate->istate, m);
+        throw;
+    }
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::precompile_aliases(std::size_t max) {
+    auto &ts = *p_tstate;
+    auto &idents = ts.istate->identmap;
+    std::size_t ncomp = 0;
+    /* arguments are never worth it, skip them right away */
+    std::size_t i = std::max(ts.precompile_pos, MAX_ARGUMENTS);
+    for (; i < idents.size(); ++i) {
+        if (max && (ncomp >= max)) {
+            ts.precompile_pos = i;
+            return ncomp;
+        }
+        if (idents[i]->type() != ident_type::ALIAS) {
+            continue;
+        }
+        auto *a = static_cast<alias_impl *>(idents[i]);
+        /* do not create alias stacks for aliases this thread never used */
+        auto it = ts.astacks.find(a->index());
+        ident_stack *node = &a->p_initial;
+        int flags = a->p_flags;
+        if (it != ts.astacks.end()) {
+            node = it->second.node;
+            flags = it->second.flags;
+        }
+        if (
+            (flags & IDENT_FLAG_UNKNOWN) || node->code ||
+            (node->val_s.type() == value_type::NONE)
+        ) {
+            continue;
+        }
+        alias_stack ast{node, flags};
+        try {
+            ast.compile(ts);
+        } catch (error const &) {
+            continue;
+        }
+        ++ncomp;
+    }
+    ts.precompile_pos = 0;
+    return ncomp;
 }
 
 LIBCUBESCRIPT_EXPORT bool state::override_mode() const {
@@ -739,6 +929,172 @@ LIBCUBESCRIPT_EXPORT bool state::persist_mode(bool v) {
     return was;
 }
 
+LIBCUBESCRIPT_EXPORT bool state::track_usage() const {
+    return p_tstate->istate->track_usage;
+}
+
+LIBCUBESCRIPT_EXPORT bool state::track_usage(bool v) {
+    auto *is = p_tstate->istate;
+    bool was = is->track_usage;
+    if (v) {
+        /* the counters always cover every ident while tracking */
+        is->usage.resize(is->identmap.size());
+    }
+    is->track_usage = v;
+    return was;
+}
+
+/* called from other OS threads, so only the allocator and the atomics of
+ * the thread state may be used
+ */
+static void post_item_new(
+    thread_state &ts, bcode_ref const *code, std::string_view src,
+    span_type<std::string_view const> args
+) {
+    auto size = sizeof(post_item);
+    if (!code) {
+        size += sizeof(std::size_t) + src.size();
+    }
+    for (auto &arg: args) {
+        size += sizeof(std::size_t) + arg.size();
+    }
+    auto *item = new (ts.istate->alloc(nullptr, 0, size)) post_item{};
+    if (code) {
+        item->code = *code;
+    }
+    item->size = size;
+    item->nargs = args.size();
+    auto *p = reinterpret_cast<char *>(item + 1);
+    auto put = [&p](std::string_view str) {
+        auto len = str.size();
+        std::memcpy(p, &len, sizeof(len));
+        std::memcpy(p + sizeof(len), str.data(), len);
+        p += sizeof(len) + len;
+    };
+    if (!code) {
+        put(src);
+    }
+    for (auto &arg: args) {
+        put(arg);
+    }
+    ts.post(item);
+}
+
+LIBCUBESCRIPT_EXPORT void state::post(
+    std::string_view code, span_type<std::string_view const> args
+) {
+    post_item_new(*p_tstate, nullptr, code, args);
+}
+
+LIBCUBESCRIPT_EXPORT bool state::post(
+    bcode_ref const &code, span_type<std::string_view const> args
+) {
+    auto *bc = bcode_p{code}.get();
+    if (!bc || !(bcode_flags(bcode_start(bc->raw())) & BC_START_SHARED)) {
+        return false;
+    }
+    post_item_new(*p_tstate, &code, std::string_view{}, args);
+    return true;
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::run_posted() {
+    auto &ts = *p_tstate;
+    /* what was posted so far goes after what was left over, oldest first */
+    auto *items = ts.posted.exchange(nullptr, std::memory_order_acquire);
+    post_item *batch = nullptr;
+    while (items) {
+        auto *next = items->next;
+        items->next = batch;
+        batch = items;
+        items = next;
+    }
+    auto **tail = &ts.post_queue;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = batch;
+    std::size_t nrun = 0;
+    valbuf<any_value> args{ts.istate};
+    while (ts.post_queue) {
+        auto *item = ts.post_queue;
+        ts.post_queue = item->next;
+        auto *p = reinterpret_cast<char const *>(item + 1);
+        auto get = [&p]() {
+            std::size_t len;
+            std::memcpy(&len, p, sizeof(len));
+            p += sizeof(len) + len;
+            return std::string_view{p - len, len};
+        };
+        try {
+            auto code = item->code;
+            if (!code) {
+                code = compile(get());
+            }
+            args.clear();
+            for (std::size_t i = 0; i < item->nargs; ++i) {
+                args.emplace_back().set_string(get(), *this);
+            }
+            exec_code_args(ts, code, args.data(), args.size());
+        } catch (...) {
+            ts.free_post(item);
+            throw;
+        }
+        ts.free_post(item);
+        ++nrun;
+    }
+    return nrun;
+}
+
+LIBCUBESCRIPT_EXPORT bool state::dedup_code() const {
+    return p_tstate->istate->dedup_code;
+}
+
+LIBCUBESCRIPT_EXPORT bool state::dedup_code(bool v) {
+    auto *is = p_tstate->istate;
+    bool was = is->dedup_code;
+    if (!v) {
+        is->code_pool.clear();
+    }
+    is->dedup_code = v;
+    return was;
+}
+
+LIBCUBESCRIPT_EXPORT span_type<ident_usage const> state::usage() const {
+    auto &usage = p_tstate->istate->usage;
+    return span_type<ident_usage const>{usage.data(), usage.size()};
+}
+
+LIBCUBESCRIPT_EXPORT void state::reset_usage() {
+    auto &usage = p_tstate->istate->usage;
+    std::fill(usage.begin(), usage.end(), ident_usage{});
+}
+
+LIBCUBESCRIPT_EXPORT state_stats state::stats() const {
+    auto *is = p_tstate->istate;
+    auto ret = is->stats;
+    ret.pooled = is->strman->counts.size();
+    return ret;
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::code_histogram(
+    bcode_ref const &code, span_type<std::size_t> counts
+) const {
+    if (!code) {
+        return 0;
+    }
+    return bcode_histogram(
+        bcode_p{code}.get()->raw(), counts.data(), counts.size()
+    );
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::opcode_count() {
+    return BC_INST_BLOCK_REF + 1;
+}
+
+LIBCUBESCRIPT_EXPORT std::string_view state::opcode_name(std::size_t op) {
+    return bcode_opcode_name(op);
+}
+
 LIBCUBESCRIPT_EXPORT std::size_t state::max_call_depth() const {
     return p_tstate->max_call_depth;
 }
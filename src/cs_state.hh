@@ -3,12 +3,14 @@
 
 #include <cubescript/cubescript.hh>
 
+#include <chrono>
 #include <unordered_map>
 #include <string>
 #include <vector>
 
 #include "cs_bcode.hh"
 #include "cs_ident.hh"
+#include "cs_map.hh"
 
 namespace cubescript {
 
@@ -35,6 +37,18 @@ struct std_allocator {
     internal_state *istate;
 };
 
+struct shared_idents {
+    using ident_vector = std::vector<ident *, std_allocator<ident *>>;
+
+    shared_idents(bcode_ref c, ident_vector &&ids):
+        code{std::move(c)}, idents{std::move(ids)}
+    {}
+
+    /* keep the code alive while the table is around */
+    bcode_ref code;
+    ident_vector idents;
+};
+
 struct internal_state {
     using allocator_type = std_allocator<
         std::pair<std::string_view const, ident *>
@@ -63,6 +77,37 @@ struct internal_state {
     command *cmd_svar;
     command *cmd_var_changed;
 
+    using shared_allocator = std_allocator<
+        std::pair<std::uint32_t const *const, shared_idents>
+    >;
+    /* ident tables of shared code executed in this state */
+    std::unordered_map<
+        std::uint32_t const *, shared_idents,
+        std::hash<std::uint32_t const *>,
+        std::equal_to<std::uint32_t const *>,
+        shared_allocator
+    > shared_code;
+    /* size at which tables of no longer used code are dropped */
+    std::size_t shared_sweep = 16;
+    using pool_allocator = std_allocator<
+        std::pair<std::size_t const, std::uint32_t *>
+    >;
+    /* compiled code by content hash, see state::dedup_code() */
+    std::unordered_map<
+        std::size_t, std::uint32_t *, std::hash<std::size_t>,
+        std::equal_to<std::size_t>, pool_allocator
+    > code_pool;
+    bool dedup_code = false;
+    /* mapped bytecode images */
+    std::vector<file_map, std_allocator<file_map>> maps;
+    /* ident usage counters, indexed by ident index */
+    std::vector<ident_usage, std_allocator<ident_usage>> usage;
+    bool track_usage = false;
+    /* runtime statistics, see state::stats() */
+    state_stats stats{};
+    /* compiled regular expressions, see regex_get() */
+    struct regex_cache *recache = nullptr;
+
     internal_state() = delete;
 
     internal_state(alloc_func af, void *data);
@@ -104,6 +149,50 @@ struct internal_state {
     }
 };
 
+/* count a use of an ident, if usage tracking is enabled */
+inline void note_usage(
+    internal_state *is, ident const *id, std::size_t ident_usage::*cnt
+) {
+    if (is->track_usage) {
+        ++(is->usage[std::size_t(id->index())].*cnt);
+    }
+}
+
+/* counts a call of an ident and the time spent in it, if usage tracking is
+ * enabled; the clock is not read otherwise
+ */
+struct usage_timer {
+    using clock = std::chrono::steady_clock;
+
+    usage_timer(internal_state *is, ident const *id):
+        p_is{is->track_usage ? is : nullptr}, p_id{id}
+    {
+        if (p_is) {
+            ++p_is->usage[std::size_t(id->index())].calls;
+            p_start = clock::now();
+        }
+    }
+
+    usage_timer(usage_timer const &) = delete;
+    usage_timer &operator=(usage_timer const &) = delete;
+
+    ~usage_timer() {
+        /* tracking may have been turned off in the meantime */
+        if (p_is && p_is->track_usage) {
+            p_is->usage[std::size_t(p_id->index())].call_ns += std::uint64_t(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    clock::now() - p_start
+                ).count()
+            );
+        }
+    }
+
+private:
+    internal_state *p_is;
+    ident const *p_id;
+    clock::time_point p_start{};
+};
+
 struct state_p {
     state_p(state &cs): csp{&cs} {}
 
@@ -130,7 +219,23 @@ inline void new_cmd_quiet(
     state &cs, std::string_view name, std::string_view args, F &&f
 ) {
     try {
-        cs.new_command(name, args, std::forward<F>(f));
+        auto &cmd = cs.new_command(name, args, std::forward<F>(f));
+        ident_p{cmd}.impl().p_flags |= IDENT_FLAG_STD;
+    } catch (error const &) {
+        return;
+    }
+}
+
+/* like new_cmd_quiet, for commands that may build their result in the
+ * string of their first argument when nothing else refers to it
+ */
+template<typename F>
+inline void new_cmd_inplace(
+    state &cs, std::string_view name, std::string_view args, F &&f
+) {
+    try {
+        auto &cmd = cs.new_command(name, args, std::forward<F>(f));
+        ident_p{cmd}.impl().p_flags |= IDENT_FLAG_INPLACE | IDENT_FLAG_STD;
     } catch (error const &) {
         return;
     }
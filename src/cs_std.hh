@@ -81,7 +81,7 @@ struct charbuf: valbuf<char> {
     }
 
     void append(std::string_view v) {
-        append(&v[0], &v[v.size()]);
+        append(v.data(), v.data() + v.size());
     }
 
     std::string_view str() {
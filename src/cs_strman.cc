@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <cubescript/cubescript.hh>
@@ -11,8 +12,23 @@ struct string_ref_state {
     internal_state *state;
     std::size_t length;
     std::size_t refcount;
+    /* the allocation holds capacity + 1 bytes */
+    std::size_t capacity;
+    /* whether the string is interned, i.e. present in the pool */
+    bool pooled;
 };
 
+inline std::size_t get_alloc_size(string_ref_state const *ss) {
+    return ss->capacity + sizeof(string_ref_state) + 1;
+}
+
+static inline void free_str(internal_state *cs, string_ref_state *ss) {
+    auto sz = get_alloc_size(ss);
+    --cs->stats.strings;
+    cs->stats.string_bytes -= sz;
+    cs->alloc(ss, sz, 0);
+}
+
 inline string_ref_state *get_ref_state(char const *ptr) {
     string_ref_state *r;
     std::memcpy(&r, &ptr, sizeof(r));
@@ -26,6 +42,7 @@ char const *string_pool::add(std::string_view str) {
         auto *st = it->second;
         /* having a null pointer is the same as non-existence */
         if (st) {
+            ++cstate->stats.intern_hits;
             ++st->refcount;
             st += 1;
             char const *r;
@@ -34,10 +51,12 @@ char const *string_pool::add(std::string_view str) {
         }
     }
     /* not present: allocate brand new data */
+    ++cstate->stats.intern_misses;
     auto ss = str.size();
     auto strp = alloc_buf(ss);
     /* write string data, it's already pre-terminated */
     memcpy(strp, str.data(), ss);
+    get_ref_state(strp)->pooled = true;
     /* store it */
     counts.emplace(std::string_view{strp, ss}, get_ref_state(strp));
     return strp;
@@ -45,7 +64,29 @@ char const *string_pool::add(std::string_view str) {
 
 char const *string_pool::ref(char const *ptr) {
     auto *ss = get_ref_state(ptr);
+    if (ss->pooled || !ss->refcount || lending) {
+        ++ss->refcount;
+        return ptr;
+    }
+    /* a string outside the pool is being shared, so it is interned; if
+     * there is a pooled one with the same contents, the new reference is
+     * to that one and the unique one stays with its only holder
+     */
+    auto sr = std::string_view{ptr, ss->length};
+    auto it = counts.find(sr);
+    if ((it != counts.end()) && it->second) {
+        ++cstate->stats.intern_hits;
+        auto *st = it->second;
+        ++st->refcount;
+        st += 1;
+        char const *rp;
+        std::memcpy(&rp, &st, sizeof(rp));
+        return rp;
+    }
+    ++cstate->stats.intern_misses;
     ++ss->refcount;
+    ss->pooled = true;
+    counts.emplace(sr, ss);
     return ptr;
 }
 
@@ -58,21 +99,38 @@ string_ref string_pool::steal(char *ptr) {
         auto *st = it->second;
         if (st) {
             /* the buffer is superfluous now */
-            cstate->alloc(ss, ss->length + sizeof(string_ref_state) + 1, 0);
+            ++cstate->stats.intern_hits;
+            free_str(cstate, ss);
             st += 1;
             char const *rp;
             std::memcpy(&rp, &st, sizeof(rp));
             return string_ref{rp};
         }
     }
+    ++cstate->stats.intern_misses;
     ss->refcount = 0; /* string_ref will increment it */
+    ss->pooled = true;
     counts.emplace(sr, ss);
     return string_ref{ptr};
 }
 
+void string_pool::steal_unique(char *ptr, any_value &v) {
+    auto *ss = get_ref_state(ptr);
+    ss->refcount = 0;
+    ss->pooled = false;
+    /* the string_ref is gone right after, so this is no share */
+    lending = true;
+    v.set_string(string_ref{ptr});
+    lending = false;
+}
+
 void string_pool::unref(char const *ptr) {
     auto *ss = get_ref_state(ptr);
     if (!--ss->refcount) {
+        if (!ss->pooled) {
+            free_str(cstate, ss);
+            return;
+        }
         /* refcount zero, so ditch it
          * this path is a little slow...
          */
@@ -89,10 +147,60 @@ void string_pool::unref(char const *ptr) {
         /* we're freeing the key */
         counts.erase(it);
         /* dealloc */
-        cstate->alloc(ss, ss->length + sizeof(string_ref_state) + 1, 0);
+        free_str(cstate, ss);
     }
 }
 
+char *string_pool::reuse_buf(char const *ptr, std::size_t len) {
+    auto *ss = get_ref_state(ptr);
+    assert(ss->refcount == 1);
+    if (ss->pooled) {
+        /* nobody else can see it, so drop it from the pool */
+        auto it = counts.find(std::string_view{ptr, ss->length});
+        if ((it != counts.end()) && (it->second == ss)) {
+            counts.erase(it);
+        }
+        ss->pooled = false;
+    }
+    if (len > ss->capacity) {
+        /* grow geometrically so that repeated appends are linear */
+        auto ncap = std::max(len, ss->capacity * 2);
+        auto *mem = cstate->alloc(
+            ss, get_alloc_size(ss), ncap + sizeof(string_ref_state) + 1
+        );
+        ss = static_cast<string_ref_state *>(mem);
+        cstate->stats.string_bytes += ncap - ss->capacity;
+        ss->capacity = ncap;
+    }
+    ss->length = len;
+    char *strp;
+    ss += 1;
+    std::memcpy(&strp, &ss, sizeof(strp));
+    strp[len] = '\0';
+    return strp;
+}
+
+string_ref string_pool::intern(char const *ptr) {
+    auto *ss = get_ref_state(ptr);
+    if (ss->pooled) {
+        return string_ref{ptr};
+    }
+    auto sr = std::string_view{ptr, ss->length};
+    auto it = counts.find(sr);
+    if ((it != counts.end()) && it->second) {
+        ++cstate->stats.intern_hits;
+        auto *st = it->second + 1;
+        char const *rp;
+        std::memcpy(&rp, &st, sizeof(rp));
+        return string_ref{rp};
+    }
+    /* nothing to share it with, so it becomes the pooled one */
+    ++cstate->stats.intern_misses;
+    ss->pooled = true;
+    counts.emplace(sr, ss);
+    return string_ref{ptr};
+}
+
 char const *string_pool::find(std::string_view str) const {
     auto it = counts.find(str);
     if (it == counts.end()) {
@@ -110,12 +218,17 @@ std::string_view string_pool::get(char const *ptr) const {
 }
 
 char *string_pool::alloc_buf(std::size_t len) const {
-    auto mem = cstate->alloc(nullptr, 0, len + sizeof(string_ref_state) + 1);
+    auto asz = len + sizeof(string_ref_state) + 1;
+    auto mem = cstate->alloc(nullptr, 0, asz);
+    ++cstate->stats.strings;
+    cstate->stats.string_bytes += asz;
     /* write length and initial refcount */
     auto *sst = static_cast<string_ref_state *>(mem);
     sst->state = cstate;
     sst->length = len;
     sst->refcount = 1;
+    sst->capacity = len;
+    sst->pooled = false;
     /* pre-terminate */
     char *strp;
     sst += 1;
@@ -137,6 +250,67 @@ std::string_view str_managed_view(char const *str) {
     return get_ref_state(str)->state->strman->get(str);
 }
 
+std::size_t str_managed_refs(char const *str) {
+    return get_ref_state(str)->refcount;
+}
+
+std::size_t str_managed_size(char const *str) {
+    return get_alloc_size(get_ref_state(str));
+}
+
+char *str_take_unique(state &cs, any_value &v, std::size_t len) {
+    if (v.type() != value_type::STRING) {
+        return nullptr;
+    }
+    char const *p = v.force_string(cs).data();
+    auto *ss = get_ref_state(p);
+    if (ss->refcount != 1) {
+        /* the other reference may be the alias the result goes to */
+        if (
+            (ss->refcount != 2) || !state_p{cs}.ts().take_unshared(p)
+        ) {
+            return nullptr;
+        }
+    }
+    /* keep it alive while the value lets go of it */
+    ++ss->refcount;
+    v.set_none();
+    return ss->state->strman->reuse_buf(p, len);
+}
+
+void str_intern(state &cs, any_value &v) {
+    if (v.type() != value_type::STRING) {
+        return;
+    }
+    char const *p = v.force_string(cs).data();
+    auto *ss = get_ref_state(p);
+    if (!ss->pooled) {
+        v.set_string(ss->state->strman->intern(p));
+    }
+}
+
+void str_lend(state &cs, any_value &dst, any_value &src) {
+    if (src.type() != value_type::STRING) {
+        dst = src;
+        return;
+    }
+    auto *strman = get_ref_state(src.force_string(cs).data())->state->strman;
+    strman->lending = true;
+    dst = src;
+    strman->lending = false;
+}
+
+void str_lend_done(state &cs, any_value &v) {
+    if (v.type() != value_type::STRING) {
+        return;
+    }
+    char const *p = v.force_string(cs).data();
+    auto *ss = get_ref_state(p);
+    if (!ss->pooled && (ss->refcount > 1)) {
+        v.set_string(ss->state->strman->intern(p));
+    }
+}
+
 /* strref implementation */
 
 LIBCUBESCRIPT_EXPORT string_ref::string_ref(state &cs, std::string_view str) {
@@ -144,10 +318,8 @@ LIBCUBESCRIPT_EXPORT string_ref::string_ref(state &cs, std::string_view str) {
 }
 
 LIBCUBESCRIPT_EXPORT string_ref::string_ref(string_ref const &ref):
-    p_str{ref.p_str}
-{
-    get_ref_state(p_str)->state->strman->ref(p_str);
-}
+    p_str{str_managed_ref(ref.p_str)}
+{}
 
 /* this can be used by friends to do quick string_ref creation */
 LIBCUBESCRIPT_EXPORT string_ref::string_ref(char const *p) {
@@ -159,7 +331,9 @@ LIBCUBESCRIPT_EXPORT string_ref::~string_ref() {
 }
 
 LIBCUBESCRIPT_EXPORT string_ref &string_ref::operator=(string_ref const &ref) {
+    auto *old = p_str;
     p_str = str_managed_ref(ref.p_str);
+    str_managed_unref(old);
     return *this;
 }
 
@@ -172,11 +346,20 @@ LIBCUBESCRIPT_EXPORT string_ref::operator std::string_view() const {
 }
 
 LIBCUBESCRIPT_EXPORT bool string_ref::operator==(string_ref const &s) const {
-    return p_str == s.p_str;
+    if (p_str == s.p_str) {
+        return true;
+    }
+    /* a string outside the pool is only held by one reference, and may
+     * have a duplicate elsewhere while it is being built
+     */
+    if (get_ref_state(p_str)->pooled && get_ref_state(s.p_str)->pooled) {
+        return false;
+    }
+    return str_managed_view(p_str) == str_managed_view(s.p_str);
 }
 
 LIBCUBESCRIPT_EXPORT bool string_ref::operator!=(string_ref const &s) const {
-    return p_str != s.p_str;
+    return !(*this == s);
 }
 
 } /* namespace cubescript */
@@ -16,6 +16,28 @@ struct string_ref_state;
 char const *str_managed_ref(char const *str);
 void str_managed_unref(char const *str);
 std::string_view str_managed_view(char const *str);
+/* the reference count and the allocation size of a managed string */
+std::size_t str_managed_refs(char const *str);
+std::size_t str_managed_size(char const *str);
+
+/* if the value is a string nothing else refers to, take it out of the value
+ * as a buffer (see string_pool::reuse_buf) holding len characters, so that
+ * it can be modified in place; otherwise return a null pointer
+ */
+char *str_take_unique(state &cs, any_value &v, std::size_t len);
+
+/* if the value is a string outside the pool, replace it with an interned
+ * one (see string_pool::intern)
+ */
+void str_intern(state &cs, any_value &v);
+
+/* assign src to dst like a copy, except that a string outside the pool is
+ * not interned although it becomes shared; this is for a short-lived copy,
+ * which must be given to str_lend_done() once the other holder may have
+ * let go of it, interning it if it is still shared
+ */
+void str_lend(state &cs, any_value &dst, any_value &src);
+void str_lend_done(state &cs, any_value &v);
 
 /* string manager
  *
@@ -29,6 +51,12 @@ std::string_view str_managed_view(char const *str);
  * as a part of the string's memory, so it can be easily accessed using just
  * the pointer to the string, but also this is transparent for usage
  *
+ * a string that is being built in place (see reuse_buf) is kept out of the
+ * pool while nothing else refers to it, since its contents may still change;
+ * it is interned as soon as it is shared (see ref), so every shared string
+ * is pooled and only these unique ones compare by contents rather than by
+ * pointer
+ *
  * this is not thread-safe yet, and later on it should be made that,
  * for now we don't bother...
  */
@@ -53,9 +81,11 @@ struct string_pool {
      */
     char const *add(std::string_view str);
 
-    /* this simply increments the reference count of an existing managed
-     * string, this is only safe when you know the pointer you are passing
-     * is already managed the system
+    /* this increments the reference count of an existing managed string,
+     * this is only safe when you know the pointer you are passing is already
+     * managed the system; a string outside the pool is interned once it is
+     * shared, which may return another pointer with the same contents, so
+     * the new reference must use the returned pointer
      */
     char const *ref(char const *ptr);
 
@@ -64,6 +94,25 @@ struct string_pool {
      */
     string_ref steal(char *ptr);
 
+    /* like steal(), but the string is not interned and is stored in v as
+     * its only reference, so that v may keep reusing it with reuse_buf()
+     */
+    void steal_unique(char *ptr, any_value &v);
+
+    /* takes a string whose only reference is held by the caller out of the
+     * pool and gives it back as a buffer like alloc_buf() does, resized to
+     * len characters (the contents are kept up to that); the capacity grows
+     * geometrically, so repeated appends are amortized; the pointer may
+     * change, and the old one must not be used anymore
+     */
+    char *reuse_buf(char const *ptr, std::size_t len);
+
+    /* returns the interned version of a managed string; a string outside
+     * the pool is put in it unless there already is one with the same
+     * contents, in which case that one is returned instead
+     */
+    string_ref intern(char const *ptr);
+
     /* decrements the reference count and removes it from the system if
      * that reaches zero; likewise, only safe with pointers that are managed
      */
@@ -83,6 +132,8 @@ struct string_pool {
     char *alloc_buf(std::size_t len) const;
 
     internal_state *cstate;
+    /* while set, ref() does not intern, see str_lend() */
+    bool lending = false;
     std::unordered_map<
         std::string_view, string_ref_state *,
         std::hash<std::string_view>,
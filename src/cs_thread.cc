@@ -5,10 +5,42 @@
 namespace cubescript {
 
 thread_state::thread_state(internal_state *cs):
-    vmstack{cs}, idstack{cs}, callstack{cs}, astacks{cs}, errbuf{cs}
+    vmstack{cs}, idstack{std_allocator<ident_stack>{cs}},
+    callstack{std_allocator<ident_level>{cs}}, astacks{cs}, errbuf{cs}
 {
     vmstack.reserve(32);
-    idstack.reserve(MAX_ARGUMENTS);
+}
+
+thread_state::~thread_state() {
+    auto *item = posted.exchange(nullptr, std::memory_order_acquire);
+    while (item) {
+        auto *next = item->next;
+        free_post(item);
+        item = next;
+    }
+    while (post_queue) {
+        auto *next = post_queue->next;
+        free_post(post_queue);
+        post_queue = next;
+    }
+}
+
+/* a lock-free stack; the owner takes all of it at once, which leaves no
+ * room for the ABA problem
+ */
+void thread_state::post(post_item *item) {
+    auto *head = posted.load(std::memory_order_relaxed);
+    do {
+        item->next = head;
+    } while (!posted.compare_exchange_weak(
+        head, item, std::memory_order_release, std::memory_order_relaxed
+    ));
+}
+
+void thread_state::free_post(post_item *item) {
+    auto size = item->size;
+    item->~post_item();
+    istate->alloc(item, size, 0);
 }
 
 hook_func thread_state::set_hook(hook_func f) {
@@ -17,6 +49,69 @@ hook_func thread_state::set_hook(hook_func f) {
     return hk;
 }
 
+debug_hook_func thread_state::set_debug_hook(
+    hook_event ev, debug_hook_func f
+) {
+    auto &slot = debug_hooks[std::size_t(ev)];
+    auto hk = std::move(slot);
+    slot = std::move(f);
+    if (slot) {
+        hook_mask |= 1u << unsigned(ev);
+    } else {
+        hook_mask &= ~(1u << unsigned(ev));
+    }
+    ++hook_gens[std::size_t(ev)];
+    return hk;
+}
+
+void thread_state::run_hook(hook_event ev, ident *id) {
+    if (in_hook) {
+        return;
+    }
+    /* the hook may replace itself, so call it from here */
+    auto &slot = debug_hooks[std::size_t(ev)];
+    auto &slot_gen = hook_gens[std::size_t(ev)];
+    auto hk = std::move(slot);
+    auto gen = slot_gen;
+    auto restore = [this, ev, &slot, &slot_gen, &hk, gen]() {
+        in_hook = false;
+        if (slot_gen == gen) {
+            slot = std::move(hk);
+        }
+        /* the mask must never name an event with an empty slot */
+        if (!slot) {
+            hook_mask &= ~(1u << unsigned(ev));
+        }
+    };
+    in_hook = true;
+    try {
+        hk(*pstate, id);
+    } catch (...) {
+        restore();
+        throw;
+    }
+    restore();
+}
+
+bool thread_state::take_unshared(char const *str) {
+    if (!unshare) {
+        return false;
+    }
+    auto &ast = get_astack(unshare);
+    auto &val = ast.node->val_s;
+    if (
+        (val.type() != value_type::STRING) ||
+        (val.force_string(*pstate).data() != str)
+    ) {
+        return false;
+    }
+    /* the result is assigned to it right after */
+    val.set_none();
+    ast.node->code = bcode_ref{};
+    unshare = nullptr;
+    return true;
+}
+
 alias_stack &thread_state::get_astack(alias const *a) {
     auto it = astacks.try_emplace(a->index());
     if (it.second) {
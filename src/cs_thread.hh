@@ -3,6 +3,8 @@
 
 #include <cubescript/cubescript.hh>
 
+#include <atomic>
+#include <deque>
 #include <utility>
 
 #include "cs_std.hh"
@@ -11,6 +13,9 @@
 
 namespace cubescript {
 
+struct recorder;
+struct replayer;
+
 struct ident_level {
     ident &id;
     argset usedargs{};
@@ -18,6 +23,19 @@ struct ident_level {
     ident_level(ident &i): id{i} {};
 };
 
+inline constexpr std::size_t HOOK_EVENTS = std::size_t(hook_event::COUNT) + 1;
+
+/* code posted to a thread from elsewhere, see state::post(); the node is
+ * followed by the source (unless there is code) and the arguments, each as
+ * a length and the chars
+ */
+struct post_item {
+    post_item *next = nullptr;
+    bcode_ref code;
+    std::size_t size = 0; /* of the whole allocation */
+    std::size_t nargs = 0;
+};
+
 struct thread_state {
     using astack_allocator = std_allocator<std::pair<int const, alias_stack>>;
     /* the shared state pointer */
@@ -26,10 +44,12 @@ struct thread_state {
     state *pstate{};
     /* VM stack */
     valbuf<any_value> vmstack;
-    /* ident stack */
-    valbuf<ident_stack> idstack;
+    /* ident stack; the nodes are linked into alias stacks and the levels
+     * are referred to across calls, so neither may move as the stacks grow
+     */
+    std::deque<ident_stack, std_allocator<ident_stack>> idstack;
     /* call stack */
-    valbuf<ident_level> callstack;
+    std::deque<ident_level, std_allocator<ident_level>> callstack;
     /* per-alias stack pointer */
     std::unordered_map<
         int, alias_stack, std::hash<int>, std::equal_to<int>, astack_allocator
@@ -38,6 +58,17 @@ struct thread_state {
     charbuf errbuf;
     /* we can attach a hook to vm events */
     hook_func call_hook{};
+    /* debug hooks and the mask of the events that have one */
+    debug_hook_func debug_hooks[HOOK_EVENTS];
+    unsigned int hook_mask = 0;
+    /* instructions between count hooks and until the next one */
+    std::size_t hook_count = 1000;
+    std::size_t hook_left = 1000;
+    /* bumped whenever the hook of an event is set, so a running one knows
+     * if it has been replaced
+     */
+    std::size_t hook_gens[HOOK_EVENTS] = {};
+    bool in_hook = false;
     /* whether we own the internal state (i.e. not a side thread */
     bool owner = false;
     /* thread ident flags */
@@ -48,17 +79,64 @@ struct thread_state {
     std::size_t call_depth = 0;
     /* loop nesting level */
     std::size_t loop_level = 0;
+    /* ident table of the shared code being executed, if any */
+    ident **idmap = nullptr;
+    /* while an in-place command runs, the alias its result is assigned to
+     * (see BC_INST_UNSHARE); it keeps its value until the command takes
+     * over the string, see take_unshared()
+     */
+    alias *unshare = nullptr;
+    /* where the next precompile_aliases() resumes */
+    std::size_t precompile_pos = 0;
+    /* workload recording and replay, if in progress */
+    recorder *rec = nullptr;
+    replayer *rep = nullptr;
+    /* nesting level of recorded host commands */
+    std::size_t rec_host = 0;
     /* debug info */
     std::string_view source{};
     std::size_t *current_line = nullptr;
+    /* posted items, pushed by any OS thread and newest first */
+    std::atomic<post_item *> posted{nullptr};
+    /* items taken from the above and not run yet, oldest first */
+    post_item *post_queue = nullptr;
 
     thread_state(internal_state *cs);
+    ~thread_state();
+
+    void post(post_item *item);
+    void free_post(post_item *item);
 
     hook_func set_hook(hook_func f);
 
     hook_func &get_hook() { return call_hook; }
     hook_func const &get_hook() const { return call_hook; }
 
+    debug_hook_func set_debug_hook(hook_event ev, debug_hook_func f);
+
+    bool hooked(hook_event ev) const {
+        return hook_mask & (1u << unsigned(ev));
+    }
+
+    /* if the alias in unshare holds str, let go of it so that the command
+     * may reuse it, and return whether it did
+     */
+    bool take_unshared(char const *str);
+
+    /* run the hook of an enabled event */
+    void run_hook(hook_event ev, ident *id);
+
+    /* count an instruction, running the count hook if enabled and due */
+    void count_hook() {
+        if (hooked(hook_event::COUNT) && !--hook_left) {
+            hook_left = hook_count;
+            run_hook(
+                hook_event::COUNT,
+                callstack.empty() ? nullptr : &callstack.back().id
+            );
+        }
+    }
+
     alias_stack &get_astack(alias const *a);
 
     char *request_errbuf(std::size_t bufs, char *&sp);
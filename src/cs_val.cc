@@ -4,6 +4,7 @@
 #include "cs_state.hh"
 #include "cs_strman.hh"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <iterator>
@@ -56,6 +57,72 @@ static std::string_view floatstr(float_type v, charbuf &buf) {
     return std::string_view{buf.data(), std::size_t(n)};
 }
 
+/* a list source is shared by all the values holding it */
+
+struct list_source {
+    list_source(internal_state *is, source_func &&f):
+        istate{is}, func{std::move(f)}
+    {}
+
+    internal_state *istate;
+    std::size_t refs = 1;
+    source_func func;
+};
+
+static void source_unref(list_source *l) {
+    if (!--l->refs) {
+        l->istate->destroy(l);
+    }
+}
+
+static string_ref source_str(state &cs, any_value const &v) {
+    charbuf buf{cs};
+    any_value item{};
+    std::size_t pos = 0;
+    while (v.next_item(cs, pos, item)) {
+        if (!buf.empty()) {
+            buf.push_back(' ');
+        }
+        list_quote_item(buf, item.get_string(cs));
+    }
+    return string_ref{cs, buf.str()};
+}
+
+/* vectors are immutable, so their string can be kept once built */
+
+struct float_vector {
+    float_vector(internal_state *is, std::size_t n): istate{is}, size{n} {}
+
+    internal_state *istate;
+    std::size_t refs = 1;
+    std::size_t size;
+    char const *str = nullptr;
+    float_type comps[4] = {};
+};
+
+static void vector_unref(float_vector *v) {
+    if (!--v->refs) {
+        if (v->str) {
+            str_managed_unref(v->str);
+        }
+        v->istate->destroy(v);
+    }
+}
+
+static char const *vector_str(state &cs, float_vector *v) {
+    if (!v->str) {
+        charbuf buf{cs}, rs{cs};
+        for (std::size_t i = 0; i < v->size; ++i) {
+            if (i) {
+                buf.push_back(' ');
+            }
+            buf.append(floatstr(v->comps[i], rs));
+        }
+        v->str = state_p{cs}.ts().istate->strman->add(buf.str());
+    }
+    return v->str;
+}
+
 template<typename T>
 static inline void csv_cleanup(value_type tv, T *stor) {
     switch (tv) {
@@ -66,6 +133,12 @@ static inline void csv_cleanup(value_type tv, T *stor) {
             bcode_unref(stor->b->raw());
             break;
         }
+        case value_type::SOURCE:
+            source_unref(stor->l);
+            break;
+        case value_type::VECTOR:
+            vector_unref(stor->fv);
+            break;
         default:
             break;
     }
@@ -137,12 +210,21 @@ any_value &any_value::operator=(any_value const &v) {
             break;
         case value_type::STRING:
             p_type = value_type::STRING;
-            p_stor.s = v.p_stor.s;
-            str_managed_ref(p_stor.s);
+            p_stor.s = str_managed_ref(v.p_stor.s);
             break;
         case value_type::CODE:
             set_code(v.get_code());
             break;
+        case value_type::SOURCE:
+            p_type = value_type::SOURCE;
+            p_stor.l = v.p_stor.l;
+            ++p_stor.l->refs;
+            break;
+        case value_type::VECTOR:
+            p_type = value_type::VECTOR;
+            p_stor.fv = v.p_stor.fv;
+            ++p_stor.fv->refs;
+            break;
         default:
             break;
     }
@@ -150,8 +232,16 @@ any_value &any_value::operator=(any_value const &v) {
 }
 
 any_value &any_value::operator=(any_value &&v) {
-    *this = v;
-    v.set_none();
+    if (this == &v) {
+        return *this;
+    }
+    /* take over the reference without touching the refcount, so that a
+     * unique string being moved does not look shared in between
+     */
+    csv_cleanup(p_type, &p_stor);
+    p_type = v.p_type;
+    std::memcpy(&p_stor, &v.p_stor, sizeof(p_stor));
+    v.p_type = value_type::NONE;
     return *this;
 }
 
@@ -221,6 +311,26 @@ void any_value::set_code(bcode_ref const &val) {
     p_stor.b = p;
 }
 
+void any_value::set_vector(span_type<float_type const> val, state &cs) {
+    switch (val.size()) {
+        case 0:
+            set_none();
+            return;
+        case 1:
+            set_float(val[0]);
+            return;
+        default:
+            break;
+    }
+    auto *is = state_p{cs}.ts().istate;
+    auto n = std::min(val.size(), std::size_t(4));
+    auto *v = is->create<float_vector>(is, n);
+    std::copy(val.begin(), val.begin() + n, v->comps);
+    csv_cleanup(p_type, &p_stor);
+    p_type = value_type::VECTOR;
+    p_stor.fv = v;
+}
+
 void any_value::set_ident(ident &val) {
     csv_cleanup(p_type, &p_stor);
     p_type = value_type::IDENT;
@@ -239,6 +349,8 @@ void any_value::force_plain() {
         case value_type::FLOAT:
         case value_type::INTEGER:
         case value_type::STRING:
+        case value_type::SOURCE:
+        case value_type::VECTOR:
             return;
         default:
             break;
@@ -255,6 +367,9 @@ float_type any_value::force_float() {
         case value_type::STRING:
             rf = parse_float(str_managed_view(p_stor.s));
             break;
+        case value_type::VECTOR:
+            rf = p_stor.fv->comps[0];
+            break;
         case value_type::FLOAT:
             return p_stor.f;
         default:
@@ -273,6 +388,10 @@ integer_type any_value::force_integer() {
         case value_type::STRING:
             ri = parse_int(str_managed_view(p_stor.s));
             break;
+        case value_type::VECTOR:
+            /* truncated, the same as parsing the string of the vector */
+            ri = integer_type(std::trunc(p_stor.fv->comps[0]));
+            break;
         case value_type::INTEGER:
             return p_stor.i;
         default:
@@ -294,6 +413,16 @@ std::string_view any_value::force_string(state &cs) {
             break;
         case value_type::STRING:
             return str_managed_view(p_stor.s);
+        case value_type::SOURCE:
+            set_string(source_str(cs, *this));
+            return str_managed_view(p_stor.s);
+        case value_type::VECTOR: {
+            auto *s = str_managed_ref(vector_str(cs, p_stor.fv));
+            vector_unref(p_stor.fv);
+            p_stor.s = s;
+            p_type = value_type::STRING;
+            return str_managed_view(s);
+        }
         default:
             str = rs.str();
             break;
@@ -338,6 +467,8 @@ integer_type any_value::get_integer() const {
             return p_stor.i;
         case value_type::STRING:
             return parse_int(str_managed_view(p_stor.s));
+        case value_type::VECTOR:
+            return integer_type(std::trunc(p_stor.fv->comps[0]));
         default:
             break;
     }
@@ -352,12 +483,22 @@ float_type any_value::get_float() const {
             return float_type(p_stor.i);
         case value_type::STRING:
             return parse_float(str_managed_view(p_stor.s));
+        case value_type::VECTOR:
+            return p_stor.fv->comps[0];
         default:
             break;
     }
     return 0.0f;
 }
 
+std::size_t any_value::get_vector(float_type *comps) const {
+    if (type() != value_type::VECTOR) {
+        return 0;
+    }
+    std::copy(p_stor.fv->comps, p_stor.fv->comps + p_stor.fv->size, comps);
+    return p_stor.fv->size;
+}
+
 bcode_ref any_value::get_code() const {
     if (type() != value_type::CODE) {
         return bcode_ref{};
@@ -384,6 +525,10 @@ string_ref any_value::get_string(state &cs) const {
             charbuf rs{cs};
             return string_ref{cs, floatstr(p_stor.f, rs)};
         }
+        case value_type::SOURCE:
+            return source_str(cs, *this);
+        case value_type::VECTOR:
+            return string_ref{vector_str(cs, p_stor.fv)};
         default:
             break;
     }
@@ -395,6 +540,8 @@ any_value any_value::get_plain() const {
         case value_type::STRING:
         case value_type::INTEGER:
         case value_type::FLOAT:
+        case value_type::SOURCE:
+        case value_type::VECTOR:
             return *this;
         default:
             break;
@@ -425,11 +572,52 @@ bool any_value::get_bool() const {
             }
             return true;
         }
+        case value_type::SOURCE:
+        case value_type::VECTOR:
+            return true;
         default:
             return false;
     }
 }
 
+bool any_value::next_item(
+    state &cs, std::size_t &pos, any_value &item
+) const {
+    if (type() != value_type::SOURCE) {
+        return false;
+    }
+    /* the source may get dropped by whatever it runs */
+    auto *l = p_stor.l;
+    ++l->refs;
+    bool ret;
+    try {
+        ret = l->func(cs, pos, item);
+    } catch (...) {
+        source_unref(l);
+        throw;
+    }
+    source_unref(l);
+    return ret;
+}
+
+void *state::shared_alloc(
+    void *data, void *p, std::size_t os, std::size_t ns
+) {
+    return static_cast<internal_state *>(data)->alloc(p, os, ns);
+}
+
+void *state::shared_data() {
+    return state_p{*this}.ts().istate;
+}
+
+any_value state::new_source(source_func func) {
+    auto *is = state_p{*this}.ts().istate;
+    any_value ret{};
+    ret.p_stor.l = is->create<list_source>(is, std::move(func));
+    ret.p_type = value_type::SOURCE;
+    return ret;
+}
+
 /* public utilities */
 
 LIBCUBESCRIPT_EXPORT string_ref concat_values(
@@ -440,7 +628,9 @@ LIBCUBESCRIPT_EXPORT string_ref concat_values(
         switch (vals[i].type()) {
             case value_type::INTEGER:
             case value_type::FLOAT:
-            case value_type::STRING: {
+            case value_type::STRING:
+            case value_type::SOURCE:
+            case value_type::VECTOR: {
                 auto val = any_value{vals[i]};
                 auto str = val.force_string(cs);
                 std::copy(str.begin(), str.end(), std::back_inserter(buf));
@@ -3,10 +3,12 @@
 #include "cs_std.hh"
 #include "cs_parser.hh"
 #include "cs_error.hh"
+#include "cs_strman.hh"
 
 #include <cstdio>
 #include <cmath>
 #include <limits>
+#include <algorithm>
 
 namespace cubescript {
 
@@ -16,7 +18,7 @@ static inline void push_alias(thread_state &ts, ident &id, ident_stack &st) {
     }
     if (!static_cast<alias &>(id).is_arg()) {
         auto *aimp = static_cast<alias_impl *>(&id);
-        auto ast = ts.get_astack(aimp);
+        auto &ast = ts.get_astack(aimp);
         ast.push(st);
         ast.flags &= ~IDENT_FLAG_UNKNOWN;
     }
@@ -121,10 +123,13 @@ void exec_command(
     res.force_plain();
 }
 
-any_value exec_alias(
-        state &cs,
-    thread_state &ts, alias *a, any_value *args,
-    std::size_t callargs, alias_stack &astack
+/* run code with the arguments bound to the argument aliases, in a new
+ * call level of id; get_code is called once the level is set up
+ */
+template<typename F>
+static any_value exec_with_args(
+    state &cs, thread_state &ts, ident &id, int flags, any_value *args,
+    std::size_t callargs, F get_code
 ) {
     /* excess arguments get ignored (make error maybe?) */
     any_value ret;
@@ -143,23 +148,19 @@ any_value exec_alias(
     }
     auto oldargs = anargs->value(cs);
     auto oldflags = ts.ident_flags;
-    ts.ident_flags = astack.flags;
+    ts.ident_flags = flags;
     any_value cv;
     cv.set_integer(integer_type(callargs));
     anargs->set_raw_value(*ts.pstate, std::move(cv));
-    auto &lev = ts.callstack.emplace_back(*a);
+    auto &lev = ts.callstack.emplace_back(id);
     lev.usedargs = std::move(uargs);
-    if (!astack.node->code) {
-        try {
-            gen_state gs{ts};
-            gs.gen_main(astack.node->val_s.get_string(*ts.pstate));
-            astack.node->code = gs.steal_ref();
-        } catch (...) {
-            ts.callstack.pop_back();
-            throw;
-        }
+    bcode_ref coderef;
+    try {
+        coderef = get_code();
+    } catch (...) {
+        ts.callstack.pop_back();
+        throw;
     }
-    bcode_ref coderef = astack.node->code;
     auto cleanup = [](
         auto &tss, std::size_t cargs, std::size_t nids, auto oflags
     ) {
@@ -183,7 +184,13 @@ any_value exec_alias(
         tss.idstack.resize(nids);
     };
     try {
-        vm_exec(cs, ts, bcode_p{coderef}.get()->raw(), ret);
+        if (ts.hooked(hook_event::CALL)) {
+            ts.run_hook(hook_event::CALL, &id);
+        }
+        vm_exec_code(cs, ts, bcode_p{coderef}.get(), ret);
+        if (ts.hooked(hook_event::RETURN)) {
+            ts.run_hook(hook_event::RETURN, &id);
+        }
     } catch (...) {
         cleanup(ts, callargs, noff, oldflags);
         anargs->set_raw_value(*ts.pstate, std::move(oldargs));
@@ -194,6 +201,36 @@ any_value exec_alias(
     return ret;
 }
 
+any_value exec_alias(
+        state &cs,
+    thread_state &ts, alias *a, any_value *args,
+    std::size_t callargs, alias_stack &astack
+) {
+    usage_timer ut{ts.istate, a};
+    return exec_with_args(
+        cs, ts, *a, astack.flags, args, callargs, [&ts, &astack]() {
+            if (astack.node->code) {
+                ++ts.istate->stats.code_hits;
+            } else {
+                ++ts.istate->stats.code_misses;
+                astack.compile(ts);
+            }
+            return astack.node->code;
+        }
+    );
+}
+
+any_value exec_code_args(
+    thread_state &ts, bcode_ref const &code, any_value *args,
+    std::size_t nargs
+) {
+    return exec_with_args(
+        *ts.pstate, ts, *ts.istate->id_dummy, 0, args, nargs, [&code]() {
+            return code;
+        }
+    );
+}
+
 any_value exec_code_with_args(thread_state &ts, bcode_ref const &body) {
     if (ts.callstack.empty()) {
         return body.call(*ts.pstate);
@@ -255,6 +292,10 @@ struct vm_guard {
             throw error{*s.pstate, "exceeded recursion limit"};
         }
         ++s.call_depth;
+        auto &st = s.istate->stats;
+        st.peak_depth = std::max(st.peak_depth, s.call_depth);
+        st.peak_vmstack = std::max(st.peak_vmstack, oldtop);
+        st.peak_idstack = std::max(st.peak_idstack, s.idstack.size());
     }
 
     ~vm_guard() {
@@ -266,6 +307,37 @@ struct vm_guard {
     std::size_t oldtop;
 };
 
+static inline ident *vm_get_ident(thread_state &ts, std::uint32_t op) {
+    if (ts.idmap) {
+        return ts.idmap[op >> 8];
+    }
+    return ts.istate->identmap[op >> 8];
+}
+
+void vm_exec_code(
+    state &cs, thread_state &ts, bcode *code, any_value &result
+) {
+    auto *raw = code->raw();
+    auto *start = bcode_start(raw);
+    ident **idmap = nullptr;
+    if (bcode_flags(start) & BC_START_SHARED) {
+        idmap = bcode_resolve_shared(ts, start);
+    }
+    if (idmap == ts.idmap) {
+        vm_exec(cs, ts, raw, result);
+        return;
+    }
+    auto *oldmap = ts.idmap;
+    ts.idmap = idmap;
+    try {
+        vm_exec(cs, ts, raw, result);
+    } catch (...) {
+        ts.idmap = oldmap;
+        throw;
+    }
+    ts.idmap = oldmap;
+}
+
 std::uint32_t *vm_exec(state &mcs,
     thread_state &ts, std::uint32_t *code, any_value &result
 ) {
@@ -290,7 +362,10 @@ std::uint32_t *vm_exec(state &mcs,
                 break;
         }
     };
+    /* set by BC_INST_UNSHARE for the command call right after it */
+    alias *unshare = nullptr;
     for (;;) {
+        ts.count_hook();
         std::uint32_t op = *code++;
         switch (op & BC_INST_OP_MASK) {
             case BC_INST_START:
@@ -353,9 +428,10 @@ std::uint32_t *vm_exec(state &mcs,
                         auto len = op >> 8;
                         char const *str;
                         std::memcpy(&str, &code, sizeof(str));
-                        std::string_view sv{str, len};
-                        args.emplace_back().set_string(sv, cs);
                         code += len / sizeof(std::uint32_t) + 1;
+                        args.emplace_back().set_string(
+                            std::string_view{str, len}, cs
+                        );
                         continue;
                     }
                     case BC_RET_INT: {
@@ -504,6 +580,14 @@ std::uint32_t *vm_exec(state &mcs,
                 continue;
             }
 
+            case BC_INST_BLOCK_REF: {
+                bcode *b;
+                auto *bp = code - 1 - (op >> 8);
+                std::memcpy(&b, &bp, sizeof(b));
+                args.emplace_back().set_code(bcode_p::make_ref(b));
+                continue;
+            }
+
             case BC_INST_EMPTY:
                 args.emplace_back().set_code(bcode_p::make_ref(
                     bcode_get_empty(ts.istate->empty, op & BC_INST_RET_MASK)
@@ -553,7 +637,7 @@ std::uint32_t *vm_exec(state &mcs,
 
             case BC_INST_IDENT: {
                 alias *a = static_cast<alias *>(
-                    ts.istate->identmap[op >> 8]
+                    vm_get_ident(ts, op)
                 );
                 if (a->is_arg() && !ident_is_used_arg(a, ts)) {
                     ts.get_astack(a).push(ts.idstack.emplace_back());
@@ -584,7 +668,7 @@ std::uint32_t *vm_exec(state &mcs,
                 goto use_top;
 
             case BC_INST_LOOKUP: {
-                ident *id = ts.istate->identmap[op >> 8];
+                ident *id = vm_get_ident(ts, op);
                 if (static_cast<alias *>(id)->is_arg()) {
                     auto &v = args.emplace_back();
                     if (ident_is_used_arg(id, ts)) {
@@ -599,10 +683,26 @@ std::uint32_t *vm_exec(state &mcs,
                         id->name().data()
                     );
                 }
+                note_usage(ts.istate, id, &ident_usage::lookups);
                 args.emplace_back() = ast.node->val_s;
                 goto use_top;
             }
 
+            case BC_INST_LOOKUP_BUF: {
+                /* never an arg, see gen_state::gen_assign_alias */
+                ident *id = vm_get_ident(ts, op);
+                auto &ast = ts.get_astack(static_cast<alias *>(id));
+                if (ast.flags & IDENT_FLAG_UNKNOWN) {
+                    throw error_p::make(
+                        *ts.pstate, "unknown alias lookup: %s",
+                        id->name().data()
+                    );
+                }
+                note_usage(ts.istate, id, &ident_usage::lookups);
+                str_lend(cs, args.emplace_back(), ast.node->val_s);
+                goto use_top;
+            }
+
             case BC_INST_CONC:
             case BC_INST_CONC_W: {
                 std::size_t numconc = op >> 8;
@@ -616,15 +716,16 @@ std::uint32_t *vm_exec(state &mcs,
                 goto use_top;
             }
 
-            case BC_INST_VAR:
-                args.emplace_back() = static_cast<builtin_var *>(
-                    ts.istate->identmap[op >> 8]
-                )->value(mcs);
+            case BC_INST_VAR: {
+                auto *var = static_cast<builtin_var *>(vm_get_ident(ts, op));
+                note_usage(ts.istate, var, &ident_usage::lookups);
+                args.emplace_back() = var->value(mcs);
                 goto use_top;
+            }
 
             case BC_INST_ALIAS: {
                 auto *a = static_cast<alias *>(
-                    ts.istate->identmap[op >> 8]
+                    vm_get_ident(ts, op)
                 );
                 auto &ast = ts.get_astack(a);
                 if (a->is_arg()) {
@@ -646,7 +747,7 @@ std::uint32_t *vm_exec(state &mcs,
 
             case BC_INST_CALL: {
                 result.force_none();
-                ident *id = ts.istate->identmap[op >> 8];
+                ident *id = vm_get_ident(ts, op);
                 std::size_t callargs = *code++;
                 std::size_t offset = args.size() - callargs;
                 auto *imp = static_cast<alias_impl *>(id);
@@ -767,12 +868,50 @@ noid:
                 }
             }
 
+            case BC_INST_UNSHARE: {
+                auto *a = static_cast<alias *>(vm_get_ident(ts, op));
+                /* peek at the command call that follows */
+                auto *id = static_cast<command_impl *>(
+                    vm_get_ident(ts, *code)
+                );
+                if (a->is_arg() || !(id->p_flags & IDENT_FLAG_INPLACE)) {
+                    continue;
+                }
+                std::size_t callargs = (
+                    (*code & BC_INST_OP_MASK) == BC_INST_COM
+                ) ? std::size_t(id->arg_count()) : code[1];
+                if (!callargs || (callargs > args.size())) {
+                    continue;
+                }
+                auto &arg = args[args.size() - callargs];
+                auto &ast = ts.get_astack(a);
+                if (
+                    (arg.type() == value_type::STRING) &&
+                    (ast.node->val_s.type() == value_type::STRING) &&
+                    (
+                        arg.force_string(cs).data() ==
+                        ast.node->val_s.force_string(cs).data()
+                    )
+                ) {
+                    /* the alias lets go of it only once the command takes
+                     * it, so nothing sees the alias empty if the command
+                     * fails or a hook looks at it before
+                     */
+                    unshare = a;
+                    continue;
+                }
+                /* it may have been pushed by BC_INST_LOOKUP_BUF */
+                str_lend_done(cs, arg);
+                continue;
+            }
+
             case BC_INST_COM: {
                 command_impl *id = static_cast<command_impl *>(
-                    ts.istate->identmap[op >> 8]
+                    vm_get_ident(ts, op)
                 );
                 std::size_t offset = args.size() - id->arg_count();
                 result.force_none();
+                ts.unshare = std::exchange(unshare, nullptr);
                 id->call(ts, span_type<any_value>{
                     &args[offset], std::size_t(id->arg_count())
                 }, result);
@@ -782,11 +921,12 @@ noid:
 
             case BC_INST_COM_V: {
                 command_impl *id = static_cast<command_impl *>(
-                    ts.istate->identmap[op >> 8]
+                    vm_get_ident(ts, op)
                 );
                 std::size_t callargs = *code++;
                 std::size_t offset = args.size() - callargs;
                 result.force_none();
+                ts.unshare = std::exchange(unshare, nullptr);
                 id->call(
                     ts, span_type<any_value>{&args[offset], callargs}, result
                 );
@@ -28,12 +28,23 @@ any_value exec_alias(
     std::size_t callargs, alias_stack &astack
 );
 
+/* run code as if it was an alias called with the given arguments */
+any_value exec_code_args(
+    thread_state &ts, bcode_ref const &code, any_value *args,
+    std::size_t nargs
+);
+
 any_value exec_code_with_args(thread_state &ts, bcode_ref const &body);
 
 std::uint32_t *vm_exec(state &mcs,
     thread_state &ts, std::uint32_t *code, any_value &result
 );
 
+/* execute a block from its start, resolving idents of shared code */
+void vm_exec_code(
+    state &cs, thread_state &ts, bcode *code, any_value &result
+);
+
 } /* namespace cubescript */
 
 #endif /* LIBCUBESCRIPT_VM_HH */
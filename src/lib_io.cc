@@ -0,0 +1,153 @@
+#include <cubescript/cubescript.hh>
+
+#include <algorithm>
+
+#include "cs_std.hh"
+#include "cs_map.hh"
+#include "cs_state.hh"
+#include "cs_thread.hh"
+#include "cs_error.hh"
+
+namespace cubescript {
+
+/* a mapped file, unmapped once whatever holds it goes away */
+struct io_file {
+    io_file(state &cs, std::string_view path):
+        istate{state_p{cs}.ts().istate}
+    {
+        if (!file_map_open(istate, path, map)) {
+            throw error_p::make(
+                cs, "could not open file '%.*s'", int(path.size()),
+                path.data()
+            );
+        }
+    }
+
+    io_file(io_file &&f): istate{f.istate}, map{f.map} {
+        f.map.data = nullptr;
+    }
+
+    ~io_file() {
+        file_map_close(istate, map);
+    }
+
+    std::string_view data() const {
+        return std::string_view{
+            static_cast<char const *>(map.data), map.size
+        };
+    }
+
+    internal_state *istate;
+    file_map map{};
+};
+
+/* get the record starting at pos and move past its separator; a separator
+ * at the very end of the file does not start another record
+ */
+static bool io_next_record(
+    std::string_view data, std::string_view sep, std::size_t &pos,
+    std::string_view &rec
+) {
+    if (pos >= data.size()) {
+        return false;
+    }
+    auto end = data.find(sep, pos);
+    if (end == std::string_view::npos) {
+        end = data.size();
+    }
+    rec = data.substr(pos, end - pos);
+    pos = std::min(end + sep.size(), data.size());
+    return true;
+}
+
+static bool io_next_line(
+    std::string_view data, std::size_t &pos, std::string_view &line
+) {
+    if (!io_next_record(data, "\n", pos, line)) {
+        return false;
+    }
+    if (!line.empty() && (line.back() == '\r')) {
+        line.remove_suffix(1);
+    }
+    return true;
+}
+
+static std::string_view io_get_sep(state &cs, any_value &arg) {
+    auto sep = arg.force_string(cs);
+    if (sep.empty()) {
+        throw error{cs, "record separator cannot be empty"};
+    }
+    return sep;
+}
+
+template<typename F>
+static void io_loop(
+    state &cs, ident &id, bcode_ref &&body, F next
+) {
+    alias_local st{cs, id};
+    any_value idv{};
+    std::string_view rec;
+    for (std::size_t pos = 0; next(pos, rec);) {
+        idv.set_string(rec, cs);
+        st.set(std::move(idv));
+        if (body.call_loop(cs) == loop_state::BREAK) {
+            break;
+        }
+    }
+}
+
+LIBCUBESCRIPT_EXPORT void std_init_io(state &gcs) {
+    new_cmd_quiet(gcs, "looplines", "vsb", [](auto &cs, auto args, auto &) {
+        io_file f{cs, args[1].get_string(cs)};
+        io_loop(cs, args[0].get_ident(cs), args[2].get_code(), [&f](
+            std::size_t &pos, std::string_view &rec
+        ) {
+            return io_next_line(f.data(), pos, rec);
+        });
+    });
+
+    new_cmd_quiet(gcs, "looprecords", "vssb", [](
+        auto &cs, auto args, auto &
+    ) {
+        io_file f{cs, args[1].get_string(cs)};
+        auto sep = io_get_sep(cs, args[2]);
+        io_loop(cs, args[0].get_ident(cs), args[3].get_code(), [&f, sep](
+            std::size_t &pos, std::string_view &rec
+        ) {
+            return io_next_record(f.data(), sep, pos, rec);
+        });
+    });
+
+    /* the same as list sources, which keep the file mapped while alive */
+
+    new_cmd_quiet(gcs, "filelines", "s", [](auto &cs, auto args, auto &res) {
+        res = cs.new_source([f = io_file{cs, args[0].get_string(cs)}](
+            auto &css, std::size_t &pos, auto &item
+        ) {
+            std::string_view line;
+            if (!io_next_line(f.data(), pos, line)) {
+                return false;
+            }
+            item.set_string(line, css);
+            return true;
+        });
+    });
+
+    new_cmd_quiet(gcs, "filerecords", "ss", [](
+        auto &cs, auto args, auto &res
+    ) {
+        string_ref sep{cs, io_get_sep(cs, args[1])};
+        res = cs.new_source([f = io_file{cs, args[0].get_string(cs)}, sep](
+            auto &css, std::size_t &pos, auto &item
+        ) {
+            std::string_view rec;
+            if (!io_next_record(f.data(), sep, pos, rec)) {
+                return false;
+            }
+            item.set_string(rec, css);
+            return true;
+        });
+    });
+}
+
+} /* namespace cubescript */
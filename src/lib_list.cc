@@ -1,9 +1,16 @@
+#include <algorithm>
+#include <cstring>
 #include <functional>
 #include <iterator>
+#include <system_error>
+#include <thread>
+#include <type_traits>
 
 #include <cubescript/cubescript.hh>
 #include "cs_std.hh"
+#include "cs_bcode.hh"
 #include "cs_parser.hh"
+#include "cs_strman.hh"
 #include "cs_thread.hh"
 
 namespace cubescript {
@@ -32,6 +39,72 @@ struct arg_val<std::string_view> {
     }
 };
 
+/* walks a list argument, parsing strings and pulling items from sources */
+struct list_walker {
+    list_walker(state &cs, any_value const &v):
+        p_cs{cs}, p_src{v}, p_parser{cs}, p_str{cs, ""}
+    {
+        if (v.type() != value_type::SOURCE) {
+            p_str = v.get_string(cs);
+            p_parser.set_input(p_str);
+        }
+    }
+
+    bool parse() {
+        if (p_src.type() != value_type::SOURCE) {
+            return p_parser.parse();
+        }
+        if (!p_src.next_item(p_cs, p_pos, p_item)) {
+            return false;
+        }
+        p_str = p_item.get_string(p_cs);
+        return true;
+    }
+
+    string_ref get_item() const {
+        if (p_src.type() != value_type::SOURCE) {
+            return p_parser.get_item();
+        }
+        return p_str;
+    }
+
+    std::string_view raw_item() const {
+        if (p_src.type() != value_type::SOURCE) {
+            return p_parser.raw_item();
+        }
+        return p_str;
+    }
+
+    void append_item(charbuf &buf) const {
+        if (p_src.type() != value_type::SOURCE) {
+            auto qi = p_parser.quoted_item();
+            if (!qi.empty() && (qi.front() == '"')) {
+                unescape_string(std::back_inserter(buf), p_parser.raw_item());
+            } else {
+                buf.append(p_parser.raw_item());
+            }
+        } else {
+            buf.append(p_str);
+        }
+    }
+
+    void append_quoted(charbuf &buf) const {
+        if (p_src.type() != value_type::SOURCE) {
+            buf.append(p_parser.quoted_item());
+        } else {
+            list_quote_item(buf, p_str);
+        }
+    }
+
+private:
+    state &p_cs;
+    any_value const &p_src;
+    list_parser p_parser;
+    string_ref p_str;
+    any_value p_item{};
+    std::size_t p_pos = 0;
+};
+
 template<typename T, typename F>
 static inline void list_find(
     state &cs, span_type<any_value> args, any_value &res, F cmp
@@ -73,14 +146,14 @@ static inline void list_assoc(
 }
 
 static void loop_list_conc(
-    state &cs, any_value &res, ident &id, std::string_view list,
+    state &cs, any_value &res, ident &id, any_value const &list,
     bcode_ref &&body, bool space
 ) {
     alias_local st{cs, id};
     any_value idv{};
     charbuf r{cs};
     int n = 0;
-    for (list_parser p{cs, list}; p.parse(); ++n) {
+    for (list_walker p{cs, list}; p.parse(); ++n) {
         idv.set_string(p.get_item());
         st.set(std::move(idv));
         if (n && space) {
@@ -141,10 +214,48 @@ static inline void list_merge(
 static void init_lib_list_sort(state &cs);
 
 LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
-    new_cmd_quiet(gcs, "listlen", "s", [](auto &cs, auto args, auto &res) {
-        res.set_integer(
-            integer_type(list_parser{cs, args[0].get_string(cs)}.count())
-        );
+    new_cmd_quiet(gcs, "listlen", "a", [](auto &cs, auto args, auto &res) {
+        integer_type n = 0;
+        for (list_walker p{cs, args[0]}; p.parse(); ++n);
+        res.set_integer(n);
+    });
+
+    new_cmd_quiet(gcs, "listrange", "iii#", [](
+        auto &cs, auto args, auto &res
+    ) {
+        integer_type start = args[0].get_integer();
+        integer_type end = args[1].get_integer();
+        integer_type step = (args[3].get_integer() >= 3)
+            ? args[2].get_integer() : 1;
+        if (!step) {
+            throw error{cs, "listrange step cannot be zero"};
+        }
+        /* the number of items is computed up front in unsigned arithmetic,
+         * so that ranges close to the integer limits cannot overflow
+         */
+        using uint_type = std::make_unsigned_t<integer_type>;
+        uint_type count = 0;
+        if ((step > 0) ? (start < end) : (start > end)) {
+            uint_type dist = (step > 0)
+                ? (uint_type(end) - uint_type(start))
+                : (uint_type(start) - uint_type(end));
+            uint_type ustep = (step > 0)
+                ? uint_type(step) : (uint_type(0) - uint_type(step));
+            count = dist / ustep + ((dist % ustep) ? 1 : 0);
+        }
+        /* the items are produced as they are iterated */
+        res = cs.new_source([start, step, count](
+            auto &, std::size_t &pos, auto &item
+        ) {
+            if (pos >= count) {
+                return false;
+            }
+            item.set_integer(integer_type(
+                uint_type(start) + uint_type(pos) * uint_type(step)
+            ));
+            ++pos;
+            return true;
+        });
     });
 
     new_cmd_quiet(gcs, "at", "si1...", [](auto &cs, auto args, auto &res) {
@@ -204,12 +315,12 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         res.set_string(make_str_view(list, qend), cs);
     });
 
-    new_cmd_quiet(gcs, "listfind", "vsb", [](auto &cs, auto args, auto &res) {
+    new_cmd_quiet(gcs, "listfind", "vab", [](auto &cs, auto args, auto &res) {
         alias_local st{cs, args[0]};
         any_value idv{};
         auto body = args[2].get_code();
         int n = -1;
-        for (list_parser p{cs, args[1].get_string(cs)}; p.parse();) {
+        for (list_walker p{cs, args[1]}; p.parse();) {
             ++n;
             idv.set_string(p.raw_item(), cs);
             st.set(std::move(idv));
@@ -221,12 +332,12 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         res.set_integer(-1);
     });
 
-    new_cmd_quiet(gcs, "listassoc", "vsb", [](auto &cs, auto args, auto &res) {
+    new_cmd_quiet(gcs, "listassoc", "vab", [](auto &cs, auto args, auto &res) {
         alias_local st{cs, args[0]};
         any_value idv{};
         auto body = args[2].get_code();
         int n = -1;
-        for (list_parser p{cs, args[1].get_string(cs)}; p.parse();) {
+        for (list_walker p{cs, args[1]}; p.parse();) {
             ++n;
             idv.set_string(p.raw_item(), cs);
             st.set(std::move(idv));
@@ -286,12 +397,12 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         );
     });
 
-    new_cmd_quiet(gcs, "looplist", "vsb", [](auto &cs, auto args, auto &) {
+    new_cmd_quiet(gcs, "looplist", "vab", [](auto &cs, auto args, auto &) {
         alias_local st{cs, args[0]};
         any_value idv{};
         auto body = args[2].get_code();
         int n = 0;
-        for (list_parser p{cs, args[1].get_string(cs)}; p.parse(); ++n) {
+        for (list_walker p{cs, args[1]}; p.parse(); ++n) {
             idv.set_string(p.get_item());
             st.set(std::move(idv));
             switch (body.call_loop(cs)) {
@@ -303,13 +414,13 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         }
     });
 
-    new_cmd_quiet(gcs, "looplist2", "vvsb", [](auto &cs, auto args, auto &) {
+    new_cmd_quiet(gcs, "looplist2", "vvab", [](auto &cs, auto args, auto &) {
         alias_local st1{cs, args[0]};
         alias_local st2{cs, args[1]};
         any_value idv{};
         auto body = args[3].get_code();
         int n = 0;
-        for (list_parser p{cs, args[2].get_string(cs)}; p.parse(); n += 2) {
+        for (list_walker p{cs, args[2]}; p.parse(); n += 2) {
             idv.set_string(p.get_item());
             st1.set(std::move(idv));
             if (p.parse()) {
@@ -327,14 +438,14 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         }
     });
 
-    new_cmd_quiet(gcs, "looplist3", "vvvsb", [](auto &cs, auto args, auto &) {
+    new_cmd_quiet(gcs, "looplist3", "vvvab", [](auto &cs, auto args, auto &) {
         alias_local st1{cs, args[0]};
         alias_local st2{cs, args[1]};
         alias_local st3{cs, args[2]};
         any_value idv{};
         auto body = args[4].get_code();
         int n = 0;
-        for (list_parser p{cs, args[3].get_string(cs)}; p.parse(); n += 3) {
+        for (list_walker p{cs, args[3]}; p.parse(); n += 3) {
             idv.set_string(p.get_item());
             st1.set(std::move(idv));
             if (p.parse()) {
@@ -358,25 +469,24 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         }
     });
 
-    new_cmd_quiet(gcs, "looplistconcat", "vsb", [](
+    new_cmd_quiet(gcs, "looplistconcat", "vab", [](
         auto &cs, auto args, auto &res
     ) {
         loop_list_conc(
-            cs, res, args[0].get_ident(cs), args[1].get_string(cs),
-            args[2].get_code(), true
+            cs, res, args[0].get_ident(cs), args[1], args[2].get_code(), true
         );
     });
 
-    new_cmd_quiet(gcs, "looplistconcatword", "vsb", [](
+    new_cmd_quiet(gcs, "looplistconcatword", "vab", [](
         auto &cs, auto args, auto &res
     ) {
         loop_list_conc(
-            cs, res, args[0].get_ident(cs), args[1].get_string(cs),
-            args[2].get_code(), false
+            cs, res, args[0].get_ident(cs), args[1], args[2].get_code(),
+            false
         );
     });
 
-    new_cmd_quiet(gcs, "listfilter", "vsb", [](
+    new_cmd_quiet(gcs, "listfilter", "vab", [](
         auto &cs, auto args, auto &res
     ) {
         alias_local st{cs, args[0]};
@@ -384,25 +494,25 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         auto body = args[2].get_code();
         charbuf r{cs};
         int n = 0;
-        for (list_parser p{cs, args[1].get_string(cs)}; p.parse(); ++n) {
+        for (list_walker p{cs, args[1]}; p.parse(); ++n) {
             idv.set_string(p.raw_item(), cs);
             st.set(std::move(idv));
             if (body.call(cs).get_bool()) {
                 if (r.size()) {
                     r.push_back(' ');
                 }
-                r.append(p.quoted_item());
+                p.append_quoted(r);
             }
         }
         res.set_string(r.str(), cs);
     });
 
-    new_cmd_quiet(gcs, "listcount", "vsb", [](auto &cs, auto args, auto &res) {
+    new_cmd_quiet(gcs, "listcount", "vab", [](auto &cs, auto args, auto &res) {
         alias_local st{cs, args[0]};
         any_value idv{};
         auto body = args[2].get_code();
         int n = 0, r = 0;
-        for (list_parser p{cs, args[1].get_string(cs)}; p.parse(); ++n) {
+        for (list_walker p{cs, args[1]}; p.parse(); ++n) {
             idv.set_string(p.raw_item(), cs);
             st.set(std::move(idv));
             if (body.call(cs).get_bool()) {
@@ -440,6 +550,25 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         res.set_string(buf.str(), cs);
     });
 
+    new_cmd_quiet(gcs, "strjoin", "as", [](auto &cs, auto args, auto &res) {
+        std::string_view sep = args[1].get_string(cs);
+        charbuf buf{cs};
+        /* items never grow when unescaped, so this is all the room needed */
+        if (args[0].type() != value_type::SOURCE) {
+            auto s = args[0].force_string(cs);
+            auto n = list_parser{cs, s}.count();
+            buf.reserve(s.size() + (n ? (n - 1) : 0) * sep.size());
+        }
+        std::size_t n = 0;
+        for (list_walker p{cs, args[0]}; p.parse(); ++n) {
+            if (n) {
+                buf.append(sep);
+            }
+            p.append_item(buf);
+        }
+        res.set_string(buf.str(), cs);
+    });
+
     new_cmd_quiet(gcs, "indexof", "ss", [](auto &cs, auto args, auto &res) {
         res.set_integer(
             list_includes(cs, args[0].get_string(cs), args[1].get_string(cs))
@@ -458,12 +587,12 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         list_merge<true, true>(cs, args, res, std::less<int>());
     });
 
-    new_cmd_quiet(gcs, "listsplice", "ssii", [](
+    new_cmd_inplace(gcs, "listsplice", "ssii", [](
         auto &cs, auto args, auto &res
     ) {
         integer_type offset = std::max(args[2].get_integer(), integer_type(0));
         integer_type len    = std::max(args[3].get_integer(), integer_type(0));
-        std::string_view s = args[0].get_string(cs);
+        std::string_view s = args[0].force_string(cs);
         std::string_view vals = args[1].get_string(cs);
         char const *list = s.data();
         list_parser p{cs, s};
@@ -474,35 +603,60 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         }
         std::string_view quote = p.quoted_item();
         char const *qend = !quote.empty() ? &quote[quote.size()] : list;
-        charbuf buf{cs};
-        if (qend > list) {
-            buf.append(list, qend);
-        }
-        if (!vals.empty()) {
-            if (!buf.empty()) {
-                buf.push_back(' ');
-            }
-            buf.append(vals);
-        }
+        /* the result is the head of the list, the values and the rest */
+        std::size_t head = std::size_t(qend - list);
         for (integer_type i = 0; i < len; ++i) {
             if (!p.parse()) {
                 break;
             }
         }
         p.skip_until_item();
+        std::string_view rest{};
         if (!p.input().empty()) {
             switch (p.input().front()) {
                 case ')':
                 case ']':
                     break;
                 default:
-                    if (!buf.empty()) {
-                        buf.push_back(' ');
-                    }
-                    buf.append(p.input());
+                    rest = p.input();
                     break;
             }
         }
+        bool vsep = head && !vals.empty();
+        bool rsep = (head || !vals.empty()) && !rest.empty();
+        std::size_t mid = vsep + vals.size() + rsep;
+        std::size_t nlen = head + mid + rest.size();
+        std::size_t roff = rest.empty() ? 0 : std::size_t(rest.data() - list);
+        auto slen = s.size();
+        if (auto *buf = str_take_unique(cs, args[0], std::max(slen, nlen))) {
+            /* move the rest into place first, then write the middle */
+            std::memmove(&buf[head + mid], &buf[roff], rest.size());
+            auto *wp = &buf[head];
+            if (vsep) {
+                *wp++ = ' ';
+            }
+            std::memcpy(wp, vals.data(), vals.size());
+            if (rsep) {
+                wp[vals.size()] = ' ';
+            }
+            auto *sp = state_p{cs}.ts().istate->strman;
+            buf = sp->reuse_buf(buf, nlen);
+            sp->steal_unique(buf, res);
+            return;
+        }
+        charbuf buf{cs};
+        buf.reserve(nlen);
+        buf.append(list, qend);
+        if (vsep) {
+            buf.push_back(' ');
+        }
+        buf.append(vals);
+        if (rsep) {
+            buf.push_back(' ');
+        }
+        if (!rest.empty()) {
+            buf.append(rest);
+        }
         res.set_string(buf.str(), cs);
     });
 
@@ -529,24 +683,348 @@ struct ListSortFun {
     }
 };
 
-static void list_sort(
-    state &cs, any_value &res, std::string_view list,
-    ident &x, ident &y, bcode_ref &&body, bcode_ref &&unique
+/* comparisons by builtin commands
+ *
+ * a body like [< $x $y] or [=s $x $y] is recognized from its bytecode and
+ * done without the VM, on keys converted from the items once; a stable
+ * sort is used, so that the result does not depend on how the work is
+ * split and large lists can be sorted on several threads
+ */
+
+enum {
+    SORT_CMP_NONE = 0, SORT_CMP_INT, SORT_CMP_FLOAT, SORT_CMP_STR
+};
+
+struct sort_cmp {
+    int type = SORT_CMP_NONE;
+    /* for sorting: whether the items go in descending order */
+    bool desc = false;
+};
+
+static sort_cmp sort_builtin_cmp(
+    state &cs, bcode_ref const &body, ident &x, ident &y, bool eq
 ) {
-    if (x == y) {
+    struct cmp_cmd {
+        char const *name;
+        int type;
+        bool desc;
+    };
+    static cmp_cmd const sort_cmds[] = {
+        {"<",  SORT_CMP_INT,   false}, {">",  SORT_CMP_INT,   true},
+        {"<f", SORT_CMP_FLOAT, false}, {">f", SORT_CMP_FLOAT, true},
+        {"<s", SORT_CMP_STR,   false}, {">s", SORT_CMP_STR,   true}
+    };
+    static cmp_cmd const eq_cmds[] = {
+        {"=", SORT_CMP_INT, false}, {"=s", SORT_CMP_STR, false}
+    };
+    static std::uint32_t const lookup_rets[] = {
+        0, BC_RET_INT, BC_RET_FLOAT, BC_RET_STRING
+    };
+    auto *bc = bcode_p{body}.get();
+    if (!bc) {
+        return sort_cmp{};
+    }
+    /* LOOKUP x, LOOKUP y, COM_V cmp 2, EXIT */
+    auto *code = bc->raw();
+    if (
+        ((code[0] & BC_INST_OP_MASK) != BC_INST_LOOKUP) ||
+        ((code[1] & BC_INST_OP_MASK) != BC_INST_LOOKUP) ||
+        ((code[2] & BC_INST_OP_MASK) != BC_INST_COM_V) || (code[3] != 2) ||
+        ((code[4] & BC_INST_OP_MASK) != BC_INST_EXIT) ||
+        (bcode_flags(bcode_start(code)) & BC_START_SHARED)
+    ) {
+        return sort_cmp{};
+    }
+    auto &idents = state_p{cs}.ts().istate->identmap;
+    auto *a = idents[code[0] >> 8], *b = idents[code[1] >> 8];
+    bool swapped;
+    if ((*a == x) && (*b == y)) {
+        swapped = false;
+    } else if ((*a == y) && (*b == x)) {
+        swapped = true;
+    } else {
+        return sort_cmp{};
+    }
+    auto name = idents[code[2] >> 8]->name();
+    auto cmds = eq ? span_type<cmp_cmd const>{eq_cmds} : span_type<
+        cmp_cmd const
+    >{sort_cmds};
+    for (auto &c: cmds) {
+        if (name != c.name) {
+            continue;
+        }
+        /* the lookups must convert like the command does */
+        auto ret = lookup_rets[c.type];
+        if (
+            ((code[0] & BC_INST_RET_MASK) != ret) ||
+            ((code[1] & BC_INST_RET_MASK) != ret)
+        ) {
+            break;
+        }
+        return sort_cmp{c.type, (c.desc != swapped)};
+    }
+    return sort_cmp{};
+}
+
+/* not worth the threads below this many items */
+static constexpr std::size_t SORT_PAR_MIN = 1 << 16;
+static constexpr std::size_t SORT_MAX_THREADS = 8;
+
+static std::size_t sort_threads(std::size_t n) {
+    if (n < SORT_PAR_MIN) {
+        return 1;
+    }
+    std::size_t nthr = std::thread::hardware_concurrency();
+    nthr = std::min({nthr, SORT_MAX_THREADS, n / (SORT_PAR_MIN / 4)});
+    return std::max(nthr, std::size_t(1));
+}
+
+/* run f(0) to f(ntasks - 1), each on its own thread but the first; if a
+ * thread cannot be started, the task is run right away instead
+ */
+template<typename F>
+static void sort_par_run(std::size_t ntasks, F &f) {
+    std::thread thrs[SORT_MAX_THREADS];
+    std::size_t nthr = 0;
+    for (std::size_t i = 1; i < ntasks; ++i) {
+        try {
+            thrs[nthr] = std::thread{std::ref(f), i};
+            ++nthr;
+        } catch (std::system_error const &) {
+            f(i);
+        }
+    }
+    f(0);
+    for (std::size_t i = 0; i < nthr; ++i) {
+        thrs[i].join();
+    }
+}
+
+/* stable sort of chunks on threads, then rounds of stable merges */
+template<typename T, typename C>
+static void sort_stable(state &cs, T *data, std::size_t n, C cmp) {
+    auto nthr = sort_threads(n);
+    if (nthr <= 1) {
+        std::stable_sort(data, data + n, cmp);
         return;
     }
+    std::size_t bounds[SORT_MAX_THREADS + 1];
+    for (std::size_t i = 0; i <= nthr; ++i) {
+        bounds[i] = n * i / nthr;
+    }
+    auto sort_chunk = [&](std::size_t i) {
+        std::stable_sort(data + bounds[i], data + bounds[i + 1], cmp);
+    };
+    sort_par_run(nthr, sort_chunk);
+    valbuf<T> tmp{state_p{cs}.ts().istate};
+    tmp.resize(n);
+    T *src = data, *dst = tmp.data();
+    for (std::size_t nch = nthr; nch > 1; nch = (nch + 1) / 2) {
+        auto merge_pair = [&](std::size_t i) {
+            auto lo = bounds[2 * i];
+            if ((2 * i + 1) >= nch) {
+                /* odd one out */
+                std::copy(src + lo, src + bounds[nch], dst + lo);
+                return;
+            }
+            auto mid = bounds[2 * i + 1];
+            auto hi = bounds[std::min(2 * i + 2, nch)];
+            std::merge(
+                src + lo, src + mid, src + mid, src + hi, dst + lo, cmp
+            );
+        };
+        auto nnew = (nch + 1) / 2;
+        sort_par_run(nnew, merge_pair);
+        auto end = bounds[nch];
+        for (std::size_t i = 0; i < nnew; ++i) {
+            bounds[i] = bounds[2 * i];
+        }
+        bounds[nnew] = end;
+        std::swap(src, dst);
+    }
+    if (src != data) {
+        std::copy(src, src + n, data);
+    }
+}
 
-    alias_local xst{cs, x}, yst{cs, y};
+template<typename K>
+struct sort_entry {
+    K key;
+    std::size_t idx;
+};
 
-    valbuf<ListSortItem> items{state_p{cs}.ts().istate};
-    size_t total = 0;
+template<typename K>
+static K sort_get_key(std::string_view s);
+
+template<>
+integer_type sort_get_key<integer_type>(std::string_view s) {
+    return parse_int(s);
+}
+
+template<>
+float_type sort_get_key<float_type>(std::string_view s) {
+    return parse_float(s);
+}
+
+template<>
+std::string_view sort_get_key<std::string_view>(std::string_view s) {
+    return s;
+}
 
+/* sort and/or drop duplicates by keys; the items are reordered in place
+ * and duplicates get their quote cleared like in the generic path
+ */
+template<typename K>
+static void list_sort_entries(
+    state &cs, valbuf<ListSortItem> &items, valbuf<sort_entry<K>> &ents,
+    sort_cmp cmp, bool sort, bool unique,
+    std::size_t &totaluniq, std::size_t &nuniq
+) {
+    auto n = items.size();
+    if (cmp.desc) {
+        sort_stable(cs, ents.data(), n, [](auto const &a, auto const &b) {
+            return a.key > b.key;
+        });
+    } else {
+        sort_stable(cs, ents.data(), n, [](auto const &a, auto const &b) {
+            return a.key < b.key;
+        });
+    }
+    if (sort) {
+        valbuf<ListSortItem> sorted{state_p{cs}.ts().istate};
+        sorted.reserve(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            sorted.push_back(items[ents[i].idx]);
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            items[i] = sorted[i];
+            ents[i].idx = i;
+        }
+    }
+    if (!unique) {
+        return;
+    }
+    /* every run of equal keys keeps its first item, which comes first
+     * in the list too since the sort was stable
+     */
+    totaluniq = 0;
+    nuniq = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        auto &item = items[ents[i].idx];
+        if (i && (ents[i].key == ents[i - 1].key)) {
+            item.quote = std::string_view{};
+        } else {
+            totaluniq += item.quote.size();
+            ++nuniq;
+        }
+    }
+}
+
+template<typename K>
+static void list_sort_keys(
+    state &cs, valbuf<ListSortItem> &items, sort_cmp cmp, bool sort,
+    bool unique, std::size_t &totaluniq, std::size_t &nuniq
+) {
+    auto n = items.size();
+    valbuf<sort_entry<K>> ents{state_p{cs}.ts().istate};
+    ents.resize(n);
+    auto nthr = sort_threads(n);
+    auto make_keys = [&](std::size_t t) {
+        for (auto i = n * t / nthr; i < (n * (t + 1) / nthr); ++i) {
+            ents[i] = sort_entry<K>{sort_get_key<K>(items[i].str), i};
+        }
+    };
+    sort_par_run(nthr, make_keys);
+    list_sort_entries(cs, items, ents, cmp, sort, unique, totaluniq, nuniq);
+}
+
+static bool list_sort_builtin(
+    state &cs, valbuf<ListSortItem> &items, ident &x, ident &y,
+    bcode_ref const &body, bcode_ref const &unique,
+    std::size_t &totaluniq, std::size_t &nuniq
+) {
+    bool sort = !!body;
+    bool uniq = !unique.empty();
+    sort_cmp cmp, ucmp;
+    if (sort) {
+        cmp = sort_builtin_cmp(cs, body, x, y, false);
+        if (!cmp.type) {
+            return false;
+        }
+    }
+    if (uniq) {
+        ucmp = sort_builtin_cmp(cs, unique, x, y, true);
+        /* after sorting, duplicates are found by the sort keys */
+        if (!ucmp.type || (sort && (ucmp.type != cmp.type))) {
+            return false;
+        }
+        if (!sort) {
+            cmp = ucmp;
+        }
+    }
+    switch (cmp.type) {
+        case SORT_CMP_INT:
+            list_sort_keys<integer_type>(
+                cs, items, cmp, sort, uniq, totaluniq, nuniq
+            );
+            break;
+        case SORT_CMP_FLOAT:
+            list_sort_keys<float_type>(
+                cs, items, cmp, sort, uniq, totaluniq, nuniq
+            );
+            break;
+        default:
+            list_sort_keys<std::string_view>(
+                cs, items, cmp, sort, uniq, totaluniq, nuniq
+            );
+            break;
+    }
+    return true;
+}
+
+static std::size_t list_sort_parse(
+    state &cs, std::string_view list, valbuf<ListSortItem> &items
+) {
+    std::size_t total = 0;
     for (list_parser p{cs, list}; p.parse();) {
         ListSortItem item = { p.raw_item(), p.quoted_item() };
         items.push_back(item);
         total += item.quote.size();
     }
+    return total;
+}
+
+static void list_sort_join(
+    state &cs, any_value &res, valbuf<ListSortItem> &items,
+    std::size_t totaluniq, std::size_t nuniq
+) {
+    charbuf sorted{cs};
+    sorted.reserve(totaluniq + std::max(nuniq - 1, size_t(0)));
+    for (size_t i = 0; i < items.size(); ++i) {
+        ListSortItem &item = items[i];
+        if (item.quote.empty()) {
+            continue;
+        }
+        if (i) {
+            sorted.push_back(' ');
+        }
+        sorted.append(item.quote);
+    }
+    res.set_string(sorted.str(), cs);
+}
+
+static void list_sort(
+    state &cs, any_value &res, std::string_view list,
+    ident &x, ident &y, bcode_ref &&body, bcode_ref &&unique
+) {
+    if (x == y) {
+        return;
+    }
+
+    alias_local xst{cs, x}, yst{cs, y};
+
+    valbuf<ListSortItem> items{state_p{cs}.ts().istate};
+    size_t total = list_sort_parse(cs, list, items);
 
     if (items.empty()) {
         res.set_string(list, cs);
@@ -555,7 +1033,9 @@ static void list_sort(
 
     size_t totaluniq = total;
     size_t nuniq = items.size();
-    if (body) {
+    if (list_sort_builtin(cs, items, x, y, body, unique, totaluniq, nuniq)) {
+        /* sorted and deduplicated without the VM */
+    } else if (body) {
         ListSortFun f = { cs, xst, yst, &body };
         std::sort(items.buf.begin(), items.buf.end(), f);
         if (!unique.empty()) {
@@ -592,19 +1072,101 @@ static void list_sort(
         }
     }
 
-    charbuf sorted{cs};
-    sorted.reserve(totaluniq + std::max(nuniq - 1, size_t(0)));
-    for (size_t i = 0; i < items.size(); ++i) {
-        ListSortItem &item = items[i];
-        if (item.quote.empty()) {
-            continue;
+    list_sort_join(cs, res, items, totaluniq, nuniq);
+}
+
+/* the type a string key compares as: a number if all of it is one, so
+ * that keys taken out of list items, which are strings, sort like numbers
+ */
+static int sort_key_type(std::string_view str) {
+    if (str.empty()) {
+        return SORT_CMP_STR;
+    }
+    std::string_view end;
+    parse_int(str, &end);
+    if (end.empty()) {
+        return SORT_CMP_INT;
+    }
+    parse_float(str, &end);
+    if (end.empty()) {
+        return SORT_CMP_FLOAT;
+    }
+    return SORT_CMP_STR;
+}
+
+/* sort by keys computed once per item (a schwartzian transform); the
+ * keys are compared as integers if all of them are integers, as floats
+ * if all of them are numbers and as strings otherwise, where a string
+ * that is a number counts as one
+ */
+static void list_sort_by(
+    state &cs, any_value &res, std::string_view list,
+    ident &x, bcode_ref &&body, bool desc
+) {
+    alias_local xst{cs, x};
+
+    valbuf<ListSortItem> items{state_p{cs}.ts().istate};
+    size_t total = list_sort_parse(cs, list, items);
+
+    if (items.empty()) {
+        res.set_string(list, cs);
+        return;
+    }
+
+    auto n = items.size();
+    valbuf<any_value> keys{state_p{cs}.ts().istate};
+    keys.reserve(n);
+    int type = SORT_CMP_INT;
+    for (size_t i = 0; i < n; ++i) {
+        any_value v{};
+        v.set_string(items[i].str, cs);
+        xst.set(std::move(v));
+        keys.push_back(body.call(cs));
+        int ktype;
+        switch (keys[i].type()) {
+            case value_type::INTEGER:
+                ktype = SORT_CMP_INT;
+                break;
+            case value_type::FLOAT:
+                ktype = SORT_CMP_FLOAT;
+                break;
+            case value_type::STRING:
+                ktype = sort_key_type(keys[i].force_string(cs));
+                break;
+            default:
+                ktype = SORT_CMP_STR;
+                break;
         }
-        if (i) {
-            sorted.push_back(' ');
+        /* integers, then floats, then strings take over */
+        type = std::max(type, ktype);
+    }
+
+    sort_cmp cmp{type, desc};
+    size_t totaluniq = total, nuniq = n;
+    auto sort_by = [&](auto get) {
+        using K = decltype(get(keys[0]));
+        valbuf<sort_entry<K>> ents{state_p{cs}.ts().istate};
+        ents.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            ents.push_back(sort_entry<K>{get(keys[i]), i});
         }
-        sorted.append(item.quote);
+        list_sort_entries(
+            cs, items, ents, cmp, true, false, totaluniq, nuniq
+        );
+    };
+    switch (type) {
+        case SORT_CMP_INT:
+            sort_by([](any_value &v) { return v.get_integer(); });
+            break;
+        case SORT_CMP_FLOAT:
+            sort_by([](any_value &v) { return v.get_float(); });
+            break;
+        default:
+            sort_by([&cs](any_value &v) { return v.force_string(cs); });
+            break;
     }
-    res.set_string(sorted.str(), cs);
+
+    list_sort_join(cs, res, items, totaluniq, nuniq);
 }
 
 static void init_lib_list_sort(state &gcs) {
@@ -624,6 +1186,14 @@ static void init_lib_list_sort(state &gcs) {
             args[2].get_ident(cs), bcode_ref{}, args[3].get_code()
         );
     });
+    new_cmd_quiet(gcs, "sortlistby", "svbi", [](
+        auto &cs, auto args, auto &res
+    ) {
+        list_sort_by(
+            cs, res, args[0].get_string(cs), args[1].get_ident(cs),
+            args[2].get_code(), (args[3].get_integer() != 0)
+        );
+    });
 }
 
 } /* namespace cubescript */
@@ -7,6 +7,8 @@
 #include <cubescript/cubescript.hh>
 
 #include "cs_state.hh"
+#include "cs_parser.hh"
+#include "cs_error.hh"
 
 namespace cubescript {
 
@@ -75,6 +77,132 @@ static inline void cmp_op(span_type<any_value> args, any_value &res, F cmp) {
     res.set_integer(integer_type(val));
 }
 
+/* vectors are computed on all 4 lanes at once, with the unused lanes zero;
+ * where available, the compiler maps the lanes onto its SIMD registers
+ */
+
+#if defined(__GNUC__)
+using vec_lanes = float_type __attribute__((
+    vector_size(4 * sizeof(float_type))
+));
+#else
+struct vec_lanes {
+    float_type l[4];
+
+    float_type &operator[](std::size_t i) {
+        return l[i];
+    }
+    float_type operator[](std::size_t i) const {
+        return l[i];
+    }
+};
+
+template<typename F>
+static inline vec_lanes vec_map(vec_lanes a, vec_lanes b, F f) {
+    return vec_lanes{f(a[0], b[0]), f(a[1], b[1]), f(a[2], b[2]), f(a[3], b[3])};
+}
+
+static inline vec_lanes operator+(vec_lanes a, vec_lanes b) {
+    return vec_map(a, b, std::plus<float_type>{});
+}
+static inline vec_lanes operator-(vec_lanes a, vec_lanes b) {
+    return vec_map(a, b, std::minus<float_type>{});
+}
+static inline vec_lanes operator*(vec_lanes a, vec_lanes b) {
+    return vec_map(a, b, std::multiplies<float_type>{});
+}
+#endif
+
+struct vec_val {
+    vec_lanes v;
+    std::size_t n;
+};
+
+static inline vec_lanes vec_splat(float_type f, std::size_t n) {
+    vec_lanes r{};
+    for (std::size_t i = 0; i < n; ++i) {
+        r[i] = f;
+    }
+    return r;
+}
+
+static std::size_t vec_parse(std::string_view s, float_type *comps) {
+    std::size_t n = 0;
+    while (!s.empty() && (n < 4)) {
+        std::string_view end;
+        auto f = parse_float(s, &end);
+        if (end.size() == s.size()) {
+            break;
+        }
+        comps[n++] = f;
+        s = end;
+    }
+    return n;
+}
+
+/* anything that reads as a list of numbers works as a vector, and a single
+ * number as a scalar
+ */
+static vec_val vec_get(state &cs, any_value const &arg) {
+    float_type comps[4] = {};
+    std::size_t n = 0;
+    switch (arg.type()) {
+        case value_type::VECTOR:
+            n = arg.get_vector(comps);
+            break;
+        case value_type::INTEGER:
+        case value_type::FLOAT:
+            comps[n++] = arg.get_float();
+            break;
+        case value_type::STRING:
+        case value_type::SOURCE:
+            n = vec_parse(arg.get_string(cs), comps);
+            break;
+        default:
+            break;
+    }
+    return vec_val{vec_lanes{comps[0], comps[1], comps[2], comps[3]}, n};
+}
+
+static void vec_set(state &cs, any_value &res, vec_lanes v, std::size_t n) {
+    float_type comps[4] = {v[0], v[1], v[2], v[3]};
+    res.set_vector(span_type<float_type const>{comps, n}, cs);
+}
+
+/* scalars apply to every component of the other vector */
+static std::size_t vec_pair(state &cs, vec_val &a, vec_val &b) {
+    if (a.n == b.n) {
+        return a.n;
+    }
+    if (a.n == 1) {
+        a.v = vec_splat(a.v[0], b.n);
+        return b.n;
+    }
+    if (b.n == 1) {
+        b.v = vec_splat(b.v[0], a.n);
+        return a.n;
+    }
+    throw error_p::make(
+        cs, "cannot combine vectors of %d and %d components",
+        int(a.n), int(b.n)
+    );
+}
+
+static inline float_type vec_dot(vec_lanes a, vec_lanes b) {
+    auto m = a * b;
+    return (m[0] + m[1]) + (m[2] + m[3]);
+}
+
+template<typename F>
+static inline void vec_op(
+    state &cs, span_type<any_value> args, any_value &res, F op
+) {
+    auto a = vec_get(cs, args[0]);
+    auto b = vec_get(cs, args[1]);
+    auto n = vec_pair(cs, a, b);
+    vec_set(cs, res, op(a.v, b.v), n);
+}
+
 LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
     new_cmd_quiet(cs, "sin", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::sin(args[0].get_float() * RAD));
@@ -365,6 +493,95 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
     new_cmd_quiet(cs, ">=f", "f1...", [](auto &, auto args, auto &res) {
         cmp_op<float_type>(args, res, std::greater_equal<float_type>());
     });
+
+    new_cmd_quiet(cs, "vec", "...", [](auto &ccs, auto args, auto &res) {
+        float_type comps[4];
+        std::size_t n = 0;
+        for (auto &arg: args) {
+            auto v = vec_get(ccs, arg);
+            for (std::size_t i = 0; (i < v.n) && (n < 4); ++i) {
+                comps[n++] = v.v[i];
+            }
+        }
+        res.set_vector(span_type<float_type const>{comps, n}, ccs);
+    });
+    new_cmd_quiet(cs, "vget", "ai", [](auto &ccs, auto args, auto &res) {
+        auto v = vec_get(ccs, args[0]);
+        auto i = args[1].get_integer();
+        res.set_float(
+            ((i >= 0) && (std::size_t(i) < v.n)) ? v.v[i] : float_type(0)
+        );
+    });
+
+    new_cmd_quiet(cs, "vadd", "aa", [](auto &ccs, auto args, auto &res) {
+        vec_op(ccs, args, res, [](vec_lanes a, vec_lanes b) {
+            return a + b;
+        });
+    });
+    new_cmd_quiet(cs, "vsub", "aa", [](auto &ccs, auto args, auto &res) {
+        vec_op(ccs, args, res, [](vec_lanes a, vec_lanes b) {
+            return a - b;
+        });
+    });
+    new_cmd_quiet(cs, "vmul", "aa", [](auto &ccs, auto args, auto &res) {
+        vec_op(ccs, args, res, [](vec_lanes a, vec_lanes b) {
+            return a * b;
+        });
+    });
+    new_cmd_quiet(cs, "vdiv", "aa", [](auto &ccs, auto args, auto &res) {
+        /* like divf, a zero divisor gives zero, which keeps unused lanes */
+        vec_op(ccs, args, res, [](vec_lanes a, vec_lanes b) {
+            vec_lanes r{};
+            for (std::size_t i = 0; i < 4; ++i) {
+                r[i] = b[i] ? (a[i] / b[i]) : float_type(0);
+            }
+            return r;
+        });
+    });
+
+    new_cmd_quiet(cs, "vdot", "aa", [](auto &ccs, auto args, auto &res) {
+        auto a = vec_get(ccs, args[0]);
+        auto b = vec_get(ccs, args[1]);
+        vec_pair(ccs, a, b);
+        res.set_float(vec_dot(a.v, b.v));
+    });
+    new_cmd_quiet(cs, "vcross", "aa", [](auto &ccs, auto args, auto &res) {
+        auto a = vec_get(ccs, args[0]);
+        auto b = vec_get(ccs, args[1]);
+        if ((a.n != 3) || (b.n != 3)) {
+            throw error{ccs, "vcross needs vectors of 3 components"};
+        }
+        auto &x = a.v, &y = b.v;
+        vec_lanes x1{x[1], x[2], x[0], 0}, y1{y[2], y[0], y[1], 0};
+        vec_lanes x2{x[2], x[0], x[1], 0}, y2{y[1], y[2], y[0], 0};
+        vec_set(ccs, res, x1 * y1 - x2 * y2, 3);
+    });
+    new_cmd_quiet(cs, "vlen", "a", [](auto &ccs, auto args, auto &res) {
+        auto a = vec_get(ccs, args[0]);
+        res.set_float(std::sqrt(vec_dot(a.v, a.v)));
+    });
+    new_cmd_quiet(cs, "vdist", "aa", [](auto &ccs, auto args, auto &res) {
+        auto a = vec_get(ccs, args[0]);
+        auto b = vec_get(ccs, args[1]);
+        vec_pair(ccs, a, b);
+        auto d = a.v - b.v;
+        res.set_float(std::sqrt(vec_dot(d, d)));
+    });
+    new_cmd_quiet(cs, "vnorm", "a", [](auto &ccs, auto args, auto &res) {
+        auto a = vec_get(ccs, args[0]);
+        auto len = std::sqrt(vec_dot(a.v, a.v));
+        if (len > 0) {
+            a.v = a.v * vec_splat(1 / len, 4);
+        }
+        vec_set(ccs, res, a.v, a.n);
+    });
+    new_cmd_quiet(cs, "vlerp", "aaf", [](auto &ccs, auto args, auto &res) {
+        auto a = vec_get(ccs, args[0]);
+        auto b = vec_get(ccs, args[1]);
+        auto n = vec_pair(ccs, a, b);
+        auto t = vec_splat(args[2].get_float(), 4);
+        vec_set(ccs, res, a.v + (b.v - a.v) * t, n);
+    });
 }
 
 } /* namespace cubescript */
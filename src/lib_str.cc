@@ -1,10 +1,15 @@
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <iterator>
 
 #include <cubescript/cubescript.hh>
 
 #include "cs_std.hh"
+#include "cs_parser.hh"
+#include "cs_regex.hh"
 #include "cs_strman.hh"
 #include "cs_thread.hh"
 
@@ -29,6 +34,171 @@ static inline void str_cmp_by(
     res.set_integer(integer_type(val));
 }
 
+/* a = (concat $a ...): append to the first string if it is only ours */
+static void str_concat(
+    state &cs, span_type<any_value> args, any_value &res,
+    std::string_view sep
+) {
+    if (args.size() > 1) {
+        auto olen = args[0].force_string(cs).size();
+        if (auto *buf = str_take_unique(cs, args[0], olen)) {
+            charbuf tail{cs};
+            for (std::size_t i = 1; i < args.size(); ++i) {
+                tail.append(sep);
+                switch (args[i].type()) {
+                    case value_type::INTEGER:
+                    case value_type::FLOAT:
+                    case value_type::STRING:
+                    case value_type::SOURCE:
+                    case value_type::VECTOR: {
+                        auto val = any_value{args[i]};
+                        tail.append(val.force_string(cs));
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+            auto *sp = state_p{cs}.ts().istate->strman;
+            buf = sp->reuse_buf(buf, olen + tail.size());
+            std::memcpy(&buf[olen], tail.data(), tail.size());
+            sp->steal_unique(buf, res);
+            return;
+        }
+    }
+    res.set_string(concat_values(cs, args, sep));
+}
+
+/* finds the bytes of a delimiter set; a single byte is left to memchr, while
+ * small sets are compared against 16 bytes at a time where the compiler has
+ * vector extensions, and anything else goes through a table
+ */
+struct str_delims {
+    static constexpr std::size_t SIMD_MAX = 4;
+
+    str_delims(std::string_view set): p_set{set} {
+        for (auto c: set) {
+            auto uc = static_cast<unsigned char>(c);
+            p_bits[uc >> 5] |= (1u << (uc & 31));
+        }
+#if defined(__GNUC__)
+        for (std::size_t i = 0; i < std::min(set.size(), SIMD_MAX); ++i) {
+            for (std::size_t j = 0; j < sizeof(chunk); ++j) {
+                p_splat[i][j] = static_cast<unsigned char>(set[i]);
+            }
+        }
+#endif
+    }
+
+    bool has(char c) const {
+        auto uc = static_cast<unsigned char>(c);
+        return p_bits[uc >> 5] & (1u << (uc & 31));
+    }
+
+    std::size_t find(std::string_view s, std::size_t pos) const {
+        if (p_set.size() == 1) {
+            auto *p = static_cast<char const *>(
+                std::memchr(s.data() + pos, p_set[0], s.size() - pos)
+            );
+            return p ? std::size_t(p - s.data()) : s.npos;
+        }
+#if defined(__GNUC__)
+        if (p_set.size() <= SIMD_MAX) {
+            for (; (pos + sizeof(chunk)) <= s.size(); pos += sizeof(chunk)) {
+                chunk c;
+                std::memcpy(&c, s.data() + pos, sizeof(c));
+                auto m = (c == p_splat[0]);
+                for (std::size_t i = 1; i < p_set.size(); ++i) {
+                    m |= (c == p_splat[i]);
+                }
+                std::uint64_t w[2];
+                static_assert(sizeof(w) == sizeof(m));
+                std::memcpy(w, &m, sizeof(w));
+                if (w[0] | w[1]) {
+                    break;
+                }
+            }
+        }
+#endif
+        for (; pos < s.size(); ++pos) {
+            if (has(s[pos])) {
+                return pos;
+            }
+        }
+        return s.npos;
+    }
+
+    /* every byte is an item of its own with an empty set */
+    template<typename F>
+    void split(std::string_view s, F f) const {
+        if (p_set.empty()) {
+            for (std::size_t i = 0; i < s.size(); ++i) {
+                f(s.substr(i, 1));
+            }
+            return;
+        }
+        std::size_t last = 0;
+        for (auto pos = find(s, 0); pos != s.npos; pos = find(s, pos + 1)) {
+            f(s.substr(last, pos - last));
+            last = pos + 1;
+        }
+        f(s.substr(last));
+    }
+
+private:
+#if defined(__GNUC__)
+    using chunk = unsigned char __attribute__((vector_size(16)));
+    chunk p_splat[SIMD_MAX];
+#endif
+    std::string_view p_set;
+    std::uint32_t p_bits[8] = {};
+};
+
+/* matches against a cached pattern, with room for its captures */
+struct regex_run {
+    regex_run(state &cs, any_value &pat):
+        re{regex_get(cs, pat)}, caps{state_p{cs}.ts().istate}
+    {
+        caps.resize(re.slots());
+    }
+
+    bool match(std::string_view s, std::size_t start, bool full = false) {
+        return re.match(s, start, full, caps.data());
+    }
+
+    std::string_view group(std::string_view s, std::size_t n) const {
+        if (((n * 2 + 1) >= caps.size()) || (caps[n * 2] < 0)) {
+            return std::string_view{};
+        }
+        auto beg = std::size_t(caps[n * 2]);
+        return s.substr(beg, std::size_t(caps[n * 2 + 1]) - beg);
+    }
+
+    regex &re;
+    valbuf<std::ptrdiff_t> caps;
+};
+
+/* \0 to \9 in the replacement refer to the groups, \\ is a backslash */
+static void regex_expand(
+    charbuf &buf, regex_run const &rr, std::string_view s,
+    std::string_view repl
+) {
+    for (std::size_t i = 0; i < repl.size(); ++i) {
+        char c = repl[i];
+        if ((c == '\\') && ((i + 1) < repl.size())) {
+            char n = repl[i + 1];
+            if ((n >= '0') && (n <= '9')) {
+                buf.append(rr.group(s, std::size_t(n - '0')));
+                ++i;
+                continue;
+            } else if (n == '\\') {
+                ++i;
+            }
+        }
+        buf.push_back(c);
+    }
+}
+
 LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
     new_cmd_quiet(cs, "strstr", "ss", [](auto &ccs, auto args, auto &res) {
         std::string_view a = args[0].get_string(ccs);
@@ -92,12 +262,14 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         res.set_string(s.str(), ccs);
     });
 
-    new_cmd_quiet(cs, "concat", "...", [](auto &ccs, auto args, auto &res) {
-        res.set_string(concat_values(ccs, args, " "));
+    new_cmd_inplace(cs, "concat", "...", [](auto &ccs, auto args, auto &res) {
+        str_concat(ccs, args, res, " ");
     });
 
-    new_cmd_quiet(cs, "concatword", "...", [](auto &ccs, auto args, auto &res) {
-        res.set_string(concat_values(ccs, args));
+    new_cmd_inplace(cs, "concatword", "...", [](
+        auto &ccs, auto args, auto &res
+    ) {
+        str_concat(ccs, args, res, "");
     });
 
     new_cmd_quiet(cs, "format", "...", [](auto &ccs, auto args, auto &res) {
@@ -109,10 +281,8 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         std::string_view f{fs};
         for (auto it = f.begin(); it != f.end(); ++it) {
             char c = *it;
-            ++it;
-            if ((c == '%') && (it != f.end())) {
-                char ic = *it;
-                ++it;
+            if ((c == '%') && ((it + 1) != f.end())) {
+                char ic = *++it;
                 if ((ic >= '1') && (ic <= '9')) {
                     int i = ic - '0';
                     if (std::size_t(i) < args.size()) {
@@ -189,48 +359,84 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         str_cmp_by(ccs, args, res, std::greater_equal<std::string_view>());
     });
 
-    new_cmd_quiet(cs, "strreplace", "ssss", [](
+    new_cmd_inplace(cs, "strreplace", "ssss", [](
         auto &ccs, auto args, auto &res
     ) {
-        std::string_view s = args[0].get_string(ccs);
+        std::string_view s = args[0].force_string(ccs);
         std::string_view oldval = args[1].get_string(ccs),
                          newval = args[2].get_string(ccs),
                          newval2 = args[3].get_string(ccs);
         if (newval2.empty()) {
             newval2 = newval;
         }
-        if (oldval.empty()) {
-            res.set_string(s, ccs);
+        auto p = oldval.empty() ? s.npos : s.find(oldval);
+        if (p == s.npos) {
+            res = std::move(args[0]);
             return;
         }
+        /* replacements that do not grow the string can be done in place */
+        if (
+            (newval.size() <= oldval.size()) &&
+            (newval2.size() <= oldval.size())
+        ) {
+            auto slen = s.size();
+            if (auto *buf = str_take_unique(ccs, args[0], slen)) {
+                std::size_t rd = 0, wr = 0;
+                for (std::size_t i = 0; p != std::string_view::npos; ++i) {
+                    auto nv = (i & 1) ? newval2 : newval;
+                    std::memmove(&buf[wr], &buf[rd], p - rd);
+                    wr += p - rd;
+                    std::memcpy(&buf[wr], nv.data(), nv.size());
+                    wr += nv.size();
+                    rd = p + oldval.size();
+                    p = std::string_view{buf, slen}.find(oldval, rd);
+                }
+                std::memmove(&buf[wr], &buf[rd], slen - rd);
+                auto *sp = state_p{ccs}.ts().istate->strman;
+                buf = sp->reuse_buf(buf, wr + slen - rd);
+                sp->steal_unique(buf, res);
+                return;
+            }
+        }
         charbuf buf{ccs};
         for (size_t i = 0;; ++i) {
-            auto p = s.find(oldval);
+            buf.append(s.substr(0, p));
+            buf.append((i & 1) ? newval2 : newval);
+            s = s.substr(p + oldval.size());
+            p = s.find(oldval);
             if (p == s.npos) {
                 buf.append(s);
-                res.set_string(s, ccs);
+                res.set_string(buf.str(), ccs);
                 return;
             }
-            buf.append(s.substr(0, p));
-            buf.append((i & 1) ? newval2 : newval);
-            buf.append(s.substr(
-                p + oldval.size(),
-                s.size() - p - oldval.size()
-            ));
         }
     });
 
-    new_cmd_quiet(cs, "strsplice", "ssii", [](
+    new_cmd_inplace(cs, "strsplice", "ssii", [](
         auto &ccs, auto args, auto &res
     ) {
-        std::string_view s = args[0].get_string(ccs);
+        std::string_view s = args[0].force_string(ccs);
         std::string_view vals = args[1].get_string(ccs);
         integer_type skip  = args[2].get_integer(),
               count  = args[3].get_integer();
         integer_type offset = std::clamp(skip, integer_type(0), integer_type(s.size())),
               len     = std::clamp(count, integer_type(0), integer_type(s.size()) - offset);
+        auto slen = s.size(), soff = std::size_t(offset);
+        auto nlen = slen - std::size_t(len) + vals.size();
+        if (auto *buf = str_take_unique(ccs, args[0], std::max(slen, nlen))) {
+            /* move the rest into place first, then write the middle */
+            auto rest = soff + std::size_t(len);
+            std::memmove(
+                &buf[soff + vals.size()], &buf[rest], slen - rest
+            );
+            std::memcpy(&buf[soff], vals.data(), vals.size());
+            auto *sp = state_p{ccs}.ts().istate->strman;
+            buf = sp->reuse_buf(buf, nlen);
+            sp->steal_unique(buf, res);
+            return;
+        }
         charbuf p{ccs};
-        p.reserve(s.size() - len + vals.size());
+        p.reserve(nlen);
         if (offset) {
             p.append(s.substr(0, offset));
         }
@@ -240,6 +446,120 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         }
         res.set_string(p.str(), ccs);
     });
+
+    new_cmd_quiet(cs, "regexmatch", "ss", [](auto &ccs, auto args, auto &res) {
+        regex_run rr{ccs, args[1]};
+        bool m = rr.match(args[0].get_string(ccs), 0, true);
+        res.set_integer(integer_type(m));
+    });
+
+    new_cmd_quiet(cs, "regexsearch", "ss", [](
+        auto &ccs, auto args, auto &res
+    ) {
+        regex_run rr{ccs, args[1]};
+        if (!rr.match(args[0].get_string(ccs), 0)) {
+            res.set_integer(-1);
+            return;
+        }
+        res.set_integer(integer_type(rr.caps[0]));
+    });
+
+    new_cmd_quiet(cs, "regexgroups", "ss", [](
+        auto &ccs, auto args, auto &res
+    ) {
+        regex_run rr{ccs, args[1]};
+        std::string_view s = args[0].get_string(ccs);
+        charbuf buf{ccs};
+        if (rr.match(s, 0)) {
+            for (std::size_t i = 0; i < (rr.caps.size() / 2); ++i) {
+                if (i) {
+                    buf.push_back(' ');
+                }
+                list_quote_item(buf, rr.group(s, i));
+            }
+        }
+        res.set_string(buf.str(), ccs);
+    });
+
+    new_cmd_quiet(cs, "regexreplace", "sss", [](
+        auto &ccs, auto args, auto &res
+    ) {
+        regex_run rr{ccs, args[1]};
+        std::string_view s = args[0].get_string(ccs);
+        std::string_view repl = args[2].get_string(ccs);
+        charbuf buf{ccs};
+        std::size_t last = 0;
+        for (std::size_t pos = 0; (pos <= s.size()) && rr.match(s, pos);) {
+            auto mbeg = std::size_t(rr.caps[0]);
+            auto mend = std::size_t(rr.caps[1]);
+            buf.append(s.substr(last, mbeg - last));
+            regex_expand(buf, rr, s, repl);
+            last = mend;
+            /* an empty match must not be found again */
+            pos = (mend == mbeg) ? (mend + 1) : mend;
+        }
+        if (!last && buf.empty()) {
+            res = std::move(args[0]);
+            return;
+        }
+        buf.append(s.substr(last));
+        res.set_string(buf.str(), ccs);
+    });
+
+    new_cmd_quiet(cs, "regexsplit", "ss", [](
+        auto &ccs, auto args, auto &res
+    ) {
+        regex_run rr{ccs, args[1]};
+        std::string_view s = args[0].get_string(ccs);
+        if (s.empty()) {
+            res.set_string("", ccs);
+            return;
+        }
+        charbuf buf{ccs};
+        std::size_t last = 0;
+        for (std::size_t pos = 0; (pos <= s.size()) && rr.match(s, pos);) {
+            auto mbeg = std::size_t(rr.caps[0]);
+            auto mend = std::size_t(rr.caps[1]);
+            if (mend == mbeg) {
+                pos = mend + 1;
+                /* nothing to split right after a separator or at the end */
+                if ((mbeg == last) || (mbeg == s.size())) {
+                    continue;
+                }
+            } else {
+                pos = mend;
+            }
+            list_quote_item(buf, s.substr(last, mbeg - last));
+            buf.push_back(' ');
+            last = mend;
+        }
+        list_quote_item(buf, s.substr(last));
+        res.set_string(buf.str(), ccs);
+    });
+
+    new_cmd_quiet(cs, "strsplit", "ss", [](auto &ccs, auto args, auto &res) {
+        std::string_view s = args[0].get_string(ccs);
+        str_delims dl{args[1].get_string(ccs)};
+        if (s.empty()) {
+            res.set_string("", ccs);
+            return;
+        }
+        /* size the list exactly first, so that it is written in place */
+        std::size_t len = 0;
+        dl.split(s, [&len](std::string_view item) {
+            len += list_quote_size(item) + 1;
+        });
+        auto *ics = state_p{ccs}.ts().istate;
+        auto *buf = ics->strman->alloc_buf(len - 1);
+        auto *p = buf;
+        dl.split(s, [&p, buf](std::string_view item) {
+            if (p != buf) {
+                *p++ = ' ';
+            }
+            p = list_quote_item(p, item);
+        });
+        res.set_string(ics->strman->steal(buf));
+    });
 }
 
 } /* namespace cubescript */
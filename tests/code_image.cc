@@ -0,0 +1,115 @@
+/* images of shared bytecode, in memory and mapped from files */
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+static int ncalls = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static void setup(cs::state &cs, char const *args) {
+    cs::std_init_all(cs);
+    cs.new_command("hostcmd", args, [](auto &, auto cargs, auto &res) {
+        ++ncalls;
+        res.set_integer(cargs[0].get_integer() * 2);
+    });
+}
+
+static cs::integer_type run(cs::state &cs, cs::bcode_ref const &code) {
+    return code.call(cs).get_integer();
+}
+
+static char const *script =
+    "double = [* $arg1 2]; result (+ (double 5) (hostcmd 6))";
+
+int main() {
+    cs::state gcs;
+    setup(gcs, "i");
+    auto code = gcs.compile_shared(script);
+
+    /* images round-trip in memory and through a mapped file */
+    auto size = gcs.code_image(code, nullptr, 0);
+    check(size > 0, "image size");
+    std::vector<std::uint32_t> buf((size + 3) / 4);
+    check(gcs.code_image(code, buf.data(), size) == size, "image written");
+    {
+        cs::state other;
+        setup(other, "i");
+        auto loaded = other.load_code_image(buf.data(), size);
+        check(run(other, loaded) == 22, "image loaded in place");
+        check(
+            other.code_image(loaded, nullptr, 0) == size,
+            "loaded image is still shared"
+        );
+    }
+    char const *path = "shared_code.img";
+    if (auto *f = std::fopen(path, "wb"); f) {
+        std::fwrite(buf.data(), 1, size, f);
+        std::fclose(f);
+    }
+    {
+        cs::state other;
+        setup(other, "i");
+        auto mapped = other.map_code_image(path);
+        check(run(other, mapped) == 22, "image mapped from a file");
+    }
+    std::remove(path);
+
+    /* truncated or garbage images are rejected */
+    {
+        cs::state other;
+        setup(other, "i");
+        bool threw = false;
+        try {
+            other.load_code_image(buf.data(), size - 4);
+        } catch (cs::error const &) {
+            threw = true;
+        }
+        check(threw, "truncated image rejected");
+        std::uint32_t junk[4] = {1, 2, 3, 4};
+        threw = false;
+        try {
+            other.load_code_image(junk, sizeof(junk));
+        } catch (cs::error const &) {
+            threw = true;
+        }
+        check(threw, "garbage image rejected");
+    }
+
+    /* a command with another argument list does not resolve */
+    {
+        cs::state other;
+        setup(other, "s");
+        auto ocalls = ncalls;
+        bool threw = false;
+        try {
+            run(other, other.load_code_image(buf.data(), size));
+        } catch (cs::error const &) {
+            threw = true;
+        }
+        check(threw, "mismatched command signature rejected");
+        check(ncalls == ocalls, "nothing run with a mismatched command");
+    }
+
+    /* code of a state is not shared */
+    bool threw = false;
+    try {
+        gcs.code_image(gcs.compile(script), nullptr, 0);
+    } catch (cs::error const &) {
+        threw = true;
+    }
+    check(threw, "image of unshared code rejected");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+/* alias code kept when the same body is assigned again */
+
+#include <cstdio>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static cs::alias &alias_of(cs::state &cs, char const *name) {
+    return static_cast<cs::alias &>(cs.get_ident(name)->get());
+}
+
+/* code kept and compiled on call by running some code */
+struct delta {
+    std::size_t kept, misses;
+};
+
+static delta run(cs::state &cs, char const *code) {
+    auto st = cs.stats();
+    cs.compile(code).call(cs);
+    auto st2 = cs.stats();
+    return delta{
+        st2.code_kept - st.code_kept, st2.code_misses - st.code_misses
+    };
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    /* the same string body keeps the code, and the next call has it */
+    auto d = run(gcs, "f = [result 1]; f");
+    check(d.kept == 0 && d.misses == 1, "first call compiles");
+    d = run(gcs, "f = [result 1]");
+    check(d.kept == 1, "same body keeps the code");
+    d = run(gcs, "f");
+    check(d.misses == 0, "no compile after the same body");
+    d = run(gcs, "loop i 5 [f = [result 1]; f]");
+    check(d.kept == 5 && d.misses == 0, "redefining in a loop");
+
+    /* a different body drops it */
+    d = run(gcs, "f = [result 2]");
+    check(d.kept == 0, "different body not kept");
+    d = run(gcs, "f");
+    check(d.misses == 1, "different body compiled on call");
+    check(
+        gcs.compile("f").call(gcs).get_integer() == 2,
+        "different body runs"
+    );
+
+    /* the same for arguments, within an alias */
+    gcs.compile(
+        "h = [arg1 = [result 5]; a = (arg1); arg1 = [result 5]; "
+        "b = (arg1); arg1 = [result 7]; + $a $b (arg1)]"
+    ).call(gcs);
+    d = run(gcs, "h [result 5]");
+    /* h itself, the first (arg1) and the one after the new body */
+    check(d.kept == 1 && d.misses == 3, "argument with the same body");
+    check(
+        gcs.compile("h [result 5]").call(gcs).get_integer() == 17,
+        "argument results"
+    );
+
+    /* code values keep it if they are the same block */
+    gcs.compile("alias c [result 3]").call(gcs);
+    auto code = gcs.compile("result 4");
+    auto other = gcs.compile("result 4");
+    cs::any_value cv;
+    cv.set_code(code);
+    alias_of(gcs, "c").set_value(gcs, cv);
+    d = run(gcs, "c");
+    check(d.misses == 1, "code value compiled on call");
+    auto kept = gcs.stats().code_kept;
+    alias_of(gcs, "c").set_value(gcs, cv);
+    d = run(gcs, "c");
+    check(
+        gcs.stats().code_kept == kept + 1 && d.misses == 0,
+        "same code value keeps the code"
+    );
+    cv.set_code(other);
+    kept = gcs.stats().code_kept;
+    alias_of(gcs, "c").set_value(gcs, cv);
+    d = run(gcs, "c");
+    check(
+        gcs.stats().code_kept == kept && d.misses == 1,
+        "different code value drops the code"
+    );
+
+    /* a code value replacing a string body drops it */
+    gcs.compile("c = [result 3]; c").call(gcs);
+    alias_of(gcs, "c").set_value(gcs, cv);
+    d = run(gcs, "c");
+    check(d.misses == 1, "code value replacing a string");
+
+    return failures ? 1 : 0;
+}
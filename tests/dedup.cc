@@ -0,0 +1,96 @@
+/* deduplication of compiled code */
+
+#include <cstdio>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+/* repeated blocks, with inlined blocks (if, while) and jumps around them,
+ * as removing the duplicates moves the code that follows them
+ */
+static char const *script =
+    "x = 0; y = 0\n"
+    "loop i 2 [x = (+ $x 1)]\n"
+    "if (> $x 1) [y = 5] [y = 6]\n"
+    "loop i 2 [x = (+ $x 1)]\n"
+    "while [< $x 10] [x = (+ $x 1)]\n"
+    "loop j 2 [loop i 2 [x = (+ $x 1)]; if (> $x 0) [y = (+ $y 1)]]\n"
+    "loop j 2 [loop i 2 [x = (+ $x 1)]; if (> $x 0) [y = (+ $y 1)]]\n"
+    "result (+ (* $x 100) $y)";
+
+static constexpr cs::integer_type expected = 18 * 100 + 9;
+
+static cs::integer_type run(cs::state &cs, char const *code) {
+    return cs.compile(code).call(cs).get_integer();
+}
+
+int main() {
+    cs::state plain;
+    cs::std_init_all(plain);
+    check(run(plain, script) == expected, "result without deduplication");
+    check(plain.stats().code_dedups == 0, "nothing deduplicated when off");
+
+    cs::state gcs;
+    cs::std_init_all(gcs);
+    check(!gcs.dedup_code(true), "deduplication off by default");
+    auto st = gcs.stats();
+    check(run(gcs, script) == expected, "result with deduplication");
+    auto st2 = gcs.stats();
+    /* the copies of the first loop body (the second loop, the while and
+     * the first outer loop) and the whole second outer loop
+     */
+    auto ndups = st2.code_dedups - st.code_dedups;
+    check(ndups == 4, "duplicate blocks removed");
+
+    /* the same code compiled again is the same bytecode */
+    {
+        auto c1 = gcs.compile(script);
+        auto st3 = gcs.stats();
+        auto c2 = gcs.compile(script);
+        auto st4 = gcs.stats();
+        /* the blocks are deduplicated first, then the whole code */
+        check(
+            st4.code_dedups - st3.code_dedups == ndups + 1,
+            "whole compile reused"
+        );
+        check(c1.call(gcs).get_integer() == expected, "first code result");
+        check(st4.code_bytes == st3.code_bytes, "no new code allocated");
+        check(c2.call(gcs).get_integer() == expected, "reused code result");
+    }
+    /* pooled code goes away with its last reference */
+    check(run(gcs, script) == expected, "recompiled after release");
+
+    /* alias bodies and shared code deduplicate the same way */
+    gcs.compile(
+        "f = [loop i 3 [z = (+ $z 1)]; loop i 3 [z = (+ $z 1)]]"
+    ).call(gcs);
+    st = gcs.stats();
+    check(run(gcs, "z = 0; f; result $z") == 6, "alias body result");
+    check(gcs.stats().code_dedups - st.code_dedups == 1, "alias body");
+    check(
+        gcs.compile_shared(script).call(gcs).get_integer() == expected,
+        "shared code result"
+    );
+
+    /* turning it off clears the pool */
+    gcs.dedup_code(false);
+    {
+        auto c1 = gcs.compile("result 5");
+        st = gcs.stats();
+        auto c2 = gcs.compile("result 5");
+        check(gcs.stats().code_dedups == st.code_dedups, "off again");
+        check(c2.call(gcs).get_integer() == 5, "result when off again");
+    }
+
+    return failures ? 1 : 0;
+}
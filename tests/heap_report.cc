@@ -0,0 +1,117 @@
+/* heap report of strings and bytecode */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static std::string read_file(char const *path) {
+    std::string ret;
+    FILE *f = std::fopen(path, "rb");
+    if (!f) {
+        return ret;
+    }
+    char buf[512];
+    std::size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f))) {
+        ret.append(buf, n);
+    }
+    std::fclose(f);
+    return ret;
+}
+
+/* the lines starting with the keyword */
+static std::size_t count_lines(std::string const &rep, char const *kw) {
+    std::size_t n = 0, len = std::strlen(kw);
+    for (std::size_t i = 0; i < rep.size();) {
+        auto end = rep.find('\n', i);
+        if (end == std::string::npos) {
+            end = rep.size();
+        }
+        if (
+            (end - i > len) && !rep.compare(i, len, kw) && (rep[i + len] == ' ')
+        ) {
+            ++n;
+        }
+        i = end + 1;
+    }
+    return n;
+}
+
+/* the line containing str, or an empty string */
+static std::string line_of(std::string const &rep, char const *str) {
+    auto pos = rep.find(str);
+    if (pos == std::string::npos) {
+        return std::string{};
+    }
+    auto beg = rep.rfind('\n', pos);
+    beg = (beg == std::string::npos) ? 0 : (beg + 1);
+    return rep.substr(beg, rep.find('\n', pos) - beg);
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+    gcs.compile(
+        "big = [loop i 10 [x = (+ $x $i)]; result (> $x 5)]\n"
+        "small = [result 1]\n"
+        "x = 0; big; small\n"
+        "long = \"\"; loop i 8 [long = (concatword $long abcdefghijklmnop)]\n"
+        "copy = $long\n"
+    ).call(gcs);
+
+    char const *path = "heap_report.txt";
+    gcs.heap_report(path, 1);
+    auto rep = read_file(path);
+    check(!rep.compare(0, 5, "heap "), "report header");
+    check(count_lines(rep, "strings") == 1, "strings line");
+    check(count_lines(rep, "string_bucket") > 0, "string buckets");
+    check(count_lines(rep, "string_size") == 1, "largest strings");
+    check(count_lines(rep, "string_refs") == 1, "most referenced strings");
+    check(count_lines(rep, "code") == 1, "code line");
+    check(count_lines(rep, "code_bucket") > 0, "code buckets");
+    check(count_lines(rep, "code_other") == 1, "other code line");
+    /* only the top alias is listed, which is the larger one */
+    check(count_lines(rep, "code_alias") == 1, "top aliases");
+    check(
+        !line_of(rep, "\"big\"").compare(0, 11, "code_alias ") &&
+        line_of(rep, "\"small\"").empty(),
+        "largest alias listed"
+    );
+    /* strings are cut short, and listed with their references */
+    auto sline = line_of(rep, "\"abcdefghijklmnopabcdefghijklmnop\"");
+    check(
+        !sline.compare(0, 12, "string_size ") &&
+        (sline.find(" 2 \"") != std::string::npos),
+        "largest string listed"
+    );
+
+    /* both aliases with a larger limit */
+    gcs.heap_report(path);
+    rep = read_file(path);
+    check(count_lines(rep, "code_alias") == 2, "all aliases");
+    check(rep.find("\"small\"") != std::string::npos, "smaller alias listed");
+    std::remove(path);
+
+    bool thrown = false;
+    try {
+        gcs.heap_report("nonexistent-dir/heap_report.txt");
+    } catch (cs::error const &) {
+        thrown = true;
+    }
+    check(thrown, "unwritable path raises an error");
+
+    return failures ? 1 : 0;
+}
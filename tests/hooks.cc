@@ -0,0 +1,162 @@
+/* debug hooks: the event mask, count hooks and hooks changing hooks */
+
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static bool is(cs::ident *id, std::string_view name) {
+    return id && (id->name() == name);
+}
+
+static unsigned int bit(cs::hook_event ev) {
+    return 1u << unsigned(ev);
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+    gcs.compile("alias f [result 1]").call(gcs);
+
+    /* the mask follows the hooks that are set */
+    check(gcs.hook_mask() == 0, "no hooks by default");
+    gcs.debug_hook(cs::hook_event::CALL, [](auto &, auto *) {});
+    gcs.debug_hook(cs::hook_event::COUNT, [](auto &, auto *) {});
+    check(
+        gcs.hook_mask() ==
+            (bit(cs::hook_event::CALL) | bit(cs::hook_event::COUNT)),
+        "mask with call and count hooks"
+    );
+    auto old = gcs.debug_hook(cs::hook_event::CALL, nullptr);
+    check(bool(old), "previous hook returned");
+    gcs.debug_hook(cs::hook_event::COUNT, nullptr);
+    check(gcs.hook_mask() == 0, "mask after removing hooks");
+    check(!gcs.debug_hook(cs::hook_event::CALL), "removed hook is empty");
+
+    /* calls and returns are seen for aliases and commands */
+    int calls = 0, rets = 0, cmds = 0;
+    gcs.debug_hook(cs::hook_event::CALL, [&](auto &, auto *id) {
+        calls += is(id, "f");
+        cmds += is(id, "strlen");
+    });
+    gcs.debug_hook(cs::hook_event::RETURN, [&](auto &, auto *id) {
+        rets += is(id, "f");
+    });
+    gcs.compile("f; f; strlen abc; strlen d").call(gcs);
+    check(calls == 2, "call hook");
+    check(rets == 2, "return hook");
+    check(cmds == 2, "call hook for commands");
+    gcs.debug_hook(cs::hook_event::CALL, nullptr);
+    gcs.debug_hook(cs::hook_event::RETURN, nullptr);
+
+    /* the count hook runs every n instructions */
+    int counts = 0;
+    gcs.debug_hook(cs::hook_event::COUNT, [&](auto &, auto *) {
+        ++counts;
+    });
+    check(gcs.hook_count(0) == 1000, "default count");
+    check(gcs.hook_count(10) == 1, "zero count taken as one");
+    gcs.compile("loop i 100 [x = $i]").call(gcs);
+    int by10 = counts;
+    counts = 0;
+    gcs.hook_count(1);
+    gcs.compile("loop i 100 [x = $i]").call(gcs);
+    check(by10 >= 30, "count hook every 10 instructions");
+    check(
+        (counts >= by10 * 10) && (counts < (by10 + 1) * 10),
+        "count hook every instruction"
+    );
+    /* the innermost alias is passed */
+    bool in_alias = false;
+    gcs.debug_hook(cs::hook_event::COUNT, [&](auto &, auto *id) {
+        in_alias = in_alias || is(id, "f");
+    });
+    gcs.compile("f").call(gcs);
+    check(in_alias, "count hook in alias");
+    gcs.debug_hook(cs::hook_event::COUNT, nullptr);
+
+    /* a hook removing itself runs once */
+    calls = 0;
+    gcs.debug_hook(cs::hook_event::CALL, [&](auto &s, auto *) {
+        ++calls;
+        s.debug_hook(cs::hook_event::CALL, nullptr);
+    });
+    gcs.compile("f; f; f").call(gcs);
+    check(calls == 1, "self removing hook");
+    check(gcs.hook_mask() == 0, "mask after self removal");
+
+    /* a hook replacing itself, the new one runs from the next event */
+    int first = 0, second = 0;
+    gcs.debug_hook(cs::hook_event::CALL, [&](auto &s, auto *) {
+        ++first;
+        s.debug_hook(cs::hook_event::CALL, [&](auto &, auto *id) {
+            second += is(id, "f");
+        });
+    });
+    gcs.compile("f; f; f").call(gcs);
+    check(first == 1, "replaced hook runs once");
+    check(second == 2, "replacement hook");
+    gcs.debug_hook(cs::hook_event::CALL, nullptr);
+
+    /* a hook with a large capture setting the hook of another event is
+     * kept, and the other hook runs from then on
+     */
+    char big[128];
+    std::memset(big, 0, sizeof(big));
+    calls = rets = 0;
+    gcs.debug_hook(cs::hook_event::CALL, [&calls, &rets, big](
+        auto &s, auto *id
+    ) {
+        if (!is(id, "f")) {
+            return;
+        }
+        calls += 1 + big[0];
+        if (!s.debug_hook(cs::hook_event::RETURN)) {
+            s.debug_hook(cs::hook_event::RETURN, [&rets](auto &, auto *rid) {
+                rets += is(rid, "f");
+            });
+        }
+    });
+    gcs.compile("f; f; f").call(gcs);
+    check(calls == 3, "hook setting another event kept");
+    check(rets == 3, "hook set by another hook");
+    check(
+        gcs.hook_mask() ==
+            (bit(cs::hook_event::CALL) | bit(cs::hook_event::RETURN)),
+        "mask after setting another event"
+    );
+    gcs.debug_hook(cs::hook_event::CALL, nullptr);
+    gcs.debug_hook(cs::hook_event::RETURN, nullptr);
+
+    /* a throwing hook stops the script and stays set */
+    calls = 0;
+    gcs.debug_hook(cs::hook_event::CALL, [&](auto &s, auto *id) {
+        if (is(id, "f") && (++calls == 2)) {
+            throw cs::error{s, "stopped"};
+        }
+    });
+    bool stopped = false;
+    try {
+        gcs.compile("f; f; f").call(gcs);
+    } catch (cs::error const &e) {
+        stopped = (e.what() == std::string_view{"stopped"});
+    }
+    check(stopped && (calls == 2), "throwing hook stops the script");
+    check(bool(gcs.debug_hook(cs::hook_event::CALL)), "throwing hook kept");
+    gcs.compile("f").call(gcs);
+    check(calls == 3, "throwing hook runs again");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+/* posting code to a thread, from it and from other OS threads */
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static constexpr int nproducers = 4;
+static constexpr int nposts = 2000;
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+    std::string log;
+    gcs.new_command("log", "s", [&log](auto &css, auto args, auto &) {
+        log += args[0].get_string(css);
+        log += ' ';
+    });
+    gcs.new_command("fail", "", [](auto &css, auto, auto &) {
+        throw cs::error{css, "posted failure"};
+    });
+    gcs.new_command("repost", "", [](auto &css, auto, auto &) {
+        css.post("log late");
+    });
+
+    /* nothing runs until run_posted, then everything runs in order */
+    std::string_view two[] = {"x", "y"};
+    std::string_view one[] = {"z"};
+    gcs.post("log first");
+    gcs.post("log (concatword $arg1 $arg2 $numargs)", two);
+    gcs.post("log $arg1; log $arg2", one);
+    check(log.empty(), "nothing run before run_posted");
+    check(gcs.run_posted() == 3, "number of items run");
+    check(log == "first xy2 z  ", "order and arguments");
+    check(gcs.run_posted() == 0, "queue emptied");
+
+    /* shared bytecode can be posted, other code cannot */
+    log.clear();
+    auto shared = gcs.compile_shared("log (concatword shared $arg1)");
+    check(gcs.post(shared, one), "shared code posted");
+    check(!gcs.post(gcs.compile("log unshared")), "unshared code rejected");
+    check(gcs.run_posted() == 1, "only the shared code was posted");
+    check(log == "sharedz ", "shared code with arguments");
+
+    /* an error leaves the items after it queued, before newer ones */
+    log.clear();
+    gcs.post("log a");
+    gcs.post("fail");
+    gcs.post("log c");
+    bool threw = false;
+    try {
+        gcs.run_posted();
+    } catch (cs::error const &) {
+        threw = true;
+    }
+    check(threw, "error propagated");
+    check(log == "a ", "items before the error run");
+    gcs.post("log d");
+    check(gcs.run_posted() == 2, "left over items run next time");
+    check(log == "a c d ", "left over items run first");
+
+    /* what is posted while running is left for the next call */
+    log.clear();
+    gcs.post("repost");
+    check(gcs.run_posted() == 1, "item posted while running is left");
+    check(log.empty(), "item posted while running not run");
+    check(gcs.run_posted() == 1, "item posted while running runs later");
+    check(log == "late ", "item posted while running");
+
+    /* several producers posting while the thread runs the items; every
+     * producer's items run in the order it posted them
+     */
+    std::vector<int> next(nproducers, 0);
+    bool ordered = true;
+    gcs.new_command("count", "ii", [&next, &ordered](
+        auto &, auto args, auto &
+    ) {
+        auto p = args[0].get_integer();
+        if (args[1].get_integer() != next[std::size_t(p)]++) {
+            ordered = false;
+        }
+    });
+    auto counted = gcs.compile_shared("count $arg1 $arg2");
+    std::vector<std::thread> producers;
+    for (int p = 0; p < nproducers; ++p) {
+        producers.emplace_back([&gcs, &counted, p]() {
+            auto ps = std::to_string(p);
+            for (int i = 0; i < nposts; ++i) {
+                auto is = std::to_string(i);
+                std::string_view args[] = {ps, is};
+                /* half of the producers post source, half bytecode */
+                if (p % 2) {
+                    gcs.post(counted, args);
+                } else {
+                    gcs.post("count $arg1 $arg2", args);
+                }
+            }
+        });
+    }
+    std::size_t total = 0;
+    while (total < std::size_t(nproducers * nposts)) {
+        total += gcs.run_posted();
+    }
+    for (auto &t: producers) {
+        t.join();
+    }
+    total += gcs.run_posted();
+    check(total == std::size_t(nproducers * nposts), "all items run once");
+    check(ordered, "items of every producer in order");
+    for (auto n: next) {
+        check(n == nposts, "items of every producer run");
+    }
+
+    return failures ? 1 : 0;
+}
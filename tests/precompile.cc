@@ -0,0 +1,96 @@
+/* compiling aliases ahead of time */
+
+#include <cstdio>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static cs::alias &alias_of(cs::state &cs, char const *name) {
+    return static_cast<cs::alias &>(cs.get_ident(name)->get());
+}
+
+/* a config with ten good aliases and one that does not compile */
+static char const *config =
+    "loop i 10 [alias (concatword a $i) [result (+ $arg1 1)]]\n"
+    "alias bad \"result (+ 1 2\"\n";
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+    check(gcs.precompile_aliases() == 0, "nothing to compile at first");
+    gcs.compile(config).call(gcs);
+
+    /* everything is compiled after a config load, and called without
+     * compiling again
+     */
+    check(gcs.precompile_aliases() == 10, "all good aliases compiled");
+    check(gcs.precompile_aliases() == 0, "nothing left to compile");
+    auto st = gcs.stats();
+    for (int i = 0; i < 10; ++i) {
+        char code[32];
+        std::snprintf(code, sizeof(code), "a%d 41", i);
+        check(
+            gcs.compile(code).call(gcs).get_integer() == 42,
+            "precompiled alias result"
+        );
+    }
+    auto st2 = gcs.stats();
+    check(st2.code_misses == st.code_misses, "no compiles on first call");
+    check(st2.code_hits - st.code_hits == 10, "first calls hit the code");
+
+    /* the alias that does not compile is skipped, and fails when called */
+    bool thrown = false;
+    try {
+        gcs.compile("bad").call(gcs);
+    } catch (cs::error const &) {
+        thrown = true;
+    }
+    check(thrown, "skipped alias raises its error when called");
+
+    /* assigning a new value discards the code */
+    gcs.compile("a3 = [result (* $arg1 2)]").call(gcs);
+    check(gcs.precompile_aliases() == 1, "reassigned alias compiled again");
+    st = gcs.stats();
+    check(gcs.compile("a3 21").call(gcs).get_integer() == 42, "new body");
+    check(gcs.stats().code_misses == st.code_misses, "new body precompiled");
+
+    /* a budget spreads the work over calls, resuming where it stopped */
+    cs::state bcs;
+    cs::std_init_all(bcs);
+    bcs.compile(config).call(bcs);
+    check(bcs.precompile_aliases(4) == 4, "first budgeted run");
+    check(bcs.precompile_aliases(4) == 4, "second budgeted run");
+    check(bcs.precompile_aliases(4) == 2, "last budgeted run");
+    check(bcs.precompile_aliases(4) == 0, "budgeted runs are done");
+    st = bcs.stats();
+    bcs.compile("a0 1; a5 1; a9 1").call(bcs);
+    check(bcs.stats().code_misses == st.code_misses, "budgeted runs cover all");
+
+    /* a single alias, with or without a value */
+    cs::state acs;
+    cs::std_init_all(acs);
+    acs.compile(config).call(acs);
+    acs.compile("alias empty").call(acs);
+    check(alias_of(acs, "a1").compile(acs), "alias compiled");
+    check(!alias_of(acs, "empty").compile(acs), "alias without a value");
+    thrown = false;
+    try {
+        alias_of(acs, "bad").compile(acs);
+    } catch (cs::error const &) {
+        thrown = true;
+    }
+    check(thrown, "alias compile raises its error");
+    check(acs.precompile_aliases() == 9, "compiled alias not compiled again");
+
+    return failures ? 1 : 0;
+}
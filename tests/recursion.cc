@@ -0,0 +1,58 @@
+/* deep alias recursion, growing the alias and call stacks a lot */
+
+#include <cstdio>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static cs::integer_type eval(cs::state &cs, char const *code) {
+    return cs.compile(code).call(cs).get_integer();
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+    /* two VM frames per level: the alias and the block of the if; the
+     * depth is kept low enough for the native stack of the test
+     */
+    gcs.max_call_depth(4000);
+
+    /* arguments and locals are pushed at every level, and still read after
+     * the deeper levels made the stacks grow
+     */
+    gcs.compile(
+        "sum = [if (> $arg1 0) [local t; t = $arg1; "
+        "result (+ (sum (- $arg1 1) $arg2) $t $arg2)] [result 0]]"
+    ).call(gcs);
+    check(eval(gcs, "sum 1000 1") == 1000 * 1001 / 2 + 1000, "deep sum");
+    check(eval(gcs, "sum 1000 1") == 1000 * 1001 / 2 + 1000, "repeated");
+
+    /* the args of the outermost level are intact after the recursion */
+    gcs.compile(
+        "outer = [sum 1000 0; result $arg1]"
+    ).call(gcs);
+    check(eval(gcs, "outer 42") == 42, "outer args after recursion");
+
+    /* going over the limit is an error, after which the state works */
+    gcs.max_call_depth(500);
+    bool threw = false;
+    try {
+        eval(gcs, "sum 1000 1");
+    } catch (cs::error const &) {
+        threw = true;
+    }
+    check(threw, "call depth limit");
+    check(eval(gcs, "sum 100 0") == 5050, "usable after the limit");
+
+    return failures ? 1 : 0;
+}
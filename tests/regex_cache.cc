@@ -0,0 +1,62 @@
+/* the cache of compiled regular expressions */
+
+#include <cstdio>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static cs::integer_type eval(cs::state &cs, char const *code) {
+    return cs.compile(code).call(cs).get_integer();
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    /* the same pattern in a loop is compiled once */
+    auto st = gcs.stats();
+    check(eval(gcs,
+        "n = 0; loop i 1000 ["
+        "if (regexmatch (concatword x $i) [x\\d+]) [n = (+ $n 1)]"
+        "]; result $n"
+    ) == 1000, "matches in a loop");
+    auto st2 = gcs.stats();
+    check(st2.regex_misses - st.regex_misses == 1, "compiled once");
+    check(st2.regex_hits - st.regex_hits == 999, "found in the cache");
+
+    /* patterns are looked up by contents, not by where they come from */
+    eval(gcs,
+        "loop i 100 [regexmatch abc (concatword [a] [.] [c])]"
+    );
+    auto st3 = gcs.stats();
+    check(st3.regex_misses - st2.regex_misses == 1, "built pattern cached");
+
+    /* more patterns than fit in the cache evict each other */
+    eval(gcs, "loop j 2 [loop i 32 [regexmatch a (concatword a $i)]]");
+    auto st4 = gcs.stats();
+    check(st4.regex_misses - st3.regex_misses == 64, "evicted patterns");
+
+    /* invalid patterns are not cached */
+    for (int i = 0; i < 2; ++i) {
+        bool threw = false;
+        try {
+            eval(gcs, "regexmatch a [(a]");
+        } catch (cs::error const &) {
+            threw = true;
+        }
+        check(threw, "invalid pattern rejected");
+    }
+    check(gcs.stats().regex_misses - st4.regex_misses == 2, "no errors cached");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,71 @@
+/* recording a workload and replaying it in a fresh state */
+
+#include <cstdio>
+#include <string_view>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static cs::integer_type eval(cs::state &cs, char const *code) {
+    return cs.compile(code).call(cs).get_integer();
+}
+
+int main() {
+    char const *path = "replay.log";
+    int ncalls = 0;
+    {
+        cs::state gcs;
+        cs::std_init_all(gcs);
+        gcs.new_var("hostvar", cs::integer_type(5));
+        gcs.new_command("hostcmd", "i", [&ncalls](
+            auto &, auto args, auto &res
+        ) {
+            ++ncalls;
+            res.set_integer(args[0].get_integer() + 100);
+        });
+        gcs.record(path);
+        gcs.compile("total = (+ (hostcmd 1) $hostvar)").call(gcs);
+        gcs.assign_value("greeting", cs::any_value{"hi", gcs});
+        gcs.compile("total = (+ $total (hostcmd 2))").call(gcs);
+        gcs.stop_recording();
+        check(ncalls == 2, "host command called while recording");
+        check(eval(gcs, "result $total") == 208, "recorded session result");
+    }
+    /* the host command is not defined here; its results are played back */
+    for (int i = 0; i < 2; ++i) {
+        cs::state gcs;
+        cs::std_init_all(gcs);
+        auto n = gcs.replay(path);
+        check(n == 2, "number of replayed calls");
+        check(eval(gcs, "result $total") == 208, "replayed session result");
+        auto greeting = gcs.compile("result $greeting").call(gcs);
+        check(
+            std::string_view{greeting.get_string(gcs)} == "hi",
+            "replayed assignment"
+        );
+        check(gcs.get_ident("hostcmd").has_value(), "host command stubbed");
+    }
+    check(ncalls == 2, "host command not called by replay");
+    std::remove(path);
+
+    cs::state gcs;
+    bool threw = false;
+    try {
+        gcs.replay(path);
+    } catch (cs::error const &) {
+        threw = true;
+    }
+    check(threw, "missing log rejected");
+
+    return failures ? 1 : 0;
+}
@@ -49,6 +49,13 @@ int main(int argc, char **argv) {
 
     cs::state gcs;
     cs::std_init_all(gcs);
+    cs::std_init_io(gcs);
+
+    /* lets the tests read fixture files next to them */
+    std::string_view test_dir{argv[1]};
+    auto dsep = test_dir.find_last_of("/\\");
+    test_dir = (dsep == test_dir.npos) ? "." : test_dir.substr(0, dsep);
+    gcs.assign_value("test_dir", cs::any_value{test_dir, gcs});
 
     gcs.new_command("echo", "...", [](auto &s, auto args, auto &) {
         std::printf("%s\n", cs::concat_values(s, args, " ").data());
@@ -0,0 +1,68 @@
+/* shared bytecode and the resolution of its idents */
+
+#include <cstdio>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+static int ncalls = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static void setup(cs::state &cs, char const *args) {
+    cs::std_init_all(cs);
+    cs.new_command("hostcmd", args, [](auto &, auto cargs, auto &res) {
+        ++ncalls;
+        res.set_integer(cargs[0].get_integer() * 2);
+    });
+}
+
+static cs::integer_type run(cs::state &cs, cs::bcode_ref const &code) {
+    return code.call(cs).get_integer();
+}
+
+static char const *script =
+    "double = [* $arg1 2]; result (+ (double 5) (hostcmd 6))";
+
+int main() {
+    cs::state gcs;
+    setup(gcs, "i");
+    auto code = gcs.compile_shared(script);
+
+    /* the same code runs in several states, each with its own idents */
+    check(run(gcs, code) == 22, "shared code in the compiling state");
+    check(run(gcs, code) == 22, "shared code with the idents cached");
+    {
+        cs::state other;
+        setup(other, "i");
+        check(run(other, code) == 22, "shared code in another state");
+        check(
+            other.get_ident("double").has_value(),
+            "aliases created in the running state"
+        );
+    }
+
+    /* a command with another argument list does not resolve */
+    {
+        cs::state other;
+        setup(other, "s");
+        auto ocalls = ncalls;
+        bool threw = false;
+        try {
+            run(other, code);
+        } catch (cs::error const &) {
+            threw = true;
+        }
+        check(threw, "mismatched command signature rejected");
+        check(ncalls == ocalls, "nothing run with a mismatched command");
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+/* saving the state into an image and restoring it in a fresh state */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static void setup(cs::state &cs, char const *args) {
+    cs::std_init_all(cs);
+    if (args) {
+        cs.new_command("hostcmd", args, [](auto &, auto cargs, auto &res) {
+            res.set_integer(cargs[0].get_integer() + 100);
+        });
+    }
+    cs.new_var("hostvar", cs::integer_type(1));
+}
+
+static cs::integer_type eval(cs::state &cs, char const *code) {
+    return cs.compile(code).call(cs).get_integer();
+}
+
+static bool load_fails(cs::state &cs, char const *path) {
+    try {
+        cs.load_image(path);
+    } catch (cs::error const &) {
+        return true;
+    }
+    return false;
+}
+
+static bool read_file(char const *path, std::vector<unsigned char> &buf) {
+    FILE *f = std::fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    unsigned char tmp[4096];
+    std::size_t n;
+    while ((n = std::fread(tmp, 1, sizeof(tmp), f))) {
+        buf.insert(buf.end(), tmp, tmp + n);
+    }
+    std::fclose(f);
+    return true;
+}
+
+static bool write_file(char const *path, std::vector<unsigned char> &buf) {
+    FILE *f = std::fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = (std::fwrite(buf.data(), 1, buf.size(), f) == buf.size());
+    return !std::fclose(f) && ok;
+}
+
+int main() {
+    char const *path = "state.img";
+    char const *bad_path = "state_bad.img";
+    {
+        cs::state gcs;
+        setup(gcs, "i");
+        gcs.compile(
+            "double = [* $arg1 2]; greet = [concat hello $arg1]\n"
+            "usecmd = [hostcmd $arg1]; hostvar 7; counter = 3\n"
+            "broken = [(]"
+        ).call(gcs);
+        gcs.assign_value("fl", cs::any_value{cs::float_type(1.5)});
+        gcs.save_image(path);
+    }
+
+    /* everything comes back, with the code of the aliases ready to run */
+    {
+        cs::state gcs;
+        setup(gcs, "i");
+        check(gcs.load_image(path) > 6, "restored vars and aliases");
+        auto st = gcs.stats();
+        check(eval(gcs, "double 5") == 10, "alias code");
+        check(eval(gcs, "usecmd 4") == 104, "host command from an alias");
+        check(gcs.stats().code_misses == st.code_misses, "nothing compiled");
+        auto greet = gcs.compile("greet x").call(gcs);
+        check(
+            std::string_view{greet.get_string(gcs)} == "hello x",
+            "string alias"
+        );
+        check(eval(gcs, "result $hostvar") == 7, "host variable");
+        check(eval(gcs, "result $counter") == 3, "integer alias");
+        auto fl = gcs.lookup_value("fl");
+        check(fl.type() == cs::value_type::FLOAT, "float alias type");
+        check(fl.get_float() == cs::float_type(1.5), "float alias");
+        bool threw = false;
+        try {
+            eval(gcs, "broken");
+        } catch (cs::error const &) {
+            threw = true;
+        }
+        check(threw, "body that does not compile fails when called");
+    }
+
+    /* a missing or different host command changes nothing */
+    for (auto *args: {static_cast<char const *>(nullptr), "s"}) {
+        cs::state gcs;
+        setup(gcs, args);
+        check(load_fails(gcs, path), "missing host command rejected");
+        check(!gcs.get_ident("double"), "no alias restored");
+        check(eval(gcs, "result $hostvar") == 1, "no var restored");
+    }
+
+    /* bad code in the last alias is found before anything is restored */
+    std::vector<unsigned char> img;
+    check(read_file(path, img), "image readable");
+    std::uint32_t const magic = 0x43424353;
+    std::size_t last = 0;
+    for (std::size_t i = 0; (i + 4) <= img.size(); i += 4) {
+        std::uint32_t w;
+        std::memcpy(&w, &img[i], sizeof(w));
+        if (w == magic) {
+            last = i;
+        }
+    }
+    check(last != 0, "code image found");
+    /* the start of the code, past the header of the code image */
+    std::uint32_t garbage = 0xFFFFFFFF;
+    std::memcpy(&img[last + 16], &garbage, sizeof(garbage));
+    check(write_file(bad_path, img), "image writable");
+    {
+        cs::state gcs;
+        setup(gcs, "i");
+        check(load_fails(gcs, bad_path), "bad code rejected");
+        check(!gcs.get_ident("double"), "no alias restored before bad code");
+        check(eval(gcs, "result $hostvar") == 1, "no var restored");
+    }
+
+    std::remove(path);
+    std::remove(bad_path);
+    return failures ? 1 : 0;
+}
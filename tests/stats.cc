@@ -0,0 +1,94 @@
+/* runtime statistics */
+
+#include <cstdio>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    /* idents by type */
+    auto st = gcs.stats();
+    check(st.commands > 0, "commands counted");
+    gcs.new_var("somevar", cs::integer_type(1));
+    gcs.compile("somealias = 5").call(gcs);
+    auto st2 = gcs.stats();
+    check(st2.vars == st.vars + 1, "new variable counted");
+    check(st2.aliases == st.aliases + 1, "new alias counted");
+    check(st2.commands == st.commands, "no new commands");
+
+    /* every compile is counted, those requested by the host are timed,
+     * and alias calls count whether they had code at hand
+     */
+    st = gcs.stats();
+    auto code = gcs.compile("f = [result (+ $arg1 1)]; f 1; f 2; f 3");
+    st2 = gcs.stats();
+    check(st2.compiles == st.compiles + 1, "compile counted");
+    check(st2.compile_ns > st.compile_ns, "compile timed");
+    check(st2.code_blocks > st.code_blocks, "code blocks counted");
+    check(st2.code_bytes > st.code_bytes, "code bytes counted");
+    st = gcs.stats();
+    code.call(gcs);
+    st2 = gcs.stats();
+    check(st2.compiles == st.compiles + 1, "alias compile counted");
+    check(st2.compile_ns == st.compile_ns, "alias compile not timed");
+    check(st2.code_misses == st.code_misses + 1, "first call misses");
+    check(st2.code_hits == st.code_hits + 2, "later calls hit");
+
+    /* strings are interned as they are shared; a string with contents
+     * already in the pool is a hit
+     */
+    st = gcs.stats();
+    gcs.compile("s = (concatword ab cd ef); t = $s").call(gcs);
+    st2 = gcs.stats();
+    check(st2.intern_misses > st.intern_misses, "new string interned");
+    check(st2.strings > st.strings, "live strings counted");
+    check(st2.string_bytes > st.string_bytes, "string memory counted");
+    st = gcs.stats();
+    gcs.compile("u = (concatword ab cd ef); v = $u").call(gcs);
+    st2 = gcs.stats();
+    check(st2.intern_hits > st.intern_hits, "string found in the pool");
+
+    /* peaks only grow, and follow the deepest call and the largest stacks
+     * seen so far
+     */
+    st = gcs.stats();
+    gcs.compile(
+        "deep = [if (> $arg1 0) [deep (- $arg1 1)] [result 0]]; deep 50"
+    ).call(gcs);
+    st2 = gcs.stats();
+    check(st2.peak_depth >= st.peak_depth + 40, "peak call depth");
+    check(st2.peak_idstack >= 50, "peak alias stack");
+    gcs.compile("deep 5").call(gcs);
+    check(gcs.stats().peak_depth == st2.peak_depth, "peak depth kept");
+    cs::state wcs;
+    cs::std_init_all(wcs);
+    wcs.compile("wide = [result $arg1]; wide 1").call(wcs);
+    st = wcs.stats();
+    wcs.compile(
+        "wide (+ 1 (+ 2 (+ 3 (+ 4 (+ 5 (+ 6 (+ 7 (+ 8 (wide 9)))))))))"
+    ).call(wcs);
+    check(wcs.stats().peak_vmstack >= st.peak_vmstack + 8, "peak VM stack");
+
+    /* errors raised by the library */
+    st = gcs.stats();
+    try {
+        gcs.compile("error oops").call(gcs);
+    } catch (cs::error const &) {
+    }
+    check(gcs.stats().errors == st.errors + 1, "error counted");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+/* strings built in place and their interning once shared */
+
+#include <cstdio>
+#include <string_view>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    gcs.compile("s = \"\"; loop i 100 [s = (concat $s abcdefgh)]").call(gcs);
+    auto st = gcs.stats();
+    gcs.compile("loop i 100 [s = (concat $s abcdefgh)]").call(gcs);
+    check(
+        gcs.stats().intern_misses - st.intern_misses <= 101,
+        "appending in a loop interns at most once per step"
+    );
+
+    /* a string built in place compares equal to the same contents once
+     * a second reference to it exists
+     */
+    gcs.compile("t = $s").call(gcs);
+    auto sv = gcs.lookup_value("s").get_string(gcs);
+    auto tv = gcs.lookup_value("t").get_string(gcs);
+    check(sv == tv, "shared copies are the same string");
+    cs::string_ref fresh{gcs, std::string_view{sv}};
+    check(sv == fresh, "shared string found in the pool");
+    check(std::string_view{sv}.size() == 200 * 9, "built string length");
+
+    /* appending to a shared string leaves the other copy alone */
+    gcs.compile("s = (concat $s x)").call(gcs);
+    auto tv2 = gcs.lookup_value("t").get_string(gcs);
+    check(std::string_view{tv2}.size() == 200 * 9, "copy left unchanged");
+    check(tv2 == fresh, "copy still pooled");
+
+    /* the alias appended to keeps its value until the command takes it,
+     * so it is unchanged when the call fails and never seen empty
+     */
+    std::string_view seen;
+    cs::string_ref seen_ref{gcs, ""};
+    gcs.debug_hook(cs::hook_event::CALL, [&](auto &s, auto *id) {
+        if ((id->name() == "concat") || (id->name() == "strreplace")) {
+            seen_ref = s.lookup_value("u").get_string(s);
+            throw cs::error{s, "refused"};
+        }
+    });
+    char const *calls[] = {
+        "u = (concat $u world)", "u = (strreplace $u l L)"
+    };
+    for (auto *code: calls) {
+        gcs.compile("u = (concatword hel lo)").call(gcs);
+        bool thrown = false;
+        try {
+            gcs.compile(code).call(gcs);
+        } catch (cs::error const &) {
+            thrown = true;
+        }
+        seen = seen_ref;
+        check(thrown, "in-place call failed");
+        check(seen == "hello", "alias seen by a hook before the call");
+        check(
+            std::string_view{gcs.lookup_value("u").get_string(gcs)} ==
+                "hello",
+            "alias unchanged after a failed in-place call"
+        );
+    }
+    gcs.debug_hook(cs::hook_event::CALL, nullptr);
+    gcs.debug_hook(cs::hook_event::RETURN, [&](auto &s, auto *id) {
+        if (id->name() == "concat") {
+            seen_ref = s.lookup_value("u").get_string(s);
+        }
+    });
+    gcs.compile("u = (concat $u world)").call(gcs);
+    seen = seen_ref;
+    check(seen == "hello world", "alias seen by a hook after the call");
+    gcs.debug_hook(cs::hook_event::RETURN, nullptr);
+    gcs.compile("loop i 100 [u = (concat $u x)]").call(gcs);
+    st = gcs.stats();
+    gcs.compile("loop i 100 [u = (concat $u x)]").call(gcs);
+    check(
+        gcs.stats().intern_misses - st.intern_misses <= 101,
+        "appending after hooks interns at most once per step"
+    );
+    check(
+        std::string_view{gcs.lookup_value("u").get_string(gcs)}.size() ==
+            11 + 400,
+        "appended after hooks"
+    );
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+/* ident usage counters */
+
+#include <cstdio>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failures = 0;
+
+static void check(bool cond, char const *what) {
+    if (!cond) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static cs::ident_usage usage_of(cs::state &cs, char const *name) {
+    auto idx = std::size_t(cs.get_ident(name)->get().index());
+    auto usage = cs.usage();
+    if (idx >= usage.size()) {
+        return cs::ident_usage{};
+    }
+    return usage[idx];
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+    gcs.new_var("hostvar", cs::integer_type(1));
+    gcs.compile("alias used [result 5]; alias unused [result 6]").call(gcs);
+
+    /* nothing is counted until tracking is enabled */
+    gcs.compile("used").call(gcs);
+    check(!gcs.track_usage(true), "tracking off by default");
+    check(usage_of(gcs, "used").calls == 0, "calls before tracking");
+
+    gcs.compile("used; used; x = $hostvar; hostvar 2; y = $used").call(gcs);
+    gcs.compile("created = 3; z = $created").call(gcs);
+    check(usage_of(gcs, "used").calls == 2, "alias calls");
+    check(usage_of(gcs, "used").call_ns > 0, "alias call time");
+    check(usage_of(gcs, "used").lookups == 1, "alias lookups");
+    check(usage_of(gcs, "hostvar").lookups == 1, "variable lookups");
+    check(usage_of(gcs, "hostvar").assigns == 1, "variable assignments");
+    check(usage_of(gcs, "created").assigns == 1, "new alias assignment");
+    check(usage_of(gcs, "created").lookups == 1, "new alias lookup");
+
+    auto unused = usage_of(gcs, "unused");
+    check(
+        !unused.calls && !unused.lookups && !unused.assigns &&
+        !unused.call_ns,
+        "unused alias"
+    );
+
+    /* counters are kept while disabled and can be reset */
+    check(gcs.track_usage(false), "tracking was on");
+    gcs.compile("used").call(gcs);
+    check(usage_of(gcs, "used").calls == 2, "calls kept when disabled");
+    gcs.reset_usage();
+    check(usage_of(gcs, "used").calls == 0, "counters reset");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,393 @@
+/* benchmarks an alias or an expression after loading scripts
+ *
+ * every thread gets a main state of its own, loads the scripts into it and
+ * then runs the target, first to warm up and then timing every iteration;
+ * the latencies of all threads are reported together, along with what the
+ * states allocated per iteration and optionally the hardware counters
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define CS_BENCH_HAS_PERF 1
+#endif
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_opts {
+    std::vector<char const *> files;
+    char const *alias = nullptr;
+    char const *expr = nullptr;
+    long warmup = 100;
+    long iters = 10000;
+    long threads = 1;
+    bool json = false;
+    bool perf = false;
+};
+
+struct alloc_counter {
+    std::size_t allocs = 0;
+    std::size_t bytes = 0;
+};
+
+static void *counting_alloc(
+    void *data, void *p, std::size_t os, std::size_t ns
+) {
+    auto *ac = static_cast<alloc_counter *>(data);
+    if (!ns) {
+        std::free(p);
+        return nullptr;
+    }
+    ++ac->allocs;
+    if (ns > os) {
+        ac->bytes += ns - os;
+    }
+    return std::realloc(p, ns);
+}
+
+/* hardware counters of the calling thread */
+
+struct hw_counters {
+    int fds[2] = {-1, -1};
+
+    bool open() {
+#ifdef CS_BENCH_HAS_PERF
+        std::uint64_t const cfgs[2] = {
+            PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES
+        };
+        for (std::size_t i = 0; i < 2; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = cfgs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fds[i] < 0) {
+                close();
+                return false;
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void close() {
+#ifdef CS_BENCH_HAS_PERF
+        for (auto &fd: fds) {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+#endif
+    }
+
+    void start() {
+#ifdef CS_BENCH_HAS_PERF
+        for (auto fd: fds) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void stop(std::uint64_t &insns, std::uint64_t &cycles) {
+#ifdef CS_BENCH_HAS_PERF
+        std::uint64_t *outs[2] = {&insns, &cycles};
+        for (std::size_t i = 0; i < 2; ++i) {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            std::uint64_t v = 0;
+            if (read(fds[i], &v, sizeof(v)) == ssize_t(sizeof(v))) {
+                *outs[i] = v;
+            }
+        }
+#else
+        (void)insns;
+        (void)cycles;
+#endif
+    }
+};
+
+struct thread_result {
+    std::vector<double> times;
+    alloc_counter allocs;
+    std::uint64_t insns = 0;
+    std::uint64_t cycles = 0;
+    bool has_perf = false;
+    std::string error;
+};
+
+static bool read_file(char const *fname, std::string &out) {
+    FILE *f = std::fopen(fname, "rb");
+    if (!f) {
+        return false;
+    }
+    char buf[4096];
+    for (;;) {
+        auto n = std::fread(buf, 1, sizeof(buf), f);
+        out.append(buf, n);
+        if (n < sizeof(buf)) {
+            break;
+        }
+    }
+    bool ret = !std::ferror(f);
+    std::fclose(f);
+    return ret;
+}
+
+static void run_thread(bench_opts const &opts, thread_result &res) {
+    alloc_counter ac;
+    cs::state gcs{counting_alloc, &ac};
+    cs::std_init_all(gcs);
+    cs::std_init_io(gcs);
+    try {
+        for (auto *fname: opts.files) {
+            std::string src;
+            if (!read_file(fname, src)) {
+                res.error = std::string{"cannot read file: "} + fname;
+                return;
+            }
+            gcs.compile(src, fname).call(gcs);
+        }
+        cs::bcode_ref code;
+        cs::alias *target = nullptr;
+        if (opts.alias) {
+            auto id = gcs.get_ident(opts.alias);
+            if (!id || (id->get().type() != cs::ident_type::ALIAS)) {
+                res.error = std::string{"no such alias: "} + opts.alias;
+                return;
+            }
+            target = static_cast<cs::alias *>(&id->get());
+        } else {
+            code = gcs.compile(opts.expr);
+        }
+        auto run = [&]() {
+            if (target) {
+                target->call(cs::span_type<cs::any_value>{}, gcs);
+            } else {
+                code.call(gcs);
+            }
+        };
+        for (long i = 0; i < opts.warmup; ++i) {
+            run();
+        }
+        hw_counters hw;
+        res.has_perf = opts.perf && hw.open();
+        res.times.reserve(std::size_t(opts.iters));
+        auto base = ac;
+        if (res.has_perf) {
+            hw.start();
+        }
+        for (long i = 0; i < opts.iters; ++i) {
+            auto start = bench_clock::now();
+            run();
+            res.times.push_back(std::chrono::duration<double, std::micro>{
+                bench_clock::now() - start
+            }.count());
+        }
+        if (res.has_perf) {
+            hw.stop(res.insns, res.cycles);
+            hw.close();
+        }
+        res.allocs.allocs = ac.allocs - base.allocs;
+        res.allocs.bytes = ac.bytes - base.bytes;
+    } catch (cs::error const &e) {
+        res.error = std::string{e.what()};
+    }
+}
+
+static void print_json_str(char const *s) {
+    std::putchar('"');
+    for (; *s; ++s) {
+        auto c = static_cast<unsigned char>(*s);
+        if ((c == '"') || (c == '\\')) {
+            std::printf("\\%c", c);
+        } else if (c < 0x20) {
+            std::printf("\\u%04x", c);
+        } else {
+            std::putchar(c);
+        }
+    }
+    std::putchar('"');
+}
+
+static void print_usage(char const *progname) {
+    std::fprintf(
+        stderr, "usage: %s [options] (-a alias | -e expr) [file...]\n"
+        "  -a alias  call this alias every iteration\n"
+        "  -e expr   run this expression every iteration\n"
+        "  -w count  warmup iterations (default 100)\n"
+        "  -n count  timed iterations (default 10000)\n"
+        "  -t count  number of threads, each with its own state (default 1)\n"
+        "  -p        read hardware counters where supported\n"
+        "  -j        print the results as JSON\n",
+        progname
+    );
+}
+
+static bool parse_args(int argc, char **argv, bench_opts &opts) {
+    for (int i = 1; i < argc; ++i) {
+        char const *arg = argv[i];
+        if ((arg[0] != '-') || !arg[1]) {
+            opts.files.push_back(arg);
+            continue;
+        }
+        if (arg[2]) {
+            return false;
+        }
+        switch (arg[1]) {
+            case 'p':
+                opts.perf = true;
+                continue;
+            case 'j':
+                opts.json = true;
+                continue;
+            default:
+                break;
+        }
+        if ((i + 1) >= argc) {
+            return false;
+        }
+        char const *val = argv[++i];
+        switch (arg[1]) {
+            case 'a':
+                opts.alias = val;
+                break;
+            case 'e':
+                opts.expr = val;
+                break;
+            case 'w':
+                opts.warmup = std::strtol(val, nullptr, 10);
+                break;
+            case 'n':
+                opts.iters = std::strtol(val, nullptr, 10);
+                break;
+            case 't':
+                opts.threads = std::strtol(val, nullptr, 10);
+                break;
+            default:
+                return false;
+        }
+    }
+    return (
+        (!opts.alias != !opts.expr) && (opts.warmup >= 0) &&
+        (opts.iters > 0) && (opts.threads > 0)
+    );
+}
+
+int main(int argc, char **argv) {
+    bench_opts opts;
+    if (!parse_args(argc, argv, opts)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::vector<thread_result> results(std::size_t(opts.threads));
+    auto start = bench_clock::now();
+    if (opts.threads == 1) {
+        run_thread(opts, results[0]);
+    } else {
+        std::vector<std::thread> thrs;
+        for (auto &res: results) {
+            thrs.emplace_back(run_thread, std::cref(opts), std::ref(res));
+        }
+        for (auto &thr: thrs) {
+            thr.join();
+        }
+    }
+    double wall = std::chrono::duration<double, std::milli>{
+        bench_clock::now() - start
+    }.count();
+    std::vector<double> times;
+    std::size_t allocs = 0, bytes = 0;
+    std::uint64_t insns = 0, cycles = 0;
+    bool has_perf = opts.perf;
+    for (auto &res: results) {
+        if (!res.error.empty()) {
+            std::fprintf(stderr, "error: %s\n", res.error.c_str());
+            return 1;
+        }
+        times.insert(times.end(), res.times.begin(), res.times.end());
+        allocs += res.allocs.allocs;
+        bytes += res.allocs.bytes;
+        insns += res.insns;
+        cycles += res.cycles;
+        has_perf = has_perf && res.has_perf;
+    }
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (auto t: times) {
+        total += t;
+    }
+    auto n = double(times.size());
+    auto pct = [&times](double p) {
+        return times[std::size_t(double(times.size() - 1) * p)];
+    };
+    char const *target = opts.alias ? opts.alias : opts.expr;
+    if (opts.json) {
+        std::printf("{\n  \"target\": ");
+        print_json_str(target);
+        std::printf(
+            ",\n  \"threads\": %ld,\n  \"warmup\": %ld,\n"
+            "  \"iterations\": %ld,\n  \"wall_ms\": %.3f,\n"
+            "  \"min_us\": %.3f,\n  \"median_us\": %.3f,\n"
+            "  \"p99_us\": %.3f,\n  \"max_us\": %.3f,\n  \"mean_us\": %.3f,\n"
+            "  \"allocs_per_iter\": %.2f,\n  \"bytes_per_iter\": %.2f",
+            opts.threads, opts.warmup, opts.iters, wall, times.front(),
+            pct(0.5), pct(0.99), times.back(), total / n,
+            double(allocs) / n, double(bytes) / n
+        );
+        if (has_perf) {
+            std::printf(
+                ",\n  \"instructions_per_iter\": %.1f,\n"
+                "  \"cycles_per_iter\": %.1f",
+                double(insns) / n, double(cycles) / n
+            );
+        }
+        std::printf("\n}\n");
+        return 0;
+    }
+    std::printf(
+        "%s: %ld iterations x %ld threads in %.3f ms\n",
+        target, opts.iters, opts.threads, wall
+    );
+    std::printf(
+        "latency: min %.3f us, median %.3f us, p99 %.3f us, max %.3f us, "
+        "mean %.3f us\n", times.front(), pct(0.5), pct(0.99), times.back(),
+        total / n
+    );
+    std::printf(
+        "memory:  %.2f allocations, %.2f bytes per iteration\n",
+        double(allocs) / n, double(bytes) / n
+    );
+    if (has_perf) {
+        std::printf(
+            "cpu:     %.1f instructions, %.1f cycles per iteration\n",
+            double(insns) / n, double(cycles) / n
+        );
+    } else if (opts.perf) {
+        std::printf("cpu:     hardware counters not available\n");
+    }
+    return 0;
+}
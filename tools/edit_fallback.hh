@@ -7,10 +7,10 @@
 inline void init_lineedit(cs::state &, std::string_view) {
 }
 
-inline std::optional<std::string> read_line(cs::state &, cs::string_var &pr) {
+inline std::optional<std::string> read_line(cs::state &s, cs::builtin_var &pr) {
     std::string lbuf;
     char buf[512];
-    printf("%s", pr.value().data());
+    printf("%s", pr.value(s).get_string(s).data());
     std::fflush(stdout);
     while (fgets(buf, sizeof(buf), stdin)) {
         lbuf += static_cast<char const *>(buf);
@@ -18,7 +18,7 @@ inline std::optional<std::string> read_line(cs::state &, cs::string_var &pr) {
             break;
         }
     }
-    return std::move(lbuf);
+    return lbuf;
 }
 
 inline void add_history(cs::state &, std::string_view) {
@@ -0,0 +1,218 @@
+/* compiles scripts into bytecode images embedded in a C++ header
+ *
+ * every script becomes an aligned byte array, which the host passes to
+ * state::load_code_image() to run the script with no parsing at startup;
+ * the idents are referred to by name and resolved when first run, so the
+ * commands and variables the host defines are declared on the command
+ * line for the scripts to compile the same as they would in the host
+ *
+ * the images are only compatible with the same build of the library, so
+ * the tool is meant to run as a part of the build of the host, where any
+ * syntax error in the scripts fails the build
+ */
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static void print_usage(char const *progname) {
+    std::fprintf(
+        stderr, "usage: %s [options] output file...\n"
+        "  -c name:args  declare a host command taking these arguments\n"
+        "  -v name:type  declare a host variable of type i, f or s\n"
+        "  -p prefix     prefix of the array names (default cs_embed_)\n"
+        "the arrays are named by the prefix and the file name without\n"
+        "directories and extension, so those must differ between files\n",
+        progname
+    );
+}
+
+static bool read_file(char const *fname, std::string &out) {
+    FILE *f = std::fopen(fname, "rb");
+    if (!f) {
+        return false;
+    }
+    char buf[4096];
+    for (;;) {
+        auto n = std::fread(buf, 1, sizeof(buf), f);
+        out.append(buf, n);
+        if (n < sizeof(buf)) {
+            break;
+        }
+    }
+    bool ret = !std::ferror(f);
+    std::fclose(f);
+    return ret;
+}
+
+/* the file name without directories and extension, as an identifier */
+static std::string array_name(std::string_view prefix, std::string_view path) {
+    auto slash = path.find_last_of("/\\");
+    if (slash != std::string_view::npos) {
+        path.remove_prefix(slash + 1);
+    }
+    if (auto dot = path.rfind('.'); (dot != std::string_view::npos) && dot) {
+        path = path.substr(0, dot);
+    }
+    std::string ret{prefix};
+    for (auto c: path) {
+        ret.push_back(std::isalnum(static_cast<unsigned char>(c)) ? c : '_');
+    }
+    return ret;
+}
+
+/* the prefix starts every array name, so it must start an identifier */
+static bool valid_prefix(std::string_view prefix) {
+    if (prefix.empty() || std::isdigit(static_cast<unsigned char>(prefix[0]))) {
+        return false;
+    }
+    for (auto c: prefix) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && (c != '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool declare(cs::state &cs, char opt, std::string_view decl) {
+    auto colon = decl.find(':');
+    if (!colon || (colon == std::string_view::npos)) {
+        return false;
+    }
+    auto name = decl.substr(0, colon);
+    auto spec = decl.substr(colon + 1);
+    if (opt == 'c') {
+        cs.new_command(name, spec, [](auto &, auto, auto &) {});
+        return true;
+    }
+    if (spec == "i") {
+        cs.new_var(name, cs::integer_type(0));
+    } else if (spec == "f") {
+        cs.new_var(name, cs::float_type(0));
+    } else if (spec == "s") {
+        cs.new_var(name, std::string_view{});
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void append_image(
+    std::string &out, std::string_view name, std::string_view fname,
+    std::vector<unsigned char> const &img
+) {
+    char buf[16];
+    out += "\n/* ";
+    out += fname;
+    out += " */\nalignas(4) inline constexpr unsigned char ";
+    out += name;
+    out += "[] = {";
+    for (std::size_t i = 0; i < img.size(); ++i) {
+        out += (i % 12) ? " " : "\n    ";
+        std::snprintf(buf, sizeof(buf), "0x%02x,", img[i]);
+        out += buf;
+    }
+    out += "\n};\n";
+}
+
+int main(int argc, char **argv) {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+    cs::std_init_io(gcs);
+    std::string_view prefix = "cs_embed_";
+    std::vector<char const *> files;
+    char const *output = nullptr;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            char const *arg = argv[i];
+            if ((arg[0] != '-') || !arg[1]) {
+                if (!output) {
+                    output = arg;
+                } else {
+                    files.push_back(arg);
+                }
+                continue;
+            }
+            if (arg[2] || ((i + 1) >= argc)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            char const *val = argv[++i];
+            if (arg[1] == 'p') {
+                prefix = val;
+                if (!valid_prefix(prefix)) {
+                    std::fprintf(stderr, "error: invalid prefix: %s\n", val);
+                    return 1;
+                }
+            } else if (
+                ((arg[1] != 'c') && (arg[1] != 'v')) ||
+                !declare(gcs, arg[1], val)
+            ) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (cs::error const &e) {
+        std::string_view msg = e.what();
+        std::fprintf(stderr, "error: %.*s\n", int(msg.size()), msg.data());
+        return 1;
+    }
+    if (files.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::string out = "/* generated by cubescript-embed, do not edit */\n";
+    std::vector<unsigned char> img;
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        auto *fname = files[i];
+        auto &name = names.emplace_back(array_name(prefix, fname));
+        for (std::size_t j = 0; j < i; ++j) {
+            if (names[j] == name) {
+                std::fprintf(
+                    stderr, "error: %s and %s would both be embedded as %s\n",
+                    files[j], fname, name.data()
+                );
+                return 1;
+            }
+        }
+        std::string src;
+        if (!read_file(fname, src)) {
+            std::fprintf(stderr, "error: cannot read file: %s\n", fname);
+            return 1;
+        }
+        try {
+            auto code = gcs.compile_shared(src, fname);
+            img.resize(gcs.code_image(code, nullptr, 0));
+            gcs.code_image(code, img.data(), img.size());
+        } catch (cs::error const &e) {
+            std::string_view msg = e.what();
+            std::fprintf(stderr, "%.*s\n", int(msg.size()), msg.data());
+            return 1;
+        }
+        append_image(out, name, fname, img);
+    }
+    /* only write a complete header, so a failed build is not left with a
+     * stale one that looks fine
+     */
+    FILE *f = std::fopen(output, "wb");
+    if (!f) {
+        std::fprintf(stderr, "error: cannot write file: %s\n", output);
+        return 1;
+    }
+    bool ok = (std::fwrite(out.data(), 1, out.size(), f) == out.size());
+    ok = !std::fclose(f) && ok;
+    if (!ok) {
+        std::fprintf(stderr, "error: cannot write file: %s\n", output);
+        std::remove(output);
+        return 1;
+    }
+    return 0;
+}
@@ -9,6 +9,8 @@
 
 #include <signal.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cctype>
 #include <cstring>
@@ -17,6 +19,7 @@
 #include <memory>
 #include <iterator>
 #include <string>
+#include <vector>
 
 #include <cubescript/cubescript.hh>
 
@@ -157,6 +160,168 @@ inline cs::command *get_hint_cmd(cs::state &cs, std::string_view buf) {
 #include "edit_linenoise.hh"
 #include "edit_fallback.hh"
 
+/* investigation */
+
+using repl_clock = std::chrono::steady_clock;
+
+static double us_since(repl_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>{
+        repl_clock::now() - start
+    }.count();
+}
+
+static void print_top(
+    cs::state &cs, cs::ident_type tp, std::size_t n, char const *title
+) {
+    auto usage = cs.usage();
+    std::vector<std::size_t> ids;
+    for (std::size_t i = 0; i < usage.size(); ++i) {
+        if (usage[i].calls && (cs.get_ident(i).type() == tp)) {
+            ids.push_back(i);
+        }
+    }
+    auto nr = std::min(n, ids.size());
+    std::partial_sort(
+        ids.begin(), ids.begin() + nr, ids.end(),
+        [&usage](std::size_t a, std::size_t b) {
+            return usage[a].call_ns > usage[b].call_ns;
+        }
+    );
+    std::printf("top %s by time (including nested calls):\n", title);
+    for (std::size_t i = 0; i < nr; ++i) {
+        auto &u = usage[ids[i]];
+        std::printf(
+            "  %10.3f ms %10zu calls %10.3f us/call %10zu lookups  %s\n",
+            double(u.call_ns) / 1e6, u.calls,
+            double(u.call_ns) / 1e3 / double(u.calls), u.lookups,
+            cs.get_ident(ids[i]).name().data()
+        );
+    }
+}
+
+/* the investigation commands are prefixed so that they do not take names
+ * away from the scripts being investigated
+ */
+static void init_meta(cs::state &gcs) {
+    /* repl_timeit [code] iterations warmup; without a warmup count, a tenth
+     * of the iterations are run first
+     */
+    gcs.new_command("repl_timeit", "bii#", [](auto &css, auto args, auto &) {
+        auto code = args[0].get_code();
+        auto iters = args[1].get_integer();
+        auto warmup = args[2].get_integer();
+        if (iters <= 0) {
+            iters = 1000;
+        }
+        if ((args[3].get_integer() < 3) || (warmup < 0)) {
+            warmup = iters / 10;
+        }
+        for (cs::integer_type i = 0; i < warmup; ++i) {
+            code.call(css);
+        }
+        std::vector<double> times;
+        times.reserve(std::size_t(iters));
+        for (cs::integer_type i = 0; i < iters; ++i) {
+            auto start = repl_clock::now();
+            code.call(css);
+            times.push_back(us_since(start));
+        }
+        std::sort(times.begin(), times.end());
+        double total = 0;
+        for (auto t: times) {
+            total += t;
+        }
+        std::printf(
+            "%d iterations: min %.3f us, median %.3f us, mean %.3f us, "
+            "p99 %.3f us, max %.3f us\n", iters, times.front(),
+            times[times.size() / 2], total / double(iters),
+            times[std::size_t(double(times.size() - 1) * 0.99)],
+            times.back()
+        );
+    });
+
+    /* repl_profile [top]: start profiling calls, or stop and show the
+     * aliases and commands that took the most time
+     */
+    gcs.new_command("repl_profile", "i", [](auto &css, auto args, auto &) {
+        if (!css.track_usage()) {
+            css.reset_usage();
+            css.track_usage(true);
+            std::printf("profiling started\n");
+            return;
+        }
+        css.track_usage(false);
+        auto n = args[0].get_integer();
+        auto top = std::size_t((n > 0) ? n : 10);
+        print_top(css, cs::ident_type::ALIAS, top, "aliases");
+        print_top(css, cs::ident_type::COMMAND, top, "commands");
+    });
+
+    /* repl_opcodes [code]: instructions of the code by opcode */
+    gcs.new_command("repl_opcodes", "b", [](auto &css, auto args, auto &) {
+        std::vector<std::size_t> counts(cs::state::opcode_count());
+        auto total = css.code_histogram(args[0].get_code(), counts);
+        std::vector<std::size_t> ops;
+        for (std::size_t i = 0; i < counts.size(); ++i) {
+            if (counts[i]) {
+                ops.push_back(i);
+            }
+        }
+        std::stable_sort(ops.begin(), ops.end(), [&counts](
+            std::size_t a, std::size_t b
+        ) {
+            return counts[a] > counts[b];
+        });
+        for (auto op: ops) {
+            std::printf(
+                "  %8zu %5.1f%%  %s\n", counts[op],
+                100.0 * double(counts[op]) / double(total),
+                cs::state::opcode_name(op).data()
+            );
+        }
+        std::printf("  %8zu total\n", total);
+    });
+
+    /* repl_stats: statistics of the state */
+    gcs.new_command("repl_stats", "", [](auto &css, auto, auto &) {
+        auto st = css.stats();
+        std::printf(
+            "idents:   %zu vars, %zu commands, %zu aliases\n",
+            st.vars, st.commands, st.aliases
+        );
+        std::printf(
+            "strings:  %zu live (%zu pooled), %zu bytes\n",
+            st.strings, st.pooled, st.string_bytes
+        );
+        std::printf(
+            "interned: %zu hits, %zu misses\n",
+            st.intern_hits, st.intern_misses
+        );
+        std::printf(
+            "bytecode: %zu blocks, %zu bytes, %zu deduplicated\n",
+            st.code_blocks, st.code_bytes, st.code_dedups
+        );
+        std::printf(
+            "compiles: %zu, %.3f ms at top level\n", st.compiles,
+            double(st.compile_ns) / 1e6
+        );
+        std::printf(
+            "aliases:  %zu calls with code, %zu compiled first, "
+            "%zu reassigned keeping it\n",
+            st.code_hits, st.code_misses, st.code_kept
+        );
+        std::printf(
+            "regex:    %zu cached, %zu compiled\n",
+            st.regex_hits, st.regex_misses
+        );
+        std::printf(
+            "peaks:    depth %zu, vm stack %zu, alias stack %zu\n",
+            st.peak_depth, st.peak_vmstack, st.peak_idstack
+        );
+        std::printf("errors:   %zu\n", st.errors);
+    });
+}
+
 /* usage */
 
 void print_usage(std::string_view progname, bool err) {
@@ -183,8 +348,9 @@ static cs::state *scs = nullptr;
 static void do_sigint(int n) {
     /* in case another SIGINT happens, terminate normally */
     signal(n, SIG_DFL);
-    scs->call_hook([](cs::state &css) {
-        css.call_hook(nullptr);
+    scs->hook_count(1);
+    scs->debug_hook(cs::hook_event::COUNT, [](cs::state &css, cs::ident *) {
+        css.debug_hook(cs::hook_event::COUNT, nullptr);
         throw cs::error{css, "<execution interrupted>"};
     });
 }
@@ -315,6 +481,7 @@ static void do_tty(cs::state &cs) {
 int main(int argc, char **argv) {
     cs::state gcs;
     cs::std_init_all(gcs);
+    cs::std_init_io(gcs);
 
     /* this is how you can override a setter for variables; fvar and svar
      * work equivalently - in this case we want to allow multiple values
@@ -376,6 +543,8 @@ int main(int argc, char **argv) {
         std::printf("%s\n", cs::concat_values(css, args, " ").data());
     });
 
+    init_meta(gcs);
+
     int firstarg = 0;
     bool has_inter = false, has_ver = false, has_help = false;
     char const *has_str = nullptr;
@@ -0,0 +1,64 @@
+/* replays a workload recorded with state::record() */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static void print_usage(char const *progname) {
+    std::fprintf(
+        stderr, "usage: %s [-n count] log\n"
+        "  -n count  replay the log this many times (default 1)\n",
+        progname
+    );
+}
+
+int main(int argc, char **argv) {
+    long count = 1;
+    char const *path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "-n") && ((i + 1) < argc)) {
+            count = std::strtol(argv[++i], nullptr, 10);
+        } else if (!path && (argv[i][0] != '-')) {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path || (count < 1)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    double total = 0;
+    for (long i = 0; i < count; ++i) {
+        /* every run starts from scratch */
+        cs::state gcs;
+        cs::std_init_all(gcs);
+        try {
+            auto start = std::chrono::steady_clock::now();
+            auto ncalls = gcs.replay(path);
+            std::chrono::duration<double, std::milli> took{
+                std::chrono::steady_clock::now() - start
+            };
+            total += took.count();
+            std::printf(
+                "run %ld: %zu calls in %.3f ms\n", i + 1, ncalls, took.count()
+            );
+        } catch (cs::error const &e) {
+            std::string_view msg = e.what();
+            std::fprintf(
+                stderr, "replay error: %.*s\n", int(msg.size()), msg.data()
+            );
+            return 1;
+        }
+    }
+    if (count > 1) {
+        std::printf("average: %.3f ms\n", total / double(count));
+    }
+    return 0;
+}